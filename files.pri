@@ -1,5 +1,6 @@
 
 SVGUI_HEADERS += \
+           layer/BackgroundRenderThread.h \
            layer/Colour3DPlotExporter.h \
            layer/Colour3DPlotLayer.h \
            layer/Colour3DPlotRenderer.h \
@@ -12,6 +13,7 @@ SVGUI_HEADERS += \
            layer/HorizontalScaleProvider.h \
            layer/ImageLayer.h \
            layer/ImageRegionFinder.h \
+           layer/InPlaceColumnOp.h \
            layer/Layer.h \
            layer/LayerFactory.h \
            layer/LayerGeometryProvider.h \
@@ -19,13 +21,18 @@ SVGUI_HEADERS += \
            layer/LogNumericalScale.h \
            layer/LinearColourScale.h \
            layer/LogColourScale.h \
+           layer/ModelAccessLock.h \
            layer/NoteLayer.h \
            layer/PaintAssistant.h \
+           layer/PeakFrequencyCache.h \
            layer/PianoScale.h \
            layer/RegionLayer.h \
+           layer/RenderThreadPool.h \
+           layer/RenderTileDiskCache.h \
            layer/RenderTimer.h \
            layer/ScrollableImageCache.h \
            layer/ScrollableMagRangeCache.h \
+           layer/ScrollableValueCache.h \
            layer/SingleColourLayer.h \
            layer/SliceableLayer.h \
            layer/SliceLayer.h \
@@ -38,13 +45,17 @@ SVGUI_HEADERS += \
            layer/TimeValueLayer.h \
            layer/VerticalScaleLayer.h \
            layer/WaveformLayer.h \
+           layer/WaveformSummaryPrefetcher.h \
            view/AlignmentView.h \
            view/Overview.h \
            view/Pane.h \
            view/PaneStack.h \
+           view/StreamedImageWriter.h \
+           view/StreamedSvgWriter.h \
            view/View.h \
            view/ViewManager.h \
            view/ViewProxy.h \
+           view/ViewStripProxy.h \
            widgets/ActivityLog.h \
            widgets/AudioDial.h \
            widgets/ClickableLabel.h \
@@ -98,6 +109,7 @@ SVGUI_HEADERS += \
            widgets/WindowTypeSelector.h
 
 SVGUI_SOURCES += \
+           layer/BackgroundRenderThread.cpp \
            layer/Colour3DPlotExporter.cpp \
            layer/Colour3DPlotLayer.cpp \
            layer/Colour3DPlotRenderer.cpp \
@@ -108,18 +120,24 @@ SVGUI_SOURCES += \
            layer/HorizontalFrequencyScale.cpp \
            layer/ImageLayer.cpp \
            layer/ImageRegionFinder.cpp \
+           layer/InPlaceColumnOp.cpp \
            layer/Layer.cpp \
            layer/LayerFactory.cpp \
            layer/LinearNumericalScale.cpp \
            layer/LogNumericalScale.cpp \
            layer/LinearColourScale.cpp \
            layer/LogColourScale.cpp \
+           layer/ModelAccessLock.cpp \
            layer/NoteLayer.cpp \
            layer/PaintAssistant.cpp \
+           layer/PeakFrequencyCache.cpp \
            layer/PianoScale.cpp \
            layer/RegionLayer.cpp \
+           layer/RenderThreadPool.cpp \
+           layer/RenderTileDiskCache.cpp \
            layer/ScrollableImageCache.cpp \
            layer/ScrollableMagRangeCache.cpp \
+           layer/ScrollableValueCache.cpp \
            layer/SingleColourLayer.cpp \
            layer/SliceLayer.cpp \
            layer/SpectrogramLayer.cpp \
@@ -130,10 +148,13 @@ SVGUI_SOURCES += \
            layer/TimeRulerLayer.cpp \
            layer/TimeValueLayer.cpp \
            layer/WaveformLayer.cpp \
+           layer/WaveformSummaryPrefetcher.cpp \
            view/AlignmentView.cpp \
            view/Overview.cpp \
            view/Pane.cpp \
            view/PaneStack.cpp \
+           view/StreamedImageWriter.cpp \
+           view/StreamedSvgWriter.cpp \
            view/View.cpp \
            view/ViewManager.cpp \
            widgets/ActivityLog.cpp \
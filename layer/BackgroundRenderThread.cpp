@@ -0,0 +1,113 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "BackgroundRenderThread.h"
+
+#include "base/Debug.h"
+
+//#define DEBUG_BACKGROUND_RENDER_THREAD 1
+
+BackgroundRenderThread::BackgroundRenderThread() :
+    Thread(Thread::NonRTThread),
+    m_running(false),
+    m_exiting(false),
+    m_started(false)
+{
+}
+
+BackgroundRenderThread::~BackgroundRenderThread()
+{
+    m_mutex.lock();
+    m_exiting = true;
+    m_jobs.clear();
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    if (m_started) {
+        wait();
+    }
+}
+
+void
+BackgroundRenderThread::post(Job job)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_jobs.push_back(job);
+
+    if (!m_started) {
+        m_started = true;
+        start();
+    }
+
+    m_condition.wakeAll();
+}
+
+void
+BackgroundRenderThread::cancelPending()
+{
+    QMutexLocker locker(&m_mutex);
+
+#ifdef DEBUG_BACKGROUND_RENDER_THREAD
+    SVDEBUG << "BackgroundRenderThread::cancelPending: discarding "
+            << m_jobs.size() << " job(s)" << endl;
+#endif
+    
+    m_jobs.clear();
+}
+
+bool
+BackgroundRenderThread::isBusy() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_running || !m_jobs.empty();
+}
+
+void
+BackgroundRenderThread::run()
+{
+    m_mutex.lock();
+
+    while (!m_exiting) {
+
+        if (m_jobs.empty()) {
+            m_condition.wait(&m_mutex);
+            continue;
+        }
+
+        Job job = m_jobs.front();
+        m_jobs.pop_front();
+        m_running = true;
+        
+        m_mutex.unlock();
+        job();
+        m_mutex.lock();
+
+        m_running = false;
+
+#ifdef DEBUG_BACKGROUND_RENDER_THREAD
+        SVDEBUG << "BackgroundRenderThread::run: job complete, "
+                << m_jobs.size() << " job(s) remaining" << endl;
+#endif
+        
+        if (!m_exiting) {
+            m_mutex.unlock();
+            emit jobComplete();
+            m_mutex.lock();
+        }
+    }
+
+    m_mutex.unlock();
+}
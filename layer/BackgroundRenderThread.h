@@ -0,0 +1,84 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_BACKGROUND_RENDER_THREAD_H
+#define SV_BACKGROUND_RENDER_THREAD_H
+
+#include "base/Thread.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <functional>
+#include <deque>
+
+/**
+ * A worker thread that runs rendering jobs posted to it, one at a
+ * time and in the order posted, and emits jobComplete() after each
+ * one. Connecting jobComplete() to a slot in the GUI thread (such as
+ * a view's update() slot) gives a queued notification that new
+ * rendered data is available.
+ *
+ * Jobs must not touch anything that the GUI thread may modify
+ * without locking, and must not use the LayerGeometryProvider or any
+ * other widget-related object: all geometry should be calculated
+ * before the job is posted. The owner of the thread is responsible
+ * for ensuring that anything referred to by a job outlives it;
+ * deleting the thread discards any jobs not yet started and waits
+ * for the current one to finish.
+ */
+class BackgroundRenderThread : public Thread
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<void()> Job;
+
+    BackgroundRenderThread();
+    virtual ~BackgroundRenderThread();
+
+    /**
+     * Add a job to the end of the queue, starting the thread if it
+     * is not yet running.
+     */
+    void post(Job job);
+
+    /**
+     * Discard any jobs that have been posted but not yet started.
+     * Does not interrupt the job currently running, if any.
+     */
+    void cancelPending();
+
+    /**
+     * Return true if there is a job running or waiting to run.
+     */
+    bool isBusy() const;
+
+signals:
+    void jobComplete();
+
+protected:
+    void run() override;
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    std::deque<Job> m_jobs;
+    bool m_running;
+    bool m_exiting;
+    bool m_started;
+};
+
+#endif
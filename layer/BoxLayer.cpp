@@ -191,6 +191,9 @@ BoxLayer::setVerticalScale(VerticalScale scale)
 bool
 BoxLayer::isLayerScrollable(const LayerGeometryProvider *v) const
 {
+    // The illuminated feature's label is replaced by its value and
+    // time labels, rather than drawn over, so illumination happens in
+    // paint() and cannot be overlaid from paintIllumination()
     QPoint discard;
     return !v->shouldIlluminateLocalFeatures(this, discard);
 }
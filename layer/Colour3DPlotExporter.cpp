@@ -18,6 +18,41 @@
 #include "data/model/FFTModel.h"
 
 #include "VerticalBinLayer.h"
+#include "ModelAccessLock.h"
+#include "RenderThreadPool.h"
+
+#include <QIODevice>
+#include <QtEndian>
+
+#include <atomic>
+#include <functional>
+#include <cstring>
+
+using std::vector;
+
+// Number of columns prepared at a time when writing to a device. The
+// memory used is proportional to this times the number of bins
+static const int exportBatchColumns = 256;
+
+// Call f(i) for each i from 0 to n-1, sharing the calls among the
+// threads of the RenderThreadPool, each taking the next i not yet
+// claimed
+static void
+runInParallel(int n, std::function<void(int)> f)
+{
+    int threadCount = RenderThreadPool::getThreadCount();
+    if (threadCount > n) threadCount = n;
+
+    std::atomic<int> next(0);
+
+    RenderThreadPool::run(threadCount, [&](int) {
+            while (true) {
+                int i = next++;
+                if (i >= n) break;
+                f(i);
+            }
+        });
+}
 
 Colour3DPlotExporter::Colour3DPlotExporter(Sources sources, Parameters params) :
     m_sources(sources),
@@ -45,18 +80,31 @@ Colour3DPlotExporter::discardSources()
     m_sources.provider = nullptr;
 }
 
-QVector<QString>
-Colour3DPlotExporter::getStringExportHeaders(DataExportOptions opts) const
+bool
+Colour3DPlotExporter::getExportExtent(sv_frame_t startFrame,
+                                      sv_frame_t duration,
+                                      ExportExtent &extent) const
 {
-    auto model =
+    QMutexLocker locker(&m_mutex);
+
+    extent.sourceId = m_sources.source;
+    extent.model =
         ModelById::getAs<DenseThreeDimensionalModel>(m_sources.source);
-    
+    extent.fftModel =
+        ModelById::getAs<FFTModel>(m_sources.fft);
+
+    auto model = extent.model;
     auto layer = m_sources.verticalBinLayer;
     auto provider = m_sources.provider;
-    
+
     if (!model || !layer) {
-        SVCERR << "ERROR: Colour3DPlotExporter::getDelimitedDataHeaderLine: Source model and layer required" << endl;
-        return {};
+        SVCERR << "ERROR: Colour3DPlotExporter::getExportExtent: Source model and layer required" << endl;
+        return false;
+    }
+    if ((m_params.binDisplay == BinDisplay::PeakFrequencies) &&
+        !extent.fftModel) {
+        SVCERR << "ERROR: Colour3DPlotExporter::getExportExtent: FFT model required in peak frequencies mode" << endl;
+        return false;
     }
 
     int minbin = 0;
@@ -73,6 +121,49 @@ Colour3DPlotExporter::getStringExportHeaders(DataExportOptions opts) const
         if (minbin + nbins > sh) nbins = sh - minbin;
     }
 
+    extent.minbin = minbin;
+    extent.nbins = nbins;
+
+    // Column frames increase with the column index, so the columns
+    // within the requested range are contiguous
+    
+    int w = model->getWidth();
+    int first = w, count = 0;
+    
+    for (int i = 0; i < w; ++i) {
+        sv_frame_t fr = model->getStartFrame() + i * model->getResolution();
+        if (fr < startFrame || fr >= startFrame + duration) {
+            continue;
+        }
+        if (i < first) first = i;
+        ++count;
+    }
+
+    extent.firstColumn = first;
+    extent.columnCount = count;
+
+    return true;
+}
+
+QVector<QString>
+Colour3DPlotExporter::getStringExportHeaders(DataExportOptions opts) const
+{
+    // The frame range does not affect the headers
+    ExportExtent extent;
+    if (!getExportExtent(0, 0, extent)) {
+        return {};
+    }
+    return getExportHeaders(extent, opts);
+}
+
+QVector<QString>
+Colour3DPlotExporter::getExportHeaders(const ExportExtent &extent,
+                                       DataExportOptions opts) const
+{
+    auto model = extent.model;
+    int minbin = extent.minbin;
+    int nbins = extent.nbins;
+
     QVector<QString> headers;
 
     if (opts & DataExportAlwaysIncludeTimestamp) {
@@ -117,122 +208,265 @@ Colour3DPlotExporter::getStringExportHeaders(DataExportOptions opts) const
     return headers;
 }
 
-QVector<QVector<QString>>
-Colour3DPlotExporter::toStringExportRows(DataExportOptions opts,
-                                         sv_frame_t startFrame,
-                                         sv_frame_t duration) const
+void
+Colour3DPlotExporter::fetchExportColumns(const ExportExtent &extent,
+                                         int firstColumn, int n,
+                                         vector<ExportSourceColumn> &columns)
+    const
 {
-    QMutexLocker locker(&m_mutex);
+    //!!! (+ phase layer type)
 
-    BinDisplay binDisplay = m_params.binDisplay;
+    int minbin = extent.minbin;
+    int nbins = extent.nbins;
+    
+    columns.assign(n, ExportSourceColumn());
 
-    auto model =
-        ModelById::getAs<DenseThreeDimensionalModel>(m_sources.source);
-    auto fftModel =
-        ModelById::getAs<FFTModel>(m_sources.fft);
+    ModelAccessLock locker(extent.sourceId);
+    
+    for (int i = 0; i < n; ++i) {
 
-    auto layer = m_sources.verticalBinLayer;
-    auto provider = m_sources.provider;
+        auto column = extent.model->getColumn(firstColumn + i);
+        columns[i].values = ColumnOp::Column
+            (column.data() + minbin, column.data() + minbin + nbins);
 
-    if (!model || !layer) {
-        SVCERR << "ERROR: Colour3DPlotExporter::toDelimitedDataString: Source model and layer required" << endl;
-        return {};
-    }
-    if ((binDisplay == BinDisplay::PeakFrequencies) && !fftModel) {
-        SVCERR << "ERROR: Colour3DPlotExporter::toDelimitedDataString: FFT model required in peak frequencies mode" << endl;
-        return {};
+        if (m_params.binDisplay == BinDisplay::PeakFrequencies) {
+            columns[i].peaks = extent.fftModel->getPeakFrequencies
+                (FFTModel::AllPeaks, firstColumn + i,
+                 minbin, minbin + nbins - 1);
+        }
     }
+}
 
-    int minbin = 0;
-    int sh = model->getHeight();
-    int nbins = sh;
-    
-    if (provider) {
+ColumnOp::Column
+Colour3DPlotExporter::getExportColumn(const ExportSourceColumn &source) const
+{
+    // The scale factor is always applied
+    auto column = ColumnOp::applyGain(source.values, m_params.scaleFactor);
 
-        minbin = layer->getIBinForY(provider, provider->getPaintHeight());
-        if (minbin >= sh) minbin = sh - 1;
-        if (minbin < 0) minbin = 0;
-    
-        nbins = layer->getIBinForY(provider, 0) - minbin + 1;
-        if (minbin + nbins > sh) nbins = sh - minbin;
+    if (m_params.binDisplay == BinDisplay::PeakBins) {
+        column = ColumnOp::peakPick(column);
     }
 
-    int w = model->getWidth();
+    return column;
+}
 
-    QVector<QVector<QString>> rows;
+QVector<QString>
+Colour3DPlotExporter::getExportRow(const ExportExtent &extent,
+                                   DataExportOptions opts,
+                                   int i,
+                                   const ExportSourceColumn &source) const
+{
+    auto model = extent.model;
+    int minbin = extent.minbin;
     
-    for (int i = 0; i < w; ++i) {
+    sv_frame_t fr = model->getStartFrame() + i * model->getResolution();
+    
+    auto column = getExportColumn(source);
         
-        sv_frame_t fr = model->getStartFrame() + i * model->getResolution();
-        if (fr < startFrame || fr >= startFrame + duration) {
-            continue;
+    QVector<QString> row;
+ 
+    if (opts & DataExportAlwaysIncludeTimestamp) {
+        if (opts & DataExportWriteTimeInFrames) {
+            row << QString("%1").arg(fr);
+        } else {
+            row << RealTime::frame2RealTime(fr, model->getSampleRate())
+                .toString().c_str();
         }
+    }
         
-        //!!! (+ phase layer type)
+    if (m_params.binDisplay == BinDisplay::PeakFrequencies) {
+            
+        const FFTModel::PeakSet &peaks = source.peaks;
 
-        auto column = model->getColumn(i);
-        column = ColumnOp::Column(column.data() + minbin,
-                                  column.data() + minbin + nbins);
+        // We don't apply normalisation or gain to the output, but
+        // we *do* perform thresholding when exporting the
+        // peak-frequency spectrogram, to give the user an
+        // opportunity to cut irrelevant peaks. And to make that
+        // match the display, we have to apply both normalisation
+        // and gain locally for thresholding
 
-        // The scale factor is always applied
-        column = ColumnOp::applyGain(column, m_params.scaleFactor);
-        
-        QVector<QString> row;
- 
-        if (opts & DataExportAlwaysIncludeTimestamp) {
-            if (opts & DataExportWriteTimeInFrames) {
-                row << QString("%1").arg(fr);
-            } else {
-                row << RealTime::frame2RealTime(fr, model->getSampleRate())
-                    .toString().c_str();
+        auto toTest = ColumnOp::normalize(column, m_params.normalization);
+        toTest = ColumnOp::applyGain(toTest, m_params.gain);
+            
+        for (const auto &p: peaks) {
+
+            int bin = p.first;
+
+            if (toTest[bin - minbin] < m_params.threshold) {
+                continue;
             }
+
+            double freq = p.second;
+            double value = column[bin - minbin];
+                
+            row << QString("%1").arg(freq) << QString("%1").arg(value);
         }
+
+    } else {
+        for (auto value: column) {
+            row << QString("%1").arg(value);
+        }
+    }
+
+    return row;
+}
+
+QVector<QVector<QString>>
+Colour3DPlotExporter::toStringExportRows(DataExportOptions opts,
+                                         sv_frame_t startFrame,
+                                         sv_frame_t duration) const
+{
+    ExportExtent extent;
+    if (!getExportExtent(startFrame, duration, extent)) {
+        return {};
+    }
+    
+    QVector<QVector<QString>> rows;
+    vector<ExportSourceColumn> columns;
+    
+    for (int i0 = 0; i0 < extent.columnCount; i0 += exportBatchColumns) {
+
+        int n = std::min(exportBatchColumns, extent.columnCount - i0);
+        fetchExportColumns(extent, extent.firstColumn + i0, n, columns);
         
-        if (binDisplay == BinDisplay::PeakFrequencies) {
-            
-            FFTModel::PeakSet peaks = fftModel->getPeakFrequencies
-                (FFTModel::AllPeaks, i, minbin, minbin + nbins - 1);
-
-            // We don't apply normalisation or gain to the output, but
-            // we *do* perform thresholding when exporting the
-            // peak-frequency spectrogram, to give the user an
-            // opportunity to cut irrelevant peaks. And to make that
-            // match the display, we have to apply both normalisation
-            // and gain locally for thresholding
-
-            auto toTest = ColumnOp::normalize(column, m_params.normalization);
-            toTest = ColumnOp::applyGain(toTest, m_params.gain);
-            
-            for (const auto &p: peaks) {
+        for (int i = 0; i < n; ++i) {
+            auto row = getExportRow(extent, opts,
+                                    extent.firstColumn + i0 + i,
+                                    columns[i]);
+            if (!row.empty()) {
+                rows.push_back(row);
+            }
+        }
+    }
+
+    return rows;
+}
+
+bool
+Colour3DPlotExporter::writeDelimitedRows(QIODevice *device,
+                                         QString delimiter,
+                                         DataExportOptions opts,
+                                         sv_frame_t startFrame,
+                                         sv_frame_t duration) const
+{
+    ExportExtent extent;
+    if (!getExportExtent(startFrame, duration, extent)) {
+        return false;
+    }
 
-                int bin = p.first;
+    // The fields are all numbers or timestamps, so there is no need
+    // to quote them
+    auto toLine = [&](const QVector<QString> &row) {
+        return (QStringList(row.toList()).join(delimiter) + "\n").toUtf8();
+    };
+    
+    if (opts & DataExportIncludeHeader) {
+        if (device->write(toLine(getExportHeaders(extent, opts))) < 0) {
+            return false;
+        }
+    }
 
-                if (toTest[bin - minbin] < m_params.threshold) {
-                    continue;
+    vector<ExportSourceColumn> columns;
+    vector<QByteArray> lines;
+    
+    for (int i0 = 0; i0 < extent.columnCount; i0 += exportBatchColumns) {
+
+        int n = std::min(exportBatchColumns, extent.columnCount - i0);
+        fetchExportColumns(extent, extent.firstColumn + i0, n, columns);
+        lines.assign(n, QByteArray());
+
+        runInParallel(n, [&](int i) {
+                auto row = getExportRow(extent, opts,
+                                        extent.firstColumn + i0 + i,
+                                        columns[i]);
+                if (!row.empty()) {
+                    lines[i] = toLine(row);
                 }
+            });
 
-                double freq = p.second;
-                double value = column[bin - minbin];
-                
-                row << QString("%1").arg(freq) << QString("%1").arg(value);
+        for (const auto &line : lines) {
+            if (line.isEmpty()) continue;
+            if (device->write(line) < 0) {
+                SVCERR << "ERROR: Colour3DPlotExporter::writeDelimitedRows: Write failed: " << device->errorString() << endl;
+                return false;
             }
+        }
+    }
 
-        } else {
-        
-            if (binDisplay == BinDisplay::PeakBins) {
-                column = ColumnOp::peakPick(column);
-            }
+    return true;
+}
+
+bool
+Colour3DPlotExporter::writeBinaryRows(QIODevice *device,
+                                      BinaryFormat format,
+                                      sv_frame_t startFrame,
+                                      sv_frame_t duration) const
+{
+    if (m_params.binDisplay == BinDisplay::PeakFrequencies) {
+        SVCERR << "ERROR: Colour3DPlotExporter::writeBinaryRows: Peak frequency export is not available in binary formats" << endl;
+        return false;
+    }
+    
+    ExportExtent extent;
+    if (!getExportExtent(startFrame, duration, extent)) {
+        return false;
+    }
+
+    int nbins = extent.nbins;
+    
+    if (format == BinaryFormat::Npy) {
+
+        // Version 1.0 header: magic, version, little-endian 16-bit
+        // header length, then a Python dict literal padded with
+        // spaces and terminated by a newline so that the data starts
+        // on a 64-byte boundary
         
-            for (auto value: column) {
-                row << QString("%1").arg(value);
-            }
+        QByteArray dict = QString("{'descr': '<f4', 'fortran_order': False, "
+                                  "'shape': (%1, %2), }")
+            .arg(extent.columnCount).arg(nbins).toLatin1();
+
+        QByteArray preamble("\x93NUMPY\x01\x00", 8);
+        int unpadded = preamble.size() + 2 + dict.size() + 1;
+        int padding = (64 - unpadded % 64) % 64;
+        dict += QByteArray(padding, ' ');
+        dict += '\n';
+
+        quint16 headerLength = qToLittleEndian(quint16(dict.size()));
+        preamble.append(reinterpret_cast<const char *>(&headerLength), 2);
+
+        if (device->write(preamble + dict) < 0) {
+            SVCERR << "ERROR: Colour3DPlotExporter::writeBinaryRows: Write failed: " << device->errorString() << endl;
+            return false;
         }
+    }
 
-        if (!row.empty()) {
-            rows.push_back(row);
+    vector<ExportSourceColumn> columns;
+    vector<quint32> buffer;
+    
+    for (int i0 = 0; i0 < extent.columnCount; i0 += exportBatchColumns) {
+
+        int n = std::min(exportBatchColumns, extent.columnCount - i0);
+        fetchExportColumns(extent, extent.firstColumn + i0, n, columns);
+        buffer.assign(size_t(n) * nbins, 0);
+
+        runInParallel(n, [&](int i) {
+                auto column = getExportColumn(columns[i]);
+                quint32 *out = buffer.data() + size_t(i) * nbins;
+                for (int j = 0; j < nbins && j < int(column.size()); ++j) {
+                    float value = column[j];
+                    quint32 bits;
+                    memcpy(&bits, &value, sizeof(bits));
+                    out[j] = qToLittleEndian(bits);
+                }
+            });
+
+        qint64 bytes = qint64(buffer.size() * sizeof(quint32));
+        if (device->write(reinterpret_cast<const char *>(buffer.data()),
+                          bytes) != bytes) {
+            SVCERR << "ERROR: Colour3DPlotExporter::writeBinaryRows: Write failed: " << device->errorString() << endl;
+            return false;
         }
     }
 
-    return rows;
+    return true;
 }
-
@@ -17,6 +17,11 @@
 
 #include "Colour3DPlotRenderer.h"
 
+#include "data/model/FFTModel.h"
+
+class QIODevice;
+class FFTModel;
+
 class Colour3DPlotExporter : public Model
 {
     Q_OBJECT
@@ -80,6 +85,55 @@ public:
     toStringExportRows(DataExportOptions options,
                        sv_frame_t startFrame,
                        sv_frame_t duration) const override;
+
+    /**
+     * Write the rows that toStringExportRows would return to the
+     * given device as delimited text, one row per line, preceded by
+     * a line of headers if DataExportIncludeHeader is set in the
+     * options.
+     *
+     * Rather than building every row before returning, this
+     * prepares a limited number of rows at a time, fetching and
+     * formatting them on several threads, and writes each batch
+     * before starting the next, so that memory use does not grow
+     * with the length of the export. Returns false if the sources
+     * are unavailable or writing to the device fails.
+     */
+    bool writeDelimitedRows(QIODevice *device,
+                            QString delimiter,
+                            DataExportOptions options,
+                            sv_frame_t startFrame,
+                            sv_frame_t duration) const;
+
+    enum class BinaryFormat {
+        /** Little-endian 32-bit floats with no header, one row after
+         *  another. */
+        RawFloat32,
+
+        /** A NumPy .npy file (format version 1.0) containing a
+         *  two-dimensional array of little-endian 32-bit floats,
+         *  with one row per column of the source model and one
+         *  column per bin. */
+        Npy
+    };
+
+    /**
+     * Write the values that toStringExportRows would return to the
+     * given device in a binary format, for bulk analysis elsewhere.
+     * Every row has the same number of values, one per exported bin,
+     * and no timestamps are written: row n corresponds to the nth
+     * column of the source model found within the requested range.
+     * Rows are prepared in batches on several threads, as for
+     * writeDelimitedRows.
+     *
+     * Peak-frequency export is not supported in binary, as its rows
+     * vary in length. Returns false in that case, or if the sources
+     * are unavailable or writing to the device fails.
+     */
+    bool writeBinaryRows(QIODevice *device,
+                         BinaryFormat format,
+                         sv_frame_t startFrame,
+                         sv_frame_t duration) const;
     
     // Further Model methods that we just delegate
 
@@ -128,6 +182,48 @@ public:
 private:
     Sources m_sources;
     Parameters m_params;
+
+    // Everything needed to produce rows for an export, captured with
+    // m_mutex held, after which rows can be made without it (the
+    // models are kept alive by their shared pointers)
+    struct ExportExtent {
+        ModelId sourceId;
+        std::shared_ptr<DenseThreeDimensionalModel> model;
+        std::shared_ptr<FFTModel> fftModel;
+        int minbin;
+        int nbins;
+        int firstColumn;
+        int columnCount;
+    };
+
+    bool getExportExtent(sv_frame_t startFrame, sv_frame_t duration,
+                         ExportExtent &extent) const;
+
+    QVector<QString> getExportHeaders(const ExportExtent &extent,
+                                      DataExportOptions options) const;
+
+    // The model data for one exported column: the cropped column
+    // values, and the peak frequencies if exporting those
+    struct ExportSourceColumn {
+        ColumnOp::Column values;
+        FFTModel::PeakSet peaks;
+    };
+
+    // Read n columns from the models starting at firstColumn. The
+    // models are not safe to read from more than one thread at once,
+    // so this is always done on the calling thread, with the source
+    // model's access lock held; the results can then be formatted in
+    // parallel
+    void fetchExportColumns(const ExportExtent &extent,
+                            int firstColumn, int n,
+                            std::vector<ExportSourceColumn> &columns) const;
+
+    ColumnOp::Column getExportColumn(const ExportSourceColumn &source) const;
+
+    QVector<QString> getExportRow(const ExportExtent &extent,
+                                  DataExportOptions options,
+                                  int column,
+                                  const ExportSourceColumn &source) const;
 };
 
 #endif
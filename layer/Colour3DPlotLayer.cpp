@@ -23,6 +23,8 @@
 #include "LayerGeometryProvider.h"
 #include "PaintAssistant.h"
 #include "Colour3DPlotExporter.h"
+#include "ModelAccessLock.h"
+#include "RenderTileDiskCache.h"
 
 #include "data/model/Dense3DModelPeakCache.h"
 
@@ -149,6 +151,29 @@ Colour3DPlotLayer::setSynchronousPainting(bool synchronous)
     m_synchronous = synchronous;
 }
 
+void
+Colour3DPlotLayer::prepareForPainting(LayerGeometryProvider *) const
+{
+    // The peak cache is a QObject, so it must not be created first on
+    // a rendering thread
+    auto model = ModelById::getAs<DenseThreeDimensionalModel>(m_model);
+    if (model) {
+        getPeakCache();
+    }
+}
+
+void
+Colour3DPlotLayer::discardViewState(int viewId) const
+{
+    auto itr = m_renderers.find(viewId);
+    if (itr != m_renderers.end()) {
+        delete itr->second;
+        m_renderers.erase(itr);
+    }
+    m_viewMags.erase(viewId);
+    m_lastRenderedMags.erase(viewId);
+}
+
 void
 Colour3DPlotLayer::setModel(ModelId modelId)
 {
@@ -907,7 +932,12 @@ Colour3DPlotLayer::getFeatureDescription(LayerGeometryProvider *v, QPoint &pos)
         sy = model->getHeight() - sy - 1;
     }
 
-    float value = model->getValueAt(sx0, sy);
+    float value = 0.f;
+    {
+        // The renderers may be reading from the model in the background
+        ModelAccessLock locker(m_model);
+        value = model->getValueAt(sx0, sy);
+    }
 
 //    cerr << "bin value (" << sx0 << "," << sy << ") is " << value << endl;
     
@@ -1100,58 +1130,16 @@ Colour3DPlotLayer::getRenderer(const LayerGeometryProvider *v) const
         sources.verticalBinLayer = this;
         sources.source = m_model;
         sources.peakCaches.push_back(getPeakCache());
-
-        ColourScale::Parameters cparams;
-        cparams.colourMap = m_colourMap;
-        cparams.inverted = m_colourInverted;
-        cparams.scaleType = m_colourScale;
-        cparams.gain = m_gain;
-
-        double minValue = 0.0;
-        double maxValue = 1.0;
-        
-        if (m_normalizeVisibleArea && m_viewMags[viewId].isSet()) {
-            minValue = m_viewMags[viewId].getMin();
-            maxValue = m_viewMags[viewId].getMax();
-        } else if (m_normalization == ColumnNormalization::Hybrid) {
-            minValue = 0;
-            maxValue = log10(model->getMaximumLevel() + 1.0);
-        } else if (m_normalization == ColumnNormalization::None) {
-            minValue = model->getMinimumLevel();
-            maxValue = model->getMaximumLevel();
-        }
-
-        SVDEBUG << "Colour3DPlotLayer: rebuilding renderer, value range is "
-                << minValue << " -> " << maxValue
-                << " (model min = " << model->getMinimumLevel()
-                << ", max = " << model->getMaximumLevel() << ")"
-                << endl;
-
-        if (maxValue <= minValue) {
-            maxValue = minValue + 0.1f;
-
-            if (!(maxValue > minValue)) { // one of them must be NaN or Inf
-                SVCERR << "WARNING: Colour3DPlotLayer::getRenderer: resetting "
-                       << "minValue and maxValue to zero and one" << endl;
-                minValue = 0.f;
-                maxValue = 1.f;
-            }
-        }
-
-        cparams.threshold = minValue;
-        cparams.minValue = minValue;
-        cparams.maxValue = maxValue;
-        
-        m_lastRenderedMags[viewId] = MagnitudeRange(float(minValue),
-                                                    float(maxValue));
+        sources.cacheIdentity = getRenderCacheIdentity();
 
         Colour3DPlotRenderer::Parameters params;
-        params.colourScale = ColourScale(cparams);
+        params.colourScale = makeColourScale(viewId);
         params.normalization = m_normalization;
         params.binScale = m_binScale;
         params.alwaysOpaque = m_opaque;
         params.invertVertical = m_invertVertical;
         params.interpolate = m_smooth;
+        params.threadCount = 0; // one per core
 
         m_renderers[viewId] = new Colour3DPlotRenderer(sources, params);
     }
@@ -1159,6 +1147,80 @@ Colour3DPlotLayer::getRenderer(const LayerGeometryProvider *v) const
     return m_renderers[viewId];
 }
 
+ColourScale
+Colour3DPlotLayer::makeColourScale(int viewId) const
+{
+    ColourScale::Parameters cparams;
+    cparams.colourMap = m_colourMap;
+    cparams.inverted = m_colourInverted;
+    cparams.scaleType = m_colourScale;
+    cparams.gain = m_gain;
+
+    double minValue = 0.0;
+    double maxValue = 1.0;
+
+    auto model = ModelById::getAs<DenseThreeDimensionalModel>(m_model);
+        
+    if (m_normalizeVisibleArea && m_viewMags[viewId].isSet()) {
+        minValue = m_viewMags[viewId].getMin();
+        maxValue = m_viewMags[viewId].getMax();
+    } else if (!model) {
+        // leave the defaults
+    } else if (m_normalization == ColumnNormalization::Hybrid) {
+        minValue = 0;
+        maxValue = log10(model->getMaximumLevel() + 1.0);
+    } else if (m_normalization == ColumnNormalization::None) {
+        minValue = model->getMinimumLevel();
+        maxValue = model->getMaximumLevel();
+    }
+
+    SVDEBUG << "Colour3DPlotLayer: making colour scale, value range is "
+            << minValue << " -> " << maxValue << endl;
+
+    if (maxValue <= minValue) {
+        maxValue = minValue + 0.1f;
+
+        if (!(maxValue > minValue)) { // one of them must be NaN or Inf
+            SVCERR << "WARNING: Colour3DPlotLayer::makeColourScale: resetting "
+                   << "minValue and maxValue to zero and one" << endl;
+            minValue = 0.f;
+            maxValue = 1.f;
+        }
+    }
+
+    cparams.threshold = minValue;
+    cparams.minValue = minValue;
+    cparams.maxValue = maxValue;
+        
+    m_lastRenderedMags[viewId] = MagnitudeRange(float(minValue),
+                                                float(maxValue));
+
+    return ColourScale(cparams);
+}
+
+QString
+Colour3DPlotLayer::getRenderCacheIdentity() const
+{
+    // Identifies the model data for the renderer's disk tile cache.
+    // Only models loaded from a file have an identity that lasts
+    // beyond the session
+
+    auto model = ModelById::getAs<DenseThreeDimensionalModel>(m_model);
+    if (!model || !model->isOK() || !model->isReady()) return "";
+
+    // The file's size and modification time are included, so that a
+    // file replaced at the same location is not taken for the old one
+    QString file = RenderTileDiskCache::getFileIdentity(model->getLocation());
+    if (file == "") return "";
+
+    return QString("colour3dplot|%1|%2|%3|%4|%5")
+        .arg(file)
+        .arg(model->getSampleRate())
+        .arg(model->getResolution())
+        .arg(model->getWidth())
+        .arg(model->getHeight());
+}
+
 void
 Colour3DPlotLayer::paintWithRenderer(LayerGeometryProvider *v,
                                      QPainter &paint, QRect rect) const
@@ -1169,6 +1231,30 @@ Colour3DPlotLayer::paintWithRenderer(LayerGeometryProvider *v,
     MagnitudeRange magRange;
     int viewId = v->getId();
 
+    // As in SpectrogramLayer, when painting synchronously with the
+    // colour scale normalised to the visible area, find the range of
+    // the whole area first so that it is rendered only once. When
+    // painting asynchronously, the range is picked up as tiles
+    // arrive instead.
+    
+    bool prescanned = false;
+    
+    if (m_synchronous && m_normalizeVisibleArea) {
+        MagnitudeRange range = renderer->scanMagnitudeRange(v);
+        if (range.isSet()) {
+            prescanned = true;
+            m_viewMags[viewId] = range;
+            MagnitudeRange previous = m_lastRenderedMags[viewId];
+            ColourScale scale = makeColourScale(viewId);
+            if (m_lastRenderedMags[viewId] != previous &&
+                !renderer->setColourScale(scale, 0)) {
+                delete m_renderers[viewId];
+                m_renderers.erase(viewId);
+                renderer = getRenderer(v);
+            }
+        }
+    }
+
     bool continuingPaint = !renderer->geometryChanged(v);
     
     if (continuingPaint) {
@@ -1181,13 +1267,20 @@ Colour3DPlotLayer::paintWithRenderer(LayerGeometryProvider *v,
 
     } else {
 
-        result = renderer->renderTimeConstrained(v, paint, rect);
+        result = renderer->renderAsynchronous(v, paint, rect);
 
+        // If a tile is being rendered in the background, the renderer
+        // will ask for a repaint itself when it's ready
         QRect uncached = renderer->getLargestUncachedRect(v);
-        if (uncached.width() > 0) {
+        if (uncached.width() > 0 &&
+            !renderer->hasBackgroundRenderPending()) {
             v->updatePaintRect(uncached);
         }
     }
+
+    if (prescanned) {
+        return;
+    }
     
     magRange.sample(result.range);
 
@@ -1202,14 +1295,25 @@ Colour3DPlotLayer::paintWithRenderer(LayerGeometryProvider *v,
         }
     }
     
+    // An asynchronous paint of a new renderer returns no range until
+    // its first tile arrives, and there is nothing to recolour until
+    // then: discarding the renderer in that case would throw the tile
+    // away and start again indefinitely
+    
     if (!continuingPaint && m_normalizeVisibleArea &&
+        m_viewMags[viewId].isSet() &&
         m_viewMags[viewId] != m_lastRenderedMags[viewId]) {
 #ifdef DEBUG_COLOUR_3D_PLOT_LAYER_PAINT
-        SVDEBUG << "mag range has changed from last rendered range: re-rendering"
+        SVDEBUG << "mag range has changed from last rendered range: recolouring"
              << endl;
 #endif
-        delete m_renderers[viewId];
-        m_renderers.erase(viewId);
+        if (!renderer->setColourScale(makeColourScale(viewId), 0)) {
+#ifdef DEBUG_COLOUR_3D_PLOT_LAYER_PAINT
+            SVDEBUG << "can't recolour: re-rendering" << endl;
+#endif
+            delete m_renderers[viewId];
+            m_renderers.erase(viewId);
+        }
         v->updatePaintRect(v->getPaintRect());
     }
 }
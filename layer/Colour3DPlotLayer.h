@@ -55,6 +55,8 @@ public:
     void paint(LayerGeometryProvider *v,
                QPainter &paint, QRect rect) const override;
     void setSynchronousPainting(bool synchronous) override;
+    void prepareForPainting(LayerGeometryProvider *) const override;
+    void discardViewState(int viewId) const override;
 
     int getVerticalScaleWidth(LayerGeometryProvider *v,
                               bool, QPainter &) const override;
@@ -206,6 +208,8 @@ protected:
     
     Colour3DPlotRenderer *getRenderer(const LayerGeometryProvider *) const;
     void invalidateRenderers();
+    ColourScale makeColourScale(int viewId) const;
+    QString getRenderCacheIdentity() const;
         
     /**
      * Return the y coordinate at which the given bin "starts"
@@ -15,6 +15,12 @@
 
 #include "Colour3DPlotRenderer.h"
 #include "RenderTimer.h"
+#include "BackgroundRenderThread.h"
+#include "RenderTileDiskCache.h"
+#include "PeakFrequencyCache.h"
+#include "ModelAccessLock.h"
+#include "RenderThreadPool.h"
+#include "InPlaceColumnOp.h"
 
 #include "base/Profiler.h"
 #include "base/HitCount.h"
@@ -29,10 +35,17 @@
 #include "ImageRegionFinder.h"
 
 #include "view/ViewManager.h" // for main model sample rate. Pity
+#include "view/View.h"
+
+#include <QDataStream>
+#include <QCryptographicHash>
 
 #include <vector>
+#include <atomic>
+#include <algorithm>
 
 #include <utility>
+#include <cstring>
 using namespace std::rel_ops;
 
 //#define DEBUG_COLOUR_PLOT_REPAINT 1
@@ -40,6 +53,12 @@ using namespace std::rel_ops;
 
 using namespace std;
 
+Colour3DPlotRenderer::~Colour3DPlotRenderer()
+{
+    // This waits for any tile in progress, which refers to us
+    delete m_backgroundThread;
+}
+
 Colour3DPlotRenderer::RenderResult
 Colour3DPlotRenderer::render(const LayerGeometryProvider *v, QPainter &paint, QRect rect)
 {
@@ -158,6 +177,9 @@ Colour3DPlotRenderer::render(const LayerGeometryProvider *v,
 
     m_magCache.resize(v->getPaintSize().width());
     m_magCache.setZoomLevel(v->getZoomLevel());
+
+    m_valueCache.resize(v->getPaintSize());
+    m_valueCache.setZoomLevel(v->getZoomLevel());
     
     if (renderType == DirectTranslucent) {
         MagnitudeRange range = renderDirectTranslucent(v, paint, rect);
@@ -193,7 +215,7 @@ Colour3DPlotRenderer::render(const LayerGeometryProvider *v,
             count.hit();
             
             // cache is valid for the complete requested area
-            paint.drawImage(rect, m_cache.getImage(), rect);
+            m_cache.drawContents(paint, rect);
 
             MagnitudeRange range = m_magCache.getRange(x0, x1 - x0);
 
@@ -211,6 +233,7 @@ Colour3DPlotRenderer::render(const LayerGeometryProvider *v,
             // partially usable
             m_cache.scrollTo(v, startFrame);
             m_magCache.scrollTo(v, startFrame);
+            m_valueCache.scrollTo(v, startFrame);
 
             // if we are not time-constrained, then we want to paint
             // the whole area in one go; we don't return a partial
@@ -230,6 +253,7 @@ Colour3DPlotRenderer::render(const LayerGeometryProvider *v,
         count.miss();
         m_cache.setStartFrame(startFrame);
         m_magCache.setStartFrame(startFrame);
+        m_valueCache.setStartFrame(startFrame);
     }
 
     bool rightToLeft = false;
@@ -328,8 +352,14 @@ Colour3DPlotRenderer::render(const LayerGeometryProvider *v,
     }
 
     QRect pr = rect & m_cache.getValidArea();
-    paint.drawImage(pr.x(), pr.y(), m_cache.getImage(),
-                    pr.x(), pr.y(), pr.width(), pr.height());
+
+    if (timeConstrained && pr != rect) {
+        // Fill the rest with a rescaled image from another zoom
+        // level, if there is one, until it has been rendered properly
+        m_cache.drawApproximation(v, paint, rect);
+    }
+    
+    m_cache.drawContents(paint, pr);
 
     if (!timeConstrained && (pr != rect)) {
         QRect cva = m_cache.getValidArea();
@@ -362,6 +392,529 @@ Colour3DPlotRenderer::render(const LayerGeometryProvider *v,
     return { pr, range };
 }
 
+Colour3DPlotRenderer::RenderResult
+Colour3DPlotRenderer::renderAsynchronous(const LayerGeometryProvider *v,
+                                         QPainter &paint, QRect rect)
+{
+    RenderType renderType = decideRenderType(v);
+
+    if (renderType != DrawBufferPixelResolution ||
+        m_params.binDisplay == BinDisplay::PeakFrequencies) {
+        return render(v, paint, rect, true);
+    }
+    
+    int x0 = v->getXForViewX(rect.x());
+    int x1 = v->getXForViewX(rect.x() + rect.width());
+    if (x0 < 0) x0 = 0;
+    if (x1 > v->getPaintWidth()) x1 = v->getPaintWidth();
+
+    sv_frame_t startFrame = v->getStartFrame();
+
+    m_cache.resize(v->getPaintSize());
+    m_cache.setZoomLevel(v->getZoomLevel());
+
+    m_magCache.resize(v->getPaintSize().width());
+    m_magCache.setZoomLevel(v->getZoomLevel());
+
+    m_valueCache.resize(v->getPaintSize());
+    m_valueCache.setZoomLevel(v->getZoomLevel());
+
+    static HitCount count("Colour3DPlotRenderer: asynchronous image cache");
+
+    if (m_cache.isValid()) {
+        m_cache.scrollTo(v, startFrame);
+        m_magCache.scrollTo(v, startFrame);
+        m_valueCache.scrollTo(v, startFrame);
+    } else {
+        m_cache.setStartFrame(startFrame);
+        m_magCache.setStartFrame(startFrame);
+        m_valueCache.setStartFrame(startFrame);
+    }
+
+    applyCompletedTile(v);
+
+    if (m_cache.isValid() &&
+        m_cache.getValidLeft() <= x0 &&
+        m_cache.getValidRight() >= x1) {
+        count.hit();
+    } else {
+        if (m_cache.isValid()) count.partial();
+        else count.miss();
+        requestBackgroundTile(v, x0, x1);
+    }
+
+    // Every view painting through this renderer needs to know when a
+    // tile is ready, not only the one that requested it, as several
+    // views with the same geometry may share a renderer
+    if (m_backgroundThread) {
+        if (const View *view = v->getView()) {
+            QObject::connect(m_backgroundThread, SIGNAL(jobComplete()),
+                             view, SLOT(update()),
+                             Qt::UniqueConnection);
+        }
+    }
+
+    QRect pr = rect & m_cache.getValidArea();
+    if (pr != rect) {
+        m_cache.drawApproximation(v, paint, rect);
+    }
+    if (!pr.isEmpty()) {
+        m_cache.drawContents(paint, pr);
+    }
+
+    MagnitudeRange range = m_magCache.getRange(x0, x1 - x0);
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+    SVDEBUG << "render " << m_sources.source
+            << ": asynchronous render returning rect rendered as "
+            << pr.x() << "," << pr.y()
+            << " " << pr.width() << "x" << pr.height() << endl;
+#endif
+
+    return { pr, range };
+}
+
+MagnitudeRange
+Colour3DPlotRenderer::scanMagnitudeRange(const LayerGeometryProvider *v)
+{
+    Profiler profiler("Colour3DPlotRenderer::scanMagnitudeRange");
+    
+    RenderType renderType = decideRenderType(v);
+
+    if (renderType == DirectTranslucent) {
+        return MagnitudeRange(); // not cached, range found when painting
+    }
+
+    int w = v->getPaintWidth();
+    int h = v->getPaintHeight();
+    if (w <= 0 || h <= 0) {
+        return MagnitudeRange();
+    }
+
+    // Bring the range cache to the view's geometry in the same way
+    // the render functions do, so that they find the ranges we add
+    // here already in place
+    
+    m_magCache.resize(w);
+    m_magCache.setZoomLevel(v->getZoomLevel());
+    m_magCache.scrollTo(v, v->getStartFrame());
+
+    static HitCount count("Colour3DPlotRenderer: magnitude scan");
+    
+    int x = 0;
+    bool scanned = false;
+    
+    while (x < w) {
+        if (m_magCache.isColumnSet(x)) {
+            ++x;
+            continue;
+        }
+        int x0 = x;
+        while (x < w && !m_magCache.isColumnSet(x)) {
+            ++x;
+        }
+        scanMagnitudes(v, x0, x - x0);
+        scanned = true;
+    }
+
+    if (scanned) {
+        if (m_magCache.areColumnsSet(0, w)) count.partial();
+        else count.miss(); // some columns have no data at all
+    } else {
+        count.hit();
+    }
+    
+    return m_magCache.getRange(0, w);
+}
+
+void
+Colour3DPlotRenderer::scanMagnitudes(const LayerGeometryProvider *v,
+                                     int x0, int w)
+{
+    int h = v->getPaintHeight();
+    
+    vector<int> binforx;
+    vector<double> binfory;
+    if (!getPixelResolutionBinMappings(v, x0, w, h, binforx, binfory)) {
+        return;
+    }
+
+    // Read from the same peak cache that a render would use, so that
+    // the ranges come out exactly as rendering would have found
+    // them, and the cache is primed for that render
+    int peakCacheIndex = -1;
+    int binsPerPeak = -1;
+    getPreferredPeakCache(v, peakCacheIndex, binsPerPeak);
+
+    DrawBufferGeometry g;
+    if (!prepareSourceGeometry(h, binfory, peakCacheIndex, g)) {
+        return;
+    }
+    g.w = w;
+    g.binforx = &binforx;
+
+    // Only the first three stages of the column pipeline are needed
+    // here: no peak picking, distribution or colour mapping
+    
+    // This is done on the calling thread only. Almost all of the
+    // work is in reading the columns from the source, which can't be
+    // done from more than one thread at a time
+    
+    vector<MagnitudeRange> ranges(w);
+
+    int psx = -1;
+    MagnitudeRange prange;
+    for (int x = 0; x < w; ++x) {
+        int sx0, sx1;
+        if (!getSourceColumnsForX(g, x, sx0, sx1)) continue;
+        for (int sx = sx0; sx < sx1; ++sx) {
+            if (sx < 0 || sx >= g.modelWidth) {
+                continue;
+            }
+            if (sx != psx) {
+                prange = MagnitudeRange();
+                prange.sample(getColumn(sx, g.minbin, g.nbins,
+                                        g.sourceModel));
+                psx = sx;
+            }
+            ranges[x].sample(prange);
+        }
+    }
+
+    for (int x = 0; x < w; ++x) {
+        if (ranges[x].isSet()) {
+            m_magCache.sampleColumn(x0 + x, ranges[x]);
+        }
+    }
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+    SVDEBUG << "render " << m_sources.source
+            << ": scanned magnitudes for " << w << " columns from "
+            << x0 << endl;
+#endif
+}
+
+bool
+Colour3DPlotRenderer::hasBackgroundRenderPending() const
+{
+    QMutexLocker locker(&m_tileMutex);
+    return m_pendingTile || m_completedTile;
+}
+
+void
+Colour3DPlotRenderer::requestBackgroundTile(const LayerGeometryProvider *v,
+                                            int x0, int x1)
+{
+    {
+        QMutexLocker locker(&m_tileMutex);
+        if (m_pendingTile || m_completedTile) {
+            // one at a time
+            return;
+        }
+    }
+
+    int left = x0;
+    int width = x1 - x0;
+    bool rightToLeft = false;
+    
+    if (m_cache.isValid()) {
+        // The tile has to adjoin the valid area, as for a partial
+        // render in renderTimeConstrained
+        m_cache.adjustToTouchValidArea(left, width, rightToLeft);
+    }
+
+    if (width <= 0) return;
+
+    // Aim for tiles that take something like 50ms each, so that the
+    // cache fills visibly while the view remains responsive to
+    // geometry changes (a tile in progress is not interrupted)
+
+    int tileWidth = 128;
+    if (m_secondsPerXPixelValid && m_secondsPerXPixel > 0.0) {
+        tileWidth = int(0.05 / m_secondsPerXPixel);
+    }
+    if (tileWidth < 32) tileWidth = 32;
+
+    ZoomLevel zoomLevel = v->getZoomLevel();
+    
+    if (getDiskCache() && zoomLevel.zone == ZoomLevel::FramesPerPixel) {
+        // Tiles can only be found again in the disk cache if they
+        // cover the same frames next time. At this zoom, every x
+        // coordinate starts on a multiple of the zoom level, so we
+        // use a fixed tile width and align tiles to a grid fixed
+        // relative to frame zero, rather than to the view.
+        tileWidth = 128;
+        int edge = (rightToLeft ? left + width : left);
+        sv_frame_t column = v->getFrameForX(edge) / zoomLevel.level;
+        int phase = int(((column % tileWidth) + tileWidth) % tileWidth);
+        if (rightToLeft) {
+            if (phase > 0) tileWidth = phase;
+        } else {
+            tileWidth -= phase;
+        }
+    }
+    
+    if (tileWidth > width) tileWidth = width;
+
+    if (rightToLeft) {
+        left = left + width - tileWidth;
+    }
+
+    int h = v->getPaintHeight();
+    
+    auto tile = std::make_shared<BackgroundTile>();
+    tile->startFrame = v->getStartFrame();
+    tile->zoomLevel = zoomLevel;
+    tile->size = v->getPaintSize();
+    tile->left = left;
+    tile->width = tileWidth;
+    tile->attainedWidth = 0;
+    tile->secondsPerXPixel = 0.0;
+
+    if (!getPixelResolutionBinMappings(v, left, tileWidth, h,
+                                       tile->binforx, tile->binfory)) {
+        return;
+    }
+
+    int binsPerPeak = -1;
+    getPreferredPeakCache(v, tile->peakCacheIndex, binsPerPeak);
+
+    tile->colourScale = m_params.colourScale;
+    tile->colourGeneration = m_colourGeneration;
+    tile->image = createDrawBufferImage(tileWidth, h);
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+    SVDEBUG << "render " << m_sources.source
+            << ": requesting background tile at " << left
+            << " of width " << tileWidth << " (requested range "
+            << x0 << " -> " << x1 << ")" << endl;
+#endif
+
+    if (!m_backgroundThread) {
+        m_backgroundThread = new BackgroundRenderThread;
+    }
+
+    {
+        QMutexLocker locker(&m_tileMutex);
+        m_pendingTile = tile;
+    }
+
+    m_backgroundThread->post([this, tile]() {
+            renderBackgroundTile(*tile);
+            QMutexLocker locker(&m_tileMutex);
+            if (m_pendingTile == tile) {
+                m_pendingTile.reset();
+                m_completedTile = tile;
+            }
+        });
+}
+
+void
+Colour3DPlotRenderer::renderBackgroundTile(BackgroundTile &tile) const
+{
+    // Called on the background thread. Must use only the tile and
+    // the things that are fixed for the lifetime of the renderer
+    // (sources and parameters other than the colour scale, for which
+    // the tile has its own copy)
+    
+    Profiler profiler("Colour3DPlotRenderer::renderBackgroundTile");
+
+    RenderTimer timer(RenderTimer::NoTimeout);
+
+    RenderTileDiskCache *diskCache = getDiskCache();
+    QString key;
+
+    static HitCount count("Colour3DPlotRenderer: disk tile cache");
+    
+    if (diskCache) {
+        key = getDiskCacheKey(tile);
+        if (diskCache->retrieve(key, tile.image, tile.magRanges)) {
+            count.hit();
+            tile.attainedWidth = tile.width;
+            tile.secondsPerXPixel = 0.0;
+            return;
+        }
+    }
+    
+    DrawBufferGeometry g;
+    vector<uchar> columns;
+    if (!prepareDrawBufferGeometry(tile.width, tile.image.height(),
+                                   tile.binforx, tile.binfory,
+                                   tile.peakCacheIndex, tile.colourScale,
+                                   columns, tile.values, tile.drawn, g)) {
+        return;
+    }
+
+    tile.attainedWidth = renderDrawBufferParallel
+        (g, getColumnReaders(g), false, timer, tile.magRanges);
+
+    transposeDrawBufferColumns(g, tile.attainedWidth, false, tile.image);
+
+    tile.secondsPerXPixel = timer.secondsPerItem(tile.attainedWidth);
+
+    if (diskCache) {
+        count.miss();
+        if (tile.attainedWidth == tile.width) {
+            diskCache->store(key, tile.image, tile.magRanges);
+        }
+    }
+}
+
+RenderTileDiskCache *
+Colour3DPlotRenderer::getDiskCache() const
+{
+    if (m_sources.cacheIdentity == "") return nullptr;
+    return RenderTileDiskCache::getInstance();
+}
+
+QString
+Colour3DPlotRenderer::getDiskCacheKey(const BackgroundTile &tile) const
+{
+    // The key must cover everything that affects the colour indices
+    // and magnitude ranges in a rendered tile. The colour map and
+    // rotation only affect the image's colour table, which is not
+    // stored, so they are left out. The bin mappings capture both the
+    // horizontal position and zoom and the vertical scale and extent.
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+
+    const int keyFormatVersion = 1;
+    
+    ColourScale::Parameters cparams = tile.colourScale.getParameters();
+
+    stream << keyFormatVersion
+           << m_sources.cacheIdentity
+           << int(cparams.scaleType)
+           << cparams.minValue
+           << cparams.maxValue
+           << cparams.threshold
+           << cparams.gain
+           << cparams.multiple
+           << int(m_params.normalization)
+           << int(m_params.binDisplay)
+           << int(m_params.binScale)
+           << m_params.interpolate
+           << m_params.invertVertical
+           << m_params.showDerivative
+           << m_params.scaleFactor
+           << tile.peakCacheIndex
+           << tile.width
+           << tile.image.height();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(data);
+    hash.addData(reinterpret_cast<const char *>(tile.binforx.data()),
+                 int(tile.binforx.size() * sizeof(int)));
+    hash.addData(reinterpret_cast<const char *>(tile.binfory.data()),
+                 int(tile.binfory.size() * sizeof(double)));
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+void
+Colour3DPlotRenderer::applyCompletedTile(const LayerGeometryProvider *v)
+{
+    std::shared_ptr<BackgroundTile> tile;
+    
+    {
+        QMutexLocker locker(&m_tileMutex);
+        tile = m_completedTile;
+        m_completedTile.reset();
+    }
+
+    if (!tile || tile->attainedWidth == 0) return;
+
+    if (tile->secondsPerXPixel > 0.0) {
+        // (not if the tile was loaded from the disk cache)
+        updateTimings(tile->secondsPerXPixel, tile->attainedWidth);
+    }
+
+    if (tile->size != m_cache.getSize() ||
+        tile->zoomLevel != m_cache.getZoomLevel()) {
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+        SVDEBUG << "render " << m_sources.source
+                << ": discarding background tile for outdated geometry"
+                << endl;
+#endif
+        return;
+    }
+
+    int h = tile->image.height();
+    
+    if (tile->colourGeneration != m_colourGeneration) {
+
+        // The colour scale has changed since the tile was requested
+        
+        if (tile->values.empty()) {
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+            SVDEBUG << "render " << m_sources.source
+                    << ": discarding background tile for outdated colour "
+                    << "scale" << endl;
+#endif
+            return;
+        }
+
+        tile->image = createDrawBufferImage(tile->width, h);
+        uchar *bits = tile->image.bits();
+        int bytesPerLine = tile->image.bytesPerLine();
+        vector<uchar> pixels(h);
+        
+        for (int x = 0; x < tile->attainedWidth; ++x) {
+            if (!tile->drawn[x]) continue;
+            m_params.colourScale.getPixels
+                (tile->values.data() + size_t(x) * h, h, pixels.data());
+            for (int y = 0; y < h; ++y) {
+                bits[y * bytesPerLine + x] = pixels[y];
+            }
+        }
+    }
+
+    // The tile's coordinates are relative to the view start frame at
+    // the time it was requested; the cache may have scrolled since
+
+    int dx = v->getXForFrame(tile->startFrame) -
+        v->getXForFrame(m_cache.getStartFrame());
+    
+    int left = tile->left + dx;
+    int width = tile->attainedWidth;
+    int imageLeft = 0;
+
+    if (left < 0) {
+        imageLeft = -left;
+        width += left;
+        left = 0;
+    }
+    if (left + width > m_cache.getSize().width()) {
+        width = m_cache.getSize().width() - left;
+    }
+    if (width <= 0) return;
+
+    m_cache.drawImage(left, width, tile->image, imageLeft, width);
+
+    if (tile->values.empty()) {
+        m_valueCache.unsetColumns(left, width);
+    } else {
+        storeColumnValues(left, width, h,
+                          tile->values.data(), tile->drawn.data(), imageLeft);
+    }
+
+    for (int i = 0; i < width; ++i) {
+        int ix = imageLeft + i;
+        if (in_range_for(tile->magRanges, ix)) {
+            m_magCache.sampleColumn(left + i, tile->magRanges.at(ix));
+        }
+    }
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+    SVDEBUG << "render " << m_sources.source
+            << ": applied background tile at " << left << " of width "
+            << width << "; cache valid area now "
+            << m_cache.getValidLeft() << " -> " << m_cache.getValidRight()
+            << endl;
+#endif
+}
+
 bool
 Colour3DPlotRenderer::getBinResolutions(const LayerGeometryProvider *v,
                                         int &binResolution,
@@ -457,7 +1010,20 @@ Colour3DPlotRenderer::decideRenderType(const LayerGeometryProvider *v) const
 
 ColumnOp::Column
 Colour3DPlotRenderer::getColumn(int sx, int minbin, int nbins,
-                                shared_ptr<DenseThreeDimensionalModel> source) const
+                                shared_ptr<DenseThreeDimensionalModel> source,
+                                const ColumnReader *reader) const
+{
+    ColumnOp::Column column, work;
+    getColumnInto(column, work, sx, minbin, nbins, source, reader);
+    return column;
+}
+
+void
+Colour3DPlotRenderer::getColumnInto(ColumnOp::Column &column,
+                                    ColumnOp::Column &work,
+                                    int sx, int minbin, int nbins,
+                                    shared_ptr<DenseThreeDimensionalModel> source,
+                                    const ColumnReader *reader) const
 {
     // order:
     // get column -> scale -> normalise -> record extents ->
@@ -466,54 +1032,77 @@ Colour3DPlotRenderer::getColumn(int sx, int minbin, int nbins,
     // we do the first bit here:
     // get column -> scale -> normalise
 
-    ColumnOp::Column column;
-    
     if (m_params.showDerivative && sx > 0) {
 
-        auto prev = getColumnRaw(sx - 1, minbin, nbins, source);
-        column = getColumnRaw(sx, minbin, nbins, source);
+        getColumnRawInto(work, sx - 1, minbin, nbins, source, reader);
+        getColumnRawInto(column, sx, minbin, nbins, source, reader);
         
         for (int i = 0; i < nbins; ++i) {
-            column[i] -= prev[i];
+            column[i] -= work[i];
         }
 
     } else {
-        column = getColumnRaw(sx, minbin, nbins, source);
+        getColumnRawInto(column, sx, minbin, nbins, source, reader);
     }
 
-    if (m_params.colourScale.getScale() == ColourScaleType::Phase &&
-        !m_sources.fft.isNone()) {
-        return column;
-    } else {
-        column = ColumnOp::applyGain(column, m_params.scaleFactor);
-        column = ColumnOp::normalize(column, m_params.normalization);
-        return column;
+    if (m_phaseColumns && !m_sources.fft.isNone()) {
+        return;
     }
+
+    InPlaceColumnOp::applyGain(column, m_params.scaleFactor);
+    InPlaceColumnOp::normalize(column, m_params.normalization);
 }
 
-ColumnOp::Column
-Colour3DPlotRenderer::getColumnRaw(int sx, int minbin, int nbins,
-                                   shared_ptr<DenseThreeDimensionalModel> source) const
+void
+Colour3DPlotRenderer::getColumnRawInto(ColumnOp::Column &column,
+                                       int sx, int minbin, int nbins,
+                                       shared_ptr<DenseThreeDimensionalModel> source,
+                                       const ColumnReader *reader) const
 {
     Profiler profiler("Colour3DPlotRenderer::getColumn");
 
-    ColumnOp::Column column;
-    ColumnOp::Column fullColumn;
+    if (reader && reader->fft) {
+
+        // This thread's own copy of the FFT model, which is also the
+        // source. Another renderer may be using it at the same time,
+        // but nothing else will. Read just the bins we want, straight
+        // into the column
+        ModelAccessLock locker(reader->id);
 
-    if (m_params.colourScale.getScale() == ColourScaleType::Phase) {
-        auto fftModel = ModelById::getAs<FFTModel>(m_sources.fft);
-        if (fftModel) {
-            fullColumn = fftModel->getPhases(sx);
+        column.resize(nbins);
+        if (nbins > 0) {
+            if (m_phaseColumns) {
+                reader->fft->getPhasesAt(sx, column.data(), minbin, nbins);
+            } else {
+                reader->fft->getMagnitudesAt(sx, column.data(), minbin, nbins);
+            }
         }
+        return;
     }
 
-    if (fullColumn.empty()) {
-        fullColumn = source->getColumn(sx);
+    column.clear();
+    
+    {
+        // The source, FFT and peak cache models all derive from the
+        // source, and none is safe to read from several threads at
+        // once
+        ModelAccessLock locker(m_sources.source);
+
+        if (m_phaseColumns) {
+            auto fftModel = ModelById::getAs<FFTModel>(m_sources.fft);
+            if (fftModel) {
+                column = fftModel->getPhases(sx);
+            }
+        }
+
+        if (column.empty()) {
+            column = source->getColumn(sx);
+        }
     }
     
-    column = ColumnOp::Column(fullColumn.data() + minbin,
-                              fullColumn.data() + minbin + nbins);
-    return column;
+    // Trim in place rather than copying into a new column
+    column.resize(minbin + nbins);
+    column.erase(column.begin(), column.begin() + minbin);
 }
 
 MagnitudeRange
@@ -661,7 +1250,11 @@ Colour3DPlotRenderer::renderDirectTranslucent(const LayerGeometryProvider *v,
             paint.drawRect(r);
 
             if (showLabel) {
-                double value = model->getValueAt(sx, sy);
+                double value = 0.0;
+                {
+                    ModelAccessLock locker(m_sources.source);
+                    value = model->getValueAt(sx, sy);
+                }
                 snprintf(labelbuf, buflen, "%06f", value);
                 QString text(labelbuf);
                 PaintAssistant::drawVisibleText
@@ -730,7 +1323,39 @@ Colour3DPlotRenderer::getPreferredPeakCache(const LayerGeometryProvider *v,
 #endif
 }
 
-void
+bool
+Colour3DPlotRenderer::getPixelResolutionBinMappings(const LayerGeometryProvider *v,
+                                                    int x0, int w, int h,
+                                                    vector<int> &binforx,
+                                                    vector<double> &binfory)
+    const
+{
+    binforx = vector<int>(w, -1);
+    binfory = vector<double>(h);
+
+    auto model = ModelById::getAs<DenseThreeDimensionalModel>(m_sources.source);
+    if (!model) return false;
+    
+    int binResolution;
+    double renderBinResolution;
+    if (!getBinResolutions(v, binResolution, renderBinResolution)) {
+        return false;
+    }
+
+    for (int x = 0; x < w; ++x) {
+        sv_frame_t f0 = v->getFrameForX(x0 + x);
+        double s0 = double(f0 - model->getStartFrame()) / renderBinResolution;
+        binforx[x] = int(s0 + 0.0001);
+    }
+
+    for (int y = 0; y < h; ++y) {
+        binfory[y] = m_sources.verticalBinLayer->getBinForY(v, h - y - 1);
+    }
+
+    return true;
+}
+
+void
 Colour3DPlotRenderer::renderToCachePixelResolution(const LayerGeometryProvider *v,
                                                    int x0, int repaintWidth,
                                                    bool rightToLeft,
@@ -753,27 +1378,18 @@ Colour3DPlotRenderer::renderToCachePixelResolution(const LayerGeometryProvider *
 
     clearDrawBuffer(repaintWidth, h);
 
-    vector<int> binforx(repaintWidth);
-    vector<double> binfory(h);
-    
-    int binResolution;
-    double renderBinResolution;
-    if (!getBinResolutions(v, binResolution, renderBinResolution)) return;
+    vector<int> binforx;
+    vector<double> binfory;
 
-    for (int x = 0; x < repaintWidth; ++x) {
-        sv_frame_t f0 = v->getFrameForX(x0 + x);
-        double s0 = double(f0 - model->getStartFrame()) / renderBinResolution;
-        binforx[x] = int(s0 + 0.0001);
+    if (!getPixelResolutionBinMappings(v, x0, repaintWidth, h,
+                                       binforx, binfory)) {
+        return;
     }
 
     int peakCacheIndex = -1;
     int binsPerPeak = -1;
 
     getPreferredPeakCache(v, peakCacheIndex, binsPerPeak);
-    
-    for (int y = 0; y < h; ++y) {
-        binfory[y] = m_sources.verticalBinLayer->getBinForY(v, h - y - 1);
-    }
 
     int attainedWidth;
 
@@ -809,15 +1425,49 @@ Colour3DPlotRenderer::renderToCachePixelResolution(const LayerGeometryProvider *
                       m_drawBuffer,
                       paintedLeft - x0, attainedWidth);
 
+    if (m_params.binDisplay == BinDisplay::PeakFrequencies) {
+        m_valueCache.unsetColumns(paintedLeft, attainedWidth);
+    } else {
+        storeColumnValues(paintedLeft, attainedWidth, h,
+                          m_drawBufferValues.data(),
+                          m_drawBufferDrawn.data(),
+                          paintedLeft - x0);
+    }
+
     for (int i = 0; in_range_for(m_magRanges, i); ++i) {
         m_magCache.sampleColumn(i, m_magRanges.at(i));
     }
 }
 
+static inline QRgb
+interpolatePixel(QRgb a, QRgb b, uint f)
+{
+    // Mix two premultiplied pixels, with weight f/256 for b: the red
+    // and blue channels are handled together in one word, then alpha
+    // and green in another, each channel in its own 16-bit lane
+    uint g = 256 - f;
+    uint rb = (((a & 0xff00ff) * g + (b & 0xff00ff) * f) >> 8) & 0xff00ff;
+    uint ag = (((a >> 8) & 0xff00ff) * g + ((b >> 8) & 0xff00ff) * f)
+        & 0xff00ff00;
+    return rb | ag;
+}
+
 QImage
 Colour3DPlotRenderer::scaleDrawBufferImage(QImage image,
                                            int targetWidth,
                                            int targetHeight) const
+{
+    return scaleIndexedImage(image, targetWidth, targetHeight,
+                             m_params.interpolate,
+                             getRenderThreadCount(targetHeight));
+}
+
+QImage
+Colour3DPlotRenderer::scaleIndexedImage(QImage image,
+                                        int targetWidth,
+                                        int targetHeight,
+                                        bool interpolate,
+                                        int threadCount)
 {
     int sourceWidth = image.width();
     int sourceHeight = image.height();
@@ -829,65 +1479,144 @@ Colour3DPlotRenderer::scaleDrawBufferImage(QImage image,
     // should be using DrawBufferPixelResolution mode instead
     
     if (targetWidth < sourceWidth || targetHeight < sourceHeight) {
-        SVCERR << "ERROR: Colour3DPlotRenderer::scaleDrawBufferImage: "
+        SVCERR << "ERROR: Colour3DPlotRenderer::scaleIndexedImage: "
                << "targetWidth " << targetWidth
                << " < sourceWidth " << sourceWidth
                << " or targetHeight " << targetHeight
                << " < sourceHeight " << sourceHeight << endl;
-        throw std::logic_error("Colour3DPlotRenderer::scaleDrawBufferImage: Can only use this function when making the image larger; should be rendering DrawBufferPixelResolution instead");
+        throw std::logic_error("Colour3DPlotRenderer::scaleIndexedImage: Can only use this function when making the image larger; should be rendering DrawBufferPixelResolution instead");
     }
 
     if (sourceWidth <= 0 || sourceHeight <= 0) {
-        throw std::logic_error("Colour3DPlotRenderer::scaleDrawBufferImage: Source image is empty");
+        throw std::logic_error("Colour3DPlotRenderer::scaleIndexedImage: Source image is empty");
     }
 
     if (targetWidth <= 0 || targetHeight <= 0) {
-        throw std::logic_error("Colour3DPlotRenderer::scaleDrawBufferImage: Target image is empty");
+        throw std::logic_error("Colour3DPlotRenderer::scaleIndexedImage: Target image is empty");
     }        
 
     // This function exists because of some unpredictable behaviour
-    // from Qt when scaling images with FastTransformation mode. We
-    // continue to use Qt's scaler for SmoothTransformation but let's
-    // bring the non-interpolated version "in-house" so we know what
-    // it's really doing.
-    
-    if (m_params.interpolate) {
-        return image.scaled(targetWidth, targetHeight,
-                            Qt::IgnoreAspectRatio,
-                            Qt::SmoothTransformation);
+    // from Qt when scaling images with FastTransformation mode, and
+    // because Qt's SmoothTransformation scaler first converts the
+    // whole indexed image to 32-bit before scaling it. Here each
+    // pixel is expanded through the colour table only as it is
+    // needed, using a premultiplied copy of the table built once.
+
+    vector<QRgb> palette(256, qRgb(0, 0, 0));
+    QVector<QRgb> table = image.colorTable();
+    for (int i = 0; i < 256 && i < table.size(); ++i) {
+        palette[i] = qPremultiply(table[i]);
     }
     
     // Same format as the target cache
     QImage target(targetWidth, targetHeight,
                   QImage::Format_ARGB32_Premultiplied);
 
-    for (int y = 0; y < targetHeight; ++y) {
-
-        QRgb *targetLine = reinterpret_cast<QRgb *>(target.scanLine(y));
-        
-        int sy = int((uint64_t(y) * sourceHeight) / targetHeight);
-        if (sy == sourceHeight) --sy;
+    uchar *targetBits = target.bits();
+    int targetBytesPerLine = target.bytesPerLine();
 
-        // The source image is 8-bit indexed
-        const uchar *sourceLine = image.constScanLine(sy);
+    if (!interpolate) {
 
-        int psx = -1;
-        QRgb colour = {};
-        
+        vector<int> sxs(targetWidth);
         for (int x = 0; x < targetWidth; ++x) {
-
             int sx = int((uint64_t(x) * sourceWidth) / targetWidth);
             if (sx == sourceWidth) --sx;
+            sxs[x] = sx;
+        }
 
-            if (sx > psx) {
-                colour = image.color(sourceLine[sx]);
+        int psy = -1;
+        
+        for (int y = 0; y < targetHeight; ++y) {
+
+            QRgb *targetLine =
+                reinterpret_cast<QRgb *>(targetBits + y * targetBytesPerLine);
+        
+            int sy = int((uint64_t(y) * sourceHeight) / targetHeight);
+            if (sy == sourceHeight) --sy;
+
+            if (sy == psy) {
+                // Same source row as the last target row
+                memcpy(targetLine, targetBits + (y-1) * targetBytesPerLine,
+                       targetWidth * sizeof(QRgb));
+                continue;
             }
-            
-            targetLine[x] = colour;
-            psx = sx;
+
+            // The source image is 8-bit indexed
+            const uchar *sourceLine = image.constScanLine(sy);
+        
+            for (int x = 0; x < targetWidth; ++x) {
+                targetLine[x] = palette[sourceLine[sxs[x]]];
+            }
+
+            psy = sy;
         }
+
+        return target;
     }
 
+    // Bilinear interpolation, with pixel centres aligned as in Qt's
+    // smooth scaler. Each target pixel is a weighted mix of two
+    // adjacent source pixels in each direction, the weights being
+    // in 1/256ths
+    
+    struct Sample {
+        int i0;
+        int i1;
+        uint f; // weight of i1
+    };
+    
+    auto makeSamples = [](int sourceSize, int targetSize) {
+        vector<Sample> samples(targetSize);
+        for (int i = 0; i < targetSize; ++i) {
+            int64_t pos = ((2 * int64_t(i) + 1) * sourceSize * 256) /
+                (2 * int64_t(targetSize)) - 128;
+            if (pos < 0) pos = 0;
+            int i0 = int(pos >> 8);
+            if (i0 >= sourceSize - 1) {
+                samples[i] = { sourceSize - 1, sourceSize - 1, 0 };
+            } else {
+                samples[i] = { i0, i0 + 1, uint(pos & 255) };
+            }
+        }
+        return samples;
+    };
+
+    vector<Sample> xs = makeSamples(sourceWidth, targetWidth);
+    vector<Sample> ys = makeSamples(sourceHeight, targetHeight);
+
+    // Each thread scales a contiguous run of target rows: first
+    // mixing the two source rows into a single expanded row, then
+    // mixing across that row
+    
+    auto scaleRows = [&](int y0, int y1) {
+        vector<QRgb> row(sourceWidth);
+        for (int y = y0; y < y1; ++y) {
+            const Sample &sy = ys[y];
+            const uchar *line0 = image.constScanLine(sy.i0);
+            const uchar *line1 = image.constScanLine(sy.i1);
+            for (int sx = 0; sx < sourceWidth; ++sx) {
+                row[sx] = interpolatePixel
+                    (palette[line0[sx]], palette[line1[sx]], sy.f);
+            }
+            QRgb *targetLine =
+                reinterpret_cast<QRgb *>(targetBits + y * targetBytesPerLine);
+            for (int x = 0; x < targetWidth; ++x) {
+                const Sample &sx = xs[x];
+                targetLine[x] = interpolatePixel
+                    (row[sx.i0], row[sx.i1], sx.f);
+            }
+        }
+    };
+    
+    if (threadCount < 1) threadCount = 1;
+    int perThread = (targetHeight + threadCount - 1) / threadCount;
+
+    RenderThreadPool::run(threadCount, [&](int t) {
+            int y0 = std::min(t * perThread, targetHeight);
+            int y1 = std::min(y0 + perThread, targetHeight);
+            scaleRows(y0, y1);
+        });
+
     return target;
 }
 
@@ -1058,6 +1787,9 @@ Colour3DPlotRenderer::renderToCacheBinResolution(const LayerGeometryProvider *v,
         m_cache.drawImage(targetLeft, targetWidth,
                           scaled,
                           sourceLeft, targetWidth);
+
+        // Scaled, so we have no values that correspond to the pixels
+        m_valueCache.unsetColumns(targetLeft, targetWidth);
     }
     
     for (int i = 0; i < targetWidth; ++i) {
@@ -1070,24 +1802,12 @@ Colour3DPlotRenderer::renderToCacheBinResolution(const LayerGeometryProvider *v,
     }
 }
 
-int
-Colour3DPlotRenderer::renderDrawBuffer(int w, int h,
-                                       const vector<int> &binforx,
-                                       const vector<double> &binfory,
-                                       int peakCacheIndex,
-                                       bool rightToLeft,
-                                       bool timeConstrained)
+bool
+Colour3DPlotRenderer::prepareSourceGeometry(int h,
+                                            const vector<double> &binfory,
+                                            int peakCacheIndex,
+                                            DrawBufferGeometry &g) const
 {
-    // Callers must have checked that the appropriate subset of
-    // Sources data members are set for the supplied flags (e.g. that
-    // peakCache corresponding to peakCacheIndex exists)
-    
-    RenderTimer timer(timeConstrained ?
-                      RenderTimer::FastRender :
-                      RenderTimer::NoTimeout);
-
-    Profiler profiler("Colour3DPlotRenderer::renderDrawBuffer");
-    
     int divisor = 1;
 
     std::shared_ptr<DenseThreeDimensionalModel> sourceModel;
@@ -1106,22 +1826,8 @@ Colour3DPlotRenderer::renderDrawBuffer(int w, int h,
             (m_sources.source);
     }
     
-    if (!sourceModel) return 0;
+    if (!sourceModel) return false;
 
-#ifdef DEBUG_COLOUR_PLOT_REPAINT
-    SVDEBUG << "render " << m_sources.source
-            << ": renderDrawBuffer: w = " << w << ", h = " << h
-            << ", peakCacheIndex = " << peakCacheIndex << " (divisor = "
-            << divisor << "), rightToLeft = " << rightToLeft
-            << ", timeConstrained = " << timeConstrained << endl;
-    SVDEBUG << "render " << m_sources.source
-            << ": renderDrawBuffer: normalization = " << int(m_params.normalization)
-            << ", binDisplay = " << int(m_params.binDisplay)
-            << ", binScale = " << int(m_params.binScale)
-            << ", alwaysOpaque = " << m_params.alwaysOpaque
-            << ", interpolate = " << m_params.interpolate << endl;
-#endif
-    
     int sh = sourceModel->getHeight();
     
     int minbin = int(binfory[0] + 0.0001);
@@ -1133,14 +1839,150 @@ Colour3DPlotRenderer::renderDrawBuffer(int w, int h,
 
 #ifdef DEBUG_COLOUR_PLOT_REPAINT
     SVDEBUG << "render " << m_sources.source
-            << ": minbin = " << minbin << ", nbins = " << nbins
+            << ": divisor = " << divisor
+            << ", minbin = " << minbin << ", nbins = " << nbins
             << ", last binfory = " << binfory[h-1]
             << " (rounds to " << int(binfory[h-1])
             << ") (model height " << sh << ")" << endl;
 #endif
     
-    int psx = -1;
+    g.h = h;
+    g.binfory = &binfory;
+    g.minbin = minbin;
+    g.nbins = nbins;
+    g.divisor = divisor;
+    g.modelWidth = sourceModel->getWidth();
+    g.sourceModel = sourceModel;
 
+    return true;
+}
+
+bool
+Colour3DPlotRenderer::prepareDrawBufferGeometry(int w, int h,
+                                                const vector<int> &binforx,
+                                                const vector<double> &binfory,
+                                                int peakCacheIndex,
+                                                const ColourScale &colourScale,
+                                                vector<uchar> &columns,
+                                                vector<float> &values,
+                                                vector<char> &drawn,
+                                                DrawBufferGeometry &g) const
+{
+    if (!prepareSourceGeometry(h, binfory, peakCacheIndex, g)) {
+        return false;
+    }
+    
+    g.w = w;
+    g.binforx = &binforx;
+    g.colourScale = &colourScale;
+
+    // Columns that are skipped when rendering must still come out as
+    // the background pixel
+    columns.assign(size_t(w) * h, 0);
+    g.columns = columns.data();
+
+    // Values are only read back for columns flagged as drawn, so
+    // don't need clearing
+    values.resize(size_t(w) * h);
+    g.values = values.data();
+    drawn.assign(w, 0);
+    g.drawn = drawn.data();
+
+    return true;
+}
+
+void
+Colour3DPlotRenderer::transposeDrawBufferColumns(const DrawBufferGeometry &g,
+                                                 int xPixelCount,
+                                                 bool rightToLeft,
+                                                 QImage &buffer) const
+{
+    Profiler profiler("Colour3DPlotRenderer::transposeDrawBufferColumns");
+
+    int x0 = 0;
+    int x1 = xPixelCount;
+    if (rightToLeft) {
+        x0 = g.w - xPixelCount;
+        x1 = g.w;
+    }
+    
+    // Work across a block of columns at a time, so that both the
+    // column reads and the row writes stay within a small region of
+    // memory
+    const int blockWidth = 64;
+
+    uchar *bits = buffer.bits();
+    int bytesPerLine = buffer.bytesPerLine();
+    
+    for (int bx0 = x0; bx0 < x1; bx0 += blockWidth) {
+        int bx1 = std::min(bx0 + blockWidth, x1);
+        for (int y = 0; y < g.h; ++y) {
+            uchar *row = bits + y * bytesPerLine;
+            const uchar *source = g.columns + y;
+            for (int x = bx0; x < bx1; ++x) {
+                row[x] = source[size_t(x) * g.h];
+            }
+        }
+    }
+}
+
+int
+Colour3DPlotRenderer::renderDrawBuffer(int w, int h,
+                                       const vector<int> &binforx,
+                                       const vector<double> &binfory,
+                                       int peakCacheIndex,
+                                       bool rightToLeft,
+                                       bool timeConstrained)
+{
+    // Callers must have checked that the appropriate subset of
+    // Sources data members are set for the supplied flags (e.g. that
+    // peakCache corresponding to peakCacheIndex exists)
+    
+    RenderTimer timer(timeConstrained ?
+                      RenderTimer::FastRender :
+                      RenderTimer::NoTimeout);
+
+    Profiler profiler("Colour3DPlotRenderer::renderDrawBuffer");
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+    SVDEBUG << "render " << m_sources.source
+            << ": renderDrawBuffer: w = " << w << ", h = " << h
+            << ", peakCacheIndex = " << peakCacheIndex
+            << ", rightToLeft = " << rightToLeft
+            << ", timeConstrained = " << timeConstrained << endl;
+    SVDEBUG << "render " << m_sources.source
+            << ": renderDrawBuffer: normalization = " << int(m_params.normalization)
+            << ", binDisplay = " << int(m_params.binDisplay)
+            << ", binScale = " << int(m_params.binScale)
+            << ", alwaysOpaque = " << m_params.alwaysOpaque
+            << ", interpolate = " << m_params.interpolate << endl;
+#endif
+
+    DrawBufferGeometry g;
+    if (!prepareDrawBufferGeometry(w, h, binforx, binfory, peakCacheIndex,
+                                   m_params.colourScale,
+                                   m_drawBufferColumns,
+                                   m_drawBufferValues,
+                                   m_drawBufferDrawn, g)) {
+        return 0;
+    }
+
+    vector<ColumnReader> readers = getColumnReaders(g);
+    
+    if (getRenderThreadCount(w) > 1 && readers.size() > 1) {
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+        SVDEBUG << "render " << m_sources.source
+                << ": rendering draw buffer in parallel with "
+                << readers.size() << " readers" << endl;
+#endif
+        int xPixelCount = renderDrawBufferParallel(g, readers,
+                                                   rightToLeft, timer,
+                                                   m_magRanges);
+        transposeDrawBufferColumns(g, xPixelCount, rightToLeft, m_drawBuffer);
+        updateTimings(timer, xPixelCount);
+        return xPixelCount;
+    }
+    
     int start = 0;
     int finish = w;
     int step = 1;
@@ -1153,123 +1995,293 @@ Colour3DPlotRenderer::renderDrawBuffer(int w, int h,
 
     int xPixelCount = 0;
     
-    ColumnOp::Column preparedColumn;
-
-    int modelWidth = sourceModel->getWidth();
+    ColumnScratch scratch;
 
 #ifdef DEBUG_COLOUR_PLOT_REPAINT
-    SVDEBUG << "render " << m_sources.source
-            << ": modelWidth " << modelWidth << ", divisor " << divisor << endl;
     SVDEBUG << "render " << m_sources.source
             << ": start = " << start << ", finish = " << finish << ", step = " << step << endl;
 #endif
     
     for (int x = start; x != finish; x += step) {
 
-        // x is the on-canvas pixel coord; sx (later) will be the
-        // source column index
-        
         ++xPixelCount;
+
+        renderDrawBufferColumn(g, x, scratch, m_magRanges);
         
-        if (binforx[x] < 0) continue;
+        double fractionComplete = double(xPixelCount) / double(w);
+        if (timer.outOfTime(fractionComplete)) {
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+            SVDEBUG << "render " << m_sources.source
+                    << ": out of time with xPixelCount = " << xPixelCount << endl;
+#endif
+            transposeDrawBufferColumns(g, xPixelCount, rightToLeft,
+                                       m_drawBuffer);
+            updateTimings(timer, xPixelCount);
+            return xPixelCount;
+        }
+    }
 
-        int sx0 = binforx[x] / divisor;
-        int sx1 = sx0;
-        if (x+1 < w) sx1 = binforx[x+1] / divisor;
-        if (sx0 < 0) sx0 = sx1 - 1;
-        if (sx0 < 0) continue;
-        if (sx1 <= sx0) sx1 = sx0 + 1;
+    transposeDrawBufferColumns(g, xPixelCount, rightToLeft, m_drawBuffer);
+    updateTimings(timer, xPixelCount);
 
 #ifdef DEBUG_COLOUR_PLOT_REPAINT
-//        SVDEBUG << "x = " << x << ", binforx[x] = " << binforx[x] << ", sx range " << sx0 << " -> " << sx1 << endl;
+    SVDEBUG << "render " << m_sources.source
+            << ": completed with xPixelCount = " << xPixelCount << endl;
 #endif
+    return xPixelCount;
+}
 
-        ColumnOp::Column pixelPeakColumn;
-        MagnitudeRange magRange;
+void
+Colour3DPlotRenderer::renderDrawBufferColumn(const DrawBufferGeometry &g,
+                                             int x,
+                                             ColumnScratch &scratch,
+                                             vector<MagnitudeRange> &magRanges)
+    const
+{
+    // x is the on-canvas pixel coord; sx (later) will be the
+    // source column index
+
+    int sx0, sx1;
+    if (!getSourceColumnsForX(g, x, sx0, sx1)) return;
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+//    SVDEBUG << "x = " << x << ", binforx[x] = " << binforx[x] << ", sx range " << sx0 << " -> " << sx1 << endl;
+#endif
+
+    ColumnOp::Column &preparedColumn = scratch.preparedColumn;
+    ColumnOp::Column &pixelPeakColumn = scratch.pixelPeakColumn;
+    bool havePeak = false;
+    
+    MagnitudeRange magRange;
         
-        for (int sx = sx0; sx < sx1; ++sx) {
+    for (int sx = sx0; sx < sx1; ++sx) {
 
-            if (sx < 0 || sx >= modelWidth) {
-                continue;
-            }
+        if (sx < 0 || sx >= g.modelWidth) {
+            continue;
+        }
 
-            if (sx != psx) {
+        if (sx != scratch.psx) {
                 
-                // order:
-                // get column -> scale -> normalise -> record extents ->
-                // peak pick -> distribute/interpolate -> apply display gain
+            // order:
+            // get column -> scale -> normalise -> record extents ->
+            // peak pick -> distribute/interpolate -> apply display gain
 
-                // this does the first three:
-                ColumnOp::Column column = getColumn(sx, minbin, nbins,
-                                                    sourceModel);
+            // this does the first three, reusing the scratch
+            // columns so as not to allocate:
+            getColumnInto(scratch.column, scratch.work, sx,
+                          g.minbin, g.nbins, g.sourceModel,
+                          &scratch.reader);
 
-                magRange.sample(column);
+            magRange.sample(scratch.column);
 
-                if (m_params.binDisplay == BinDisplay::PeakBins) {
-                    column = ColumnOp::peakPick(column);
-                }
+            const ColumnOp::Column *column = &scratch.column;
+            
+            if (m_params.binDisplay == BinDisplay::PeakBins) {
+                InPlaceColumnOp::peakPick(scratch.column, scratch.work);
+                column = &scratch.work;
+            }
 
-                preparedColumn =
-                    ColumnOp::distribute(column,
-                                         h,
-                                         binfory,
-                                         minbin,
-                                         m_params.interpolate);
+            InPlaceColumnOp::distribute(*column,
+                                        preparedColumn,
+                                        g.h,
+                                        *g.binfory,
+                                        g.minbin,
+                                        m_params.interpolate);
 
-                // Display gain belongs to the colour scale and is
-                // applied by the colour scale object when mapping it
+            // Display gain belongs to the colour scale and is
+            // applied by the colour scale object when mapping it
                 
-                psx = sx;
-            }
+            scratch.psx = sx;
+        }
 
-            if (sx == sx0) {
-                pixelPeakColumn = preparedColumn;
-            } else {
-                for (int i = 0; in_range_for(pixelPeakColumn, i); ++i) {
-                    pixelPeakColumn[i] = std::max(pixelPeakColumn[i],
-                                                  preparedColumn[i]);
-                }
+        if (!havePeak) {
+            // Assignment reuses the existing storage of the scratch
+            // column where it can
+            pixelPeakColumn.assign(preparedColumn.begin(),
+                                   preparedColumn.end());
+            havePeak = true;
+        } else {
+            // Written as a plain loop over raw pointers so that the
+            // compiler can vectorise it
+            int n = int(std::min(pixelPeakColumn.size(),
+                                 preparedColumn.size()));
+            float *peak = pixelPeakColumn.data();
+            const float *prepared = preparedColumn.data();
+            for (int i = 0; i < n; ++i) {
+                peak[i] = std::max(peak[i], prepared[i]);
             }
         }
+    }
 
-        if (!pixelPeakColumn.empty()) {
+    if (havePeak && !pixelPeakColumn.empty()) {
 
-            for (int y = 0; y < h; ++y) {
-                int py;
-                if (m_params.invertVertical) {
-                    py = y;
-                } else {
-                    py = h - y - 1;
+        // Map straight into this column of the column-major buffer,
+        // which is owned by this x coordinate alone, then flip it if
+        // the lowest bin belongs at the bottom
+
+        uchar *column = g.columns + size_t(x) * g.h;
+        g.colourScale->getPixels(pixelPeakColumn.data(), g.h, column);
+
+        // Keep the values too, so that the column can be recoloured
+        // later without rendering it again
+        float *values = g.values + size_t(x) * g.h;
+        std::copy(pixelPeakColumn.begin(), pixelPeakColumn.begin() + g.h,
+                  values);
+        g.drawn[x] = 1;
+        
+        if (!m_params.invertVertical) {
+            std::reverse(column, column + g.h);
+            std::reverse(values, values + g.h);
+        }
+            
+        magRanges.push_back(magRange);
+    }
+}
+
+bool
+Colour3DPlotRenderer::getSourceColumnsForX(const DrawBufferGeometry &g,
+                                           int x, int &sx0, int &sx1) const
+{
+    const vector<int> &binforx = *g.binforx;
+    
+    if (binforx[x] < 0) return false;
+
+    sx0 = binforx[x] / g.divisor;
+    sx1 = sx0;
+    if (x+1 < g.w) sx1 = binforx[x+1] / g.divisor;
+    if (sx0 < 0) sx0 = sx1 - 1;
+    if (sx0 < 0) return false;
+    if (sx1 <= sx0) sx1 = sx0 + 1;
+
+    return true;
+}
+
+int
+Colour3DPlotRenderer::renderDrawBufferParallel(const DrawBufferGeometry &g,
+                                               const vector<ColumnReader> &readers,
+                                               bool rightToLeft,
+                                               RenderTimer &timer,
+                                               vector<MagnitudeRange> &magRanges)
+    const
+{
+    Profiler profiler("Colour3DPlotRenderer::renderDrawBufferParallel");
+    
+    // The draw buffer is divided into fixed-width chunks of columns,
+    // numbered in the order in which the serial renderer would have
+    // visited them (i.e. from the right if rightToLeft is set). Each
+    // thread repeatedly claims the lowest-numbered chunk not yet
+    // taken, so that the set of completed chunks is always a
+    // contiguous run from the start whenever we stop claiming new
+    // ones. Only the calling thread consults the RenderTimer; if it
+    // reports that we are out of time, no further chunks are
+    // claimed, but those already claimed are completed. The
+    // per-chunk magnitude ranges are then appended to magRanges in
+    // chunk order, so the result is the same as the serial render.
+    //
+    // Each thread reads from its own FFT reader. Without readers,
+    // the chunks are all rendered on the calling thread.
+
+    const int chunkWidth = 16;
+    int w = g.w;
+    int chunkCount = (w + chunkWidth - 1) / chunkWidth;
+
+    int threadCount = std::min(getRenderThreadCount(w), int(readers.size()));
+    if (threadCount < 1) threadCount = 1;
+
+    vector<vector<MagnitudeRange>> chunkRanges(chunkCount);
+    
+    std::atomic<int> nextChunk(0);
+    std::atomic<bool> abandoned(false);
+
+    auto renderChunks = [&](int thread) {
+        bool checkTimer = (thread == 0); // the calling thread
+        ColumnScratch scratch;
+        if (thread < int(readers.size())) {
+            scratch.reader = readers[thread];
+        }
+        while (!abandoned) {
+            int chunk = nextChunk++;
+            if (chunk >= chunkCount) {
+                break;
+            }
+            int i0 = chunk * chunkWidth;
+            int i1 = std::min(i0 + chunkWidth, w);
+            for (int i = i0; i < i1; ++i) {
+                int x = (rightToLeft ? w - i - 1 : i);
+                renderDrawBufferColumn(g, x, scratch, chunkRanges[chunk]);
+            }
+            if (checkTimer) {
+                int claimed = std::min(int(nextChunk) * chunkWidth, w);
+                double fractionComplete = double(claimed) / double(w);
+                if (timer.outOfTime(fractionComplete)) {
+                    abandoned = true;
                 }
-                m_drawBuffer.setPixel
-                    (x,
-                     py,
-                     m_params.colourScale.getPixel(pixelPeakColumn[y]));
             }
-            
-            m_magRanges.push_back(magRange);
         }
+    };
 
-        double fractionComplete = double(xPixelCount) / double(w);
-        if (timer.outOfTime(fractionComplete)) {
-#ifdef DEBUG_COLOUR_PLOT_REPAINT
-            SVDEBUG << "render " << m_sources.source
-                    << ": out of time with xPixelCount = " << xPixelCount << endl;
-#endif
-            updateTimings(timer, xPixelCount);
-            return xPixelCount;
-        }
-    }
+    RenderThreadPool::run(threadCount, renderChunks);
 
-    updateTimings(timer, xPixelCount);
+    int completedChunks = std::min(int(nextChunk), chunkCount);
+    int xPixelCount = std::min(completedChunks * chunkWidth, w);
+
+    for (int chunk = 0; chunk < completedChunks; ++chunk) {
+        magRanges.insert(magRanges.end(),
+                           chunkRanges[chunk].begin(),
+                           chunkRanges[chunk].end());
+    }
 
 #ifdef DEBUG_COLOUR_PLOT_REPAINT
     SVDEBUG << "render " << m_sources.source
-            << ": completed with xPixelCount = " << xPixelCount << endl;
+            << ": parallel render " << (abandoned ? "ran out of time" : "completed")
+            << " with xPixelCount = " << xPixelCount << endl;
 #endif
+    
     return xPixelCount;
 }
 
+vector<Colour3DPlotRenderer::ColumnReader>
+Colour3DPlotRenderer::getColumnReaders(const DrawBufferGeometry &g) const
+{
+    vector<ColumnReader> readers;
+
+    // The readers stand in for the FFT model only, not for the peak
+    // caches derived from it
+    auto fft = ModelById::getAs<DenseThreeDimensionalModel>(m_sources.fft);
+    if (!fft || g.sourceModel != fft) {
+        return readers;
+    }
+
+    for (auto id : m_sources.fftReaders) {
+        auto reader = ModelById::getAs<FFTModel>(id);
+        if (reader) {
+            readers.push_back({ id, reader });
+        }
+    }
+
+    return readers;
+}
+
+int
+Colour3DPlotRenderer::getRenderThreadCount(int w) const
+{
+    int threadCount = m_params.threadCount;
+    
+    if (threadCount <= 0) {
+        threadCount = RenderThreadPool::getThreadCount();
+    }
+
+    // Not worth the overhead for narrow areas, such as the strips
+    // exposed when scrolling slowly
+    const int minColumnsPerThread = 32;
+    if (threadCount > w / minColumnsPerThread) {
+        threadCount = w / minColumnsPerThread;
+    }
+    if (threadCount < 1) threadCount = 1;
+    
+    return threadCount;
+}
+
 int
 Colour3DPlotRenderer::renderDrawBufferPeakFrequencies(const LayerGeometryProvider *v,
                                                       int w, int h,
@@ -1303,8 +2315,17 @@ Colour3DPlotRenderer::renderDrawBufferPeakFrequencies(const LayerGeometryProvide
     int nbins  = int(binfory[h-1]) - minbin + 1;
     if (minbin + nbins > sh) nbins = sh - minbin;
 
+    int maxbin = minbin + nbins - 1;
+    
     FFTModel::PeakSet peakfreqs;
 
+    PeakFrequencyCache *peakCache = getPeakFrequencyCache();
+
+    // Write to the indexed buffer directly, as setPixel range-checks
+    // and converts for every call
+    uchar *bits = m_drawBuffer.bits();
+    int bytesPerLine = m_drawBuffer.bytesPerLine();
+
     int psx = -1;
     
     int start = 0;
@@ -1340,21 +2361,42 @@ Colour3DPlotRenderer::renderDrawBufferPeakFrequencies(const LayerGeometryProvide
             << ", step = " << step << endl;
 #endif
     
+    // Peaks are the expensive part. We work through the columns in
+    // chunks, first making sure the peak cache has everything needed
+    // for the chunk (which it calculates in parallel, if it has FFT
+    // readers to do so) and then drawing it. The chunks are small
+    // enough per thread for the timer to be checked often
+
+    int chunkWidth = 16 * getRenderThreadCount(w);
+    vector<int> chunkColumns;
+    
+    int chunkStart = start;
+    
     for (int x = start; x != finish; x += step) {
         
         // x is the on-canvas pixel coord; sx (later) will be the
         // source column index
+
+        if (x == chunkStart) {
+            chunkColumns.clear();
+            int cx = x;
+            for (int i = 0; i < chunkWidth && cx != finish; ++i) {
+                int sx0, sx1;
+                if (getPeakSourceColumns(binforx, w, cx, sx0, sx1) &&
+                    sx0 < modelWidth &&
+                    (chunkColumns.empty() || chunkColumns.back() != sx0)) {
+                    chunkColumns.push_back(sx0);
+                }
+                cx += step;
+            }
+            peakCache->prepare(chunkColumns, minbin, maxbin);
+            chunkStart = cx;
+        }
         
         ++xPixelCount;
-        
-        if (binforx[x] < 0) continue;
 
-        int sx0 = binforx[x];
-        int sx1 = sx0;
-        if (x+1 < w) sx1 = binforx[x+1];
-        if (sx0 < 0) sx0 = sx1 - 1;
-        if (sx0 < 0) continue;
-        if (sx1 <= sx0) sx1 = sx0 + 1;
+        int sx0, sx1;
+        if (!getPeakSourceColumns(binforx, w, x, sx0, sx1)) continue;
 
         ColumnOp::Column pixelPeakColumn;
         MagnitudeRange magRange;
@@ -1373,8 +2415,7 @@ Colour3DPlotRenderer::renderDrawBufferPeakFrequencies(const LayerGeometryProvide
 
             if (sx == sx0) {
                 pixelPeakColumn = preparedColumn;
-                peakfreqs = fft->getPeakFrequencies(FFTModel::AllPeaks, sx,
-                                                    minbin, minbin + nbins - 1);
+                peakfreqs = peakCache->getPeakFrequencies(sx, minbin, maxbin);
             } else {
                 for (int i = 0; in_range_for(pixelPeakColumn, i); ++i) {
                     pixelPeakColumn[i] = std::max(pixelPeakColumn[i],
@@ -1415,7 +2456,7 @@ Colour3DPlotRenderer::renderDrawBufferPeakFrequencies(const LayerGeometryProvide
 //                        << value << ", pixel " << pixel << "\n";
 #endif
                 
-                m_drawBuffer.setPixel(x, iy, pixel);
+                bits[iy * bytesPerLine + x] = uchar(pixel);
             }
 
             m_magRanges.push_back(magRange);
@@ -1443,11 +2484,46 @@ Colour3DPlotRenderer::renderDrawBufferPeakFrequencies(const LayerGeometryProvide
     return xPixelCount;
 }
 
+bool
+Colour3DPlotRenderer::getPeakSourceColumns(const vector<int> &binforx,
+                                           int w, int x,
+                                           int &sx0, int &sx1) const
+{
+    if (binforx[x] < 0) return false;
+
+    sx0 = binforx[x];
+    sx1 = sx0;
+    if (x+1 < w) sx1 = binforx[x+1];
+    if (sx0 < 0) sx0 = sx1 - 1;
+    if (sx0 < 0) return false;
+    if (sx1 <= sx0) sx1 = sx0 + 1;
+
+    return true;
+}
+
+PeakFrequencyCache *
+Colour3DPlotRenderer::getPeakFrequencyCache()
+{
+    if (!m_peakFrequencyCache) {
+        if (m_sources.peakFrequencyCache) {
+            m_peakFrequencyCache = m_sources.peakFrequencyCache;
+        } else {
+            m_peakFrequencyCache = std::make_shared<PeakFrequencyCache>
+                (m_sources.fft, m_sources.fftReaders);
+        }
+    }
+    return m_peakFrequencyCache.get();
+}
+
 void
 Colour3DPlotRenderer::updateTimings(const RenderTimer &timer, int xPixelCount)
 {
-    double secondsPerXPixel = timer.secondsPerItem(xPixelCount);
+    updateTimings(timer.secondsPerItem(xPixelCount), xPixelCount);
+}
 
+void
+Colour3DPlotRenderer::updateTimings(double secondsPerXPixel, int xPixelCount)
+{
     // valid if we have enough data points, or if the overall time is
     // massively slow anyway (as we definitely need to warn about that)
     bool valid = (xPixelCount > 20 || secondsPerXPixel > 0.01);
@@ -1467,18 +2543,124 @@ Colour3DPlotRenderer::updateTimings(const RenderTimer &timer, int xPixelCount)
 }
 
 void
-Colour3DPlotRenderer::recreateDrawBuffer(int w, int h)
+Colour3DPlotRenderer::storeColumnValues(int cacheLeft, int width, int h,
+                                        const float *values,
+                                        const char *drawn,
+                                        int sourceLeft)
 {
-    m_drawBuffer = QImage(w, h, QImage::Format_Indexed8);
+    if (h != m_valueCache.getHeight()) {
+        m_valueCache.unsetColumns(cacheLeft, width);
+        return;
+    }
+    
+    for (int i = 0; i < width; ++i) {
+        int sx = sourceLeft + i;
+        if (drawn[sx]) {
+            m_valueCache.setColumn(cacheLeft + i, values + size_t(sx) * h);
+        } else {
+            m_valueCache.setColumn(cacheLeft + i, nullptr);
+        }
+    }
+}
+
+bool
+Colour3DPlotRenderer::setColourScale(const ColourScale &colourScale,
+                                     int colourRotation)
+{
+    bool phase = (colourScale.getScale() == ColourScaleType::Phase);
+    if (phase != m_phaseColumns) {
+        return false;
+    }
+
+    int left = m_cache.getValidLeft();
+    int width = m_cache.getValidWidth();
+
+    if (m_cache.isValid() && !m_valueCache.areColumnsSet(left, width)) {
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+        SVDEBUG << "render " << m_sources.source
+                << ": setColourScale: no values for some of the valid area, "
+                << "can't recolour" << endl;
+#endif
+        return false;
+    }
+
+    Profiler profiler("Colour3DPlotRenderer::setColourScale");
+    
+    m_params.colourScale = colourScale;
+    m_params.colourRotation = colourRotation;
+    ++m_colourGeneration;
+
+    // The draw buffer's colour table is out of date, and so are the
+    // images retained for other zoom levels. We could recolour those
+    // from their retained values, but we'd rather not spend the time
+    // on levels that may never be revisited, so the values go too
+    m_drawBuffer = QImage();
+    m_cache.discardRetained();
+    m_valueCache.discardRetained();
+
+    if (!m_cache.isValid()) {
+        return true;
+    }
+
+    int h = m_valueCache.getHeight();
+    QImage image = createDrawBufferImage(width, h);
+    uchar *bits = image.bits();
+    int bytesPerLine = image.bytesPerLine();
+
+    // Each thread maps a contiguous run of columns, writing to
+    // distinct bytes of the image
+    
+    auto recolour = [&](int i0, int i1) {
+        vector<uchar> pixels(h);
+        for (int i = i0; i < i1; ++i) {
+            const auto &values = m_valueCache.getColumn(left + i);
+            if (values.empty()) continue; // blank, left as background
+            m_params.colourScale.getPixels(values.data(), h, pixels.data());
+            for (int y = 0; y < h; ++y) {
+                bits[y * bytesPerLine + i] = pixels[y];
+            }
+        }
+    };
+
+    int threadCount = getRenderThreadCount(width);
+    int perThread = (width + threadCount - 1) / threadCount;
+
+    RenderThreadPool::run(threadCount, [&](int t) {
+            int i0 = std::min(t * perThread, width);
+            int i1 = std::min(i0 + perThread, width);
+            recolour(i0, i1);
+        });
+
+    m_cache.drawImage(left, width, image, 0, width);
+
+#ifdef DEBUG_COLOUR_PLOT_REPAINT
+    SVDEBUG << "render " << m_sources.source
+            << ": setColourScale: recoloured " << width << " columns" << endl;
+#endif
+
+    return true;
+}
+
+QImage
+Colour3DPlotRenderer::createDrawBufferImage(int w, int h) const
+{
+    QImage image(w, h, QImage::Format_Indexed8);
 
     for (int pixel = 0; pixel < 256; ++pixel) {
-        m_drawBuffer.setColor
+        image.setColor
             ((unsigned char)pixel,
              m_params.colourScale.getColourForPixel
              (pixel, m_params.colourRotation).rgb());
     }
 
-    m_drawBuffer.fill(0);
+    image.fill(0);
+    return image;
+}
+
+void
+Colour3DPlotRenderer::recreateDrawBuffer(int w, int h)
+{
+    m_drawBuffer = createDrawBufferImage(w, h);
     m_magRanges.clear();
 }
 
@@ -19,6 +19,7 @@
 #include "ColourScale.h"
 #include "ScrollableImageCache.h"
 #include "ScrollableMagRangeCache.h"
+#include "ScrollableValueCache.h"
 
 #include "base/ColumnOp.h"
 #include "base/MagnitudeRange.h"
@@ -28,12 +29,19 @@
 #include <QRect>
 #include <QPainter>
 #include <QImage>
+#include <QMutex>
+
+#include <memory>
 
 class LayerGeometryProvider;
+class BackgroundRenderThread;
+class RenderTileDiskCache;
+class PeakFrequencyCache;
 class VerticalBinLayer;
 class RenderTimer;
 class Dense3DModelPeakCache;
 class DenseThreeDimensionalModel;
+class FFTModel;
 
 enum class BinDisplay {
     AllBins,
@@ -57,6 +65,29 @@ public:
         ModelId source; // always; a DenseThreeDimensionalModel
         ModelId fft; // optionally; an FFTModel; used for phase/peak-freq modes
         std::vector<ModelId> peakCaches; // zero or more
+
+        // Optional further FFTModels with the same parameters as fft
+        // (which must then also be the source). The FFT model is not
+        // safe to read from more than one thread at once, so draw
+        // buffer columns read from it are rendered in parallel only
+        // if these are supplied, each rendering thread then reading
+        // from one of its own. Readers may be shared between
+        // renderers, which take turns with each one
+        std::vector<ModelId> fftReaders;
+
+        // Optional cache of peak frequencies for the fft model, used
+        // in peak-frequency mode. Supply one to share it between
+        // renderers; if none is supplied, the renderer uses its own
+        std::shared_ptr<PeakFrequencyCache> peakFrequencyCache;
+
+        // Optional identity for the source data that remains the
+        // same from one session to the next, such as an audio file
+        // identity (see RenderTileDiskCache::getFileIdentity)
+        // together with any analysis parameters. If set,
+        // and the RenderTileDiskCache is enabled, tiles rendered in
+        // the background are also stored on disk under keys derived
+        // from it, and reloaded from there when next needed
+        QString cacheIdentity;
     };        
 
     struct Parameters {
@@ -70,7 +101,8 @@ public:
             invertVertical(false),
             showDerivative(false),
             scaleFactor(1.0),
-            colourRotation(0) { }
+            colourRotation(0),
+            threadCount(1) { }
 
         /** A complete ColourScale object by value, used for colour
          *  map conversion. Note that the final display gain setting is
@@ -114,15 +146,35 @@ public:
 
         /** Colourmap rotation, in the range 0-255. */
         int colourRotation;
+
+        /** Number of threads to use for the data-parallel parts of
+         *  rendering, taken from the RenderThreadPool. 1 means render
+         *  serially on the calling thread; 0 means use one thread per
+         *  available core. Columns of the draw buffer are rendered in
+         *  parallel only when read directly from an FFT model for
+         *  which fftReaders are supplied in the Sources, as the
+         *  models are not otherwise safe to read from several
+         *  threads. The rendered result is the same whatever the
+         *  thread count. */
+        int threadCount;
     };
     
     Colour3DPlotRenderer(Sources sources, Parameters parameters) :
         m_sources(sources),
         m_params(parameters),
+        m_phaseColumns(parameters.colourScale.getScale() ==
+                       ColourScaleType::Phase),
+        m_colourGeneration(0),
         m_secondsPerXPixel(0.0),
-        m_secondsPerXPixelValid(false)
+        m_secondsPerXPixelValid(false),
+        m_backgroundThread(nullptr)
     { }
 
+    ~Colour3DPlotRenderer();
+
+    Colour3DPlotRenderer(const Colour3DPlotRenderer &) = delete;
+    Colour3DPlotRenderer &operator=(const Colour3DPlotRenderer &) = delete;
+
     struct RenderResult {
         /**
          * The rect that was actually rendered. May be equal to the
@@ -198,6 +250,46 @@ public:
     RenderResult renderTimeConstrained(const LayerGeometryProvider *v,
                                        QPainter &paint, QRect rect);
 
+    /**
+     * Render the requested area using the given painter, obtaining
+     * geometry (e.g. start frame) from the stored
+     * LayerGeometryProvider, without doing any significant rendering
+     * work on the calling thread.
+     *
+     * Only the part of the rect that is already available in the
+     * cache is painted; the returned QRect (the rendered field in
+     * the RenderResult struct) contains that area. If any of the
+     * rect is missing from the cache, a tile adjoining the valid
+     * area of the cache is queued for rendering on a background
+     * thread belonging to this renderer. When the tile is complete,
+     * the update() slot of every view that has called this function
+     * is invoked, and the next call to this function copies the
+     * tile into the cache and queues the next one, so that the cache
+     * fills progressively. Only one tile is
+     * in progress at a time; tiles that no longer match the view
+     * geometry by the time they are complete are discarded.
+     *
+     * Render types that are cheap, or that need the
+     * LayerGeometryProvider while rendering (bin-resolution, direct
+     * translucent, and peak-frequency rendering), are carried out
+     * as for renderTimeConstrained instead.
+     *
+     * The same conditions apply as for render() with respect to
+     * model readiness and layer dormancy.
+     */
+    RenderResult renderAsynchronous(const LayerGeometryProvider *v,
+                                    QPainter &paint, QRect rect);
+
+    /**
+     * Return true if a tile has been queued for rendering by
+     * renderAsynchronous and has not yet been copied to the
+     * cache. A caller that would otherwise request a repaint of the
+     * area reported by getLargestUncachedRect should not do so while
+     * this returns true, as the renderer will trigger its own
+     * repaint when the tile arrives.
+     */
+    bool hasBackgroundRenderPending() const;
+
     /**
      * Return the area of the largest rectangle within the entire area
      * of the cache that is unavailable in the cache. This is only
@@ -212,6 +304,27 @@ public:
      */
     QRect getLargestUncachedRect(const LayerGeometryProvider *v);
 
+    /**
+     * Return the magnitude range of the whole visible area at the
+     * provider's current geometry, as a render of that area would
+     * find it, without rendering anything. Ranges already known for
+     * columns of the area (because they were rendered or scanned
+     * before, and have remained in view while scrolling) are reused,
+     * and the rest are read from the same source and peak cache as a
+     * render would use and recorded for next time. Reading stops
+     * short of the peak picking, distribution and colour mapping
+     * stages of rendering, and is done on the calling thread.
+     *
+     * This is intended for a caller that normalises the colour scale
+     * to the visible area, so that it can set the scale before
+     * rendering rather than render once to find the range and then
+     * again with the scale adjusted. Unlike renderAsynchronous, it
+     * may do substantial work on the calling thread.
+     *
+     * Returns an unset range for render types that are not cached.
+     */
+    MagnitudeRange scanMagnitudeRange(const LayerGeometryProvider *v);
+
     /**
      * Return true if the provider's geometry differs from the cache,
      * or if we are not using a cache. i.e. if the cache will be
@@ -238,22 +351,71 @@ public:
         return m_params.colourScale.getColour(value, m_params.colourRotation);
     }
 
+    /**
+     * Replace the colour scale and colour rotation used for
+     * rendering, recolouring the visible area already held in the
+     * cache from the values it was originally rendered from rather
+     * than rendering it again. This is much cheaper than creating a
+     * new renderer when only the gain, threshold, range or colour
+     * map have changed.
+     *
+     * Return true if this was done. Return false, leaving the
+     * renderer unchanged, if it could not be: if the new scale
+     * differs from the old in whether it is a phase scale (which
+     * changes the source data), or if some of the cached area was
+     * rendered in a way that did not retain its values (bin
+     * resolution, peak frequencies, or loaded from the disk tile
+     * cache). The caller should then discard this renderer and
+     * create a new one.
+     */
+    bool setColourScale(const ColourScale &colourScale, int colourRotation);
+    
     /**
      * Return the enclosing rectangle for the region of similar colour
      * to the given point within the cache. Return an empty QRect if
      * this is not possible. \see ImageRegionFinder
      */
     QRect findSimilarRegionExtents(QPoint point) const;
+
+    /**
+     * Scale an 8-bit indexed image up to the given size, which must
+     * be at least as large as the image in both dimensions, returning
+     * a premultiplied ARGB image coloured through the image's colour
+     * table. Pixels are interpolated bilinearly if interpolate is
+     * true, and replicated otherwise. Rows are shared between up to
+     * threadCount threads. This is the scaler used when rendering at
+     * bin resolution, used in place of QImage::scaled.
+     */
+    static QImage scaleIndexedImage(QImage image,
+                                    int targetWidth, int targetHeight,
+                                    bool interpolate, int threadCount);
     
 private:
     Sources m_sources;
     Parameters m_params;
 
+    // Whether columns are read as phases. Fixed for the lifetime of
+    // the renderer, unlike the rest of the colour scale, so that
+    // background rendering can consult it without locking
+    const bool m_phaseColumns;
+
+    // Incremented whenever the colour scale changes, so that tiles
+    // rendered in the background with an older one can be recognised
+    int m_colourGeneration;
+
     // Draw buffer is the target of each partial repaint. It is always
     // at view height (not model height) and is cleared and repainted
     // on each fragment render. The only reason it's stored as a data
     // member is to avoid reallocation.
     QImage m_drawBuffer;
+    std::vector<uchar> m_drawBufferColumns;
+
+    // The values that were mapped to colour indices in the draw
+    // buffer, in the same column-major layout as m_drawBufferColumns,
+    // and a flag for each column showing whether anything was drawn
+    // there. Filled only when rendering at pixel resolution
+    std::vector<float> m_drawBufferValues;
+    std::vector<char> m_drawBufferDrawn;
 
     // A temporary store of magnitude ranges per-column, used when
     // rendering to the draw buffer. This always has the same length
@@ -279,6 +441,17 @@ private:
     // versa (as the image cache is limited to contiguous ranges).
     ScrollableMagRangeCache m_magCache;
 
+    // The value cache holds, for the columns of the image cache that
+    // were rendered at pixel resolution, the values that were mapped
+    // through the colour scale, so that setColourScale can recolour
+    // them. It has the same size, zoom and start frame as the image
+    // cache.
+    ScrollableValueCache m_valueCache;
+
+    // Either the one from the sources, or our own if none was
+    // supplied. Created when first needed
+    std::shared_ptr<PeakFrequencyCache> m_peakFrequencyCache;
+
     double m_secondsPerXPixel;
     bool m_secondsPerXPixelValid;
 
@@ -306,13 +479,170 @@ private:
                          bool rightToLeft,
                          bool timeConstrained);
 
+    // Values that stay fixed across all the columns of a single
+    // renderDrawBuffer call, gathered together so that any column
+    // can be rendered independently of the others
+    struct DrawBufferGeometry {
+        int w;
+        int h;
+        const std::vector<int> *binforx;
+        const std::vector<double> *binfory;
+        int minbin;
+        int nbins;
+        int divisor;
+        int modelWidth;
+        std::shared_ptr<DenseThreeDimensionalModel> sourceModel;
+        const ColourScale *colourScale;
+        // Column-major buffer of w * h colour indices, each column
+        // contiguous and ordered from the top row down, so that a
+        // column can be written sequentially rather than striding
+        // across the rows of the image. Copied into the image by
+        // transposeDrawBufferColumns once rendering is done.
+        uchar *columns;
+        // The values mapped to those colour indices, in the same
+        // layout, and a flag per column set if it was drawn at all
+        float *values;
+        char *drawn;
+    };
+
+    // An FFT model from Sources::fftReaders, read by one rendering
+    // thread in place of the shared source model
+    struct ColumnReader {
+        ModelId id;
+        std::shared_ptr<FFTModel> fft;
+    };
+    
+    // Working storage for renderDrawBufferColumn, reused from one
+    // column to the next so that we don't have to allocate for every
+    // pixel column. Each rendering thread needs its own.
+    struct ColumnScratch {
+        int psx; // source column held in preparedColumn, or -1 if none
+        ColumnOp::Column column;
+        ColumnOp::Column work;
+        ColumnOp::Column preparedColumn;
+        ColumnOp::Column pixelPeakColumn;
+        ColumnReader reader; // if any, read instead of g.sourceModel
+        ColumnScratch() : psx(-1) { }
+    };
+
+    // Render a single draw-buffer column. The scratch argument
+    // carries the most recently prepared source column from one call
+    // to the next, and the magnitude range for the column (if it was
+    // drawn at all) is appended to magRanges. Safe to call
+    // concurrently for different x coordinates.
+    void renderDrawBufferColumn(const DrawBufferGeometry &g, int x,
+                                ColumnScratch &scratch,
+                                std::vector<MagnitudeRange> &magRanges) const;
+
+    // Find the range of source columns [sx0, sx1) that contribute to
+    // pixel column x, returning false if there are none
+    bool getSourceColumnsForX(const DrawBufferGeometry &g, int x,
+                              int &sx0, int &sx1) const;
+
+    // Return one reader for each thread that may render columns of
+    // the draw buffer in parallel, or none if the geometry reads from
+    // anything other than the FFT model
+    std::vector<ColumnReader> getColumnReaders(const DrawBufferGeometry &g)
+        const;
+    
+    int renderDrawBufferParallel(const DrawBufferGeometry &g,
+                                 const std::vector<ColumnReader> &readers,
+                                 bool rightToLeft,
+                                 RenderTimer &timer,
+                                 std::vector<MagnitudeRange> &magRanges) const;
+
+    int getRenderThreadCount(int w) const;
+
+    // Fill in the fields of g that describe the source model and bin
+    // range (everything other than the x mapping and output buffers)
+    bool prepareSourceGeometry(int h,
+                               const std::vector<double> &binfory,
+                               int peakCacheIndex,
+                               DrawBufferGeometry &g) const;
+    
+    bool prepareDrawBufferGeometry(int w, int h,
+                                   const std::vector<int> &binforx,
+                                   const std::vector<double> &binfory,
+                                   int peakCacheIndex,
+                                   const ColourScale &colourScale,
+                                   std::vector<uchar> &columns,
+                                   std::vector<float> &values,
+                                   std::vector<char> &drawn,
+                                   DrawBufferGeometry &g) const;
+
+    // Copy the xPixelCount columns rendered so far (counting from the
+    // right if rightToLeft) from the column buffer into the image
+    void transposeDrawBufferColumns(const DrawBufferGeometry &g,
+                                    int xPixelCount, bool rightToLeft,
+                                    QImage &buffer) const;
+
+    bool getPixelResolutionBinMappings(const LayerGeometryProvider *v,
+                                       int x0, int w, int h,
+                                       std::vector<int> &binforx,
+                                       std::vector<double> &binfory) const;
+
+    // Record in the magnitude range cache the ranges for the w
+    // columns starting at x0, for scanMagnitudeRange
+    void scanMagnitudes(const LayerGeometryProvider *v, int x0, int w);
+
+    // A region of the cache rendered on the background thread by
+    // renderAsynchronous. Everything up to peakCacheIndex is filled
+    // in on the GUI thread when the tile is requested; the rest is
+    // filled in on the background thread.
+    struct BackgroundTile {
+        sv_frame_t startFrame; // of the view when the tile was requested
+        ZoomLevel zoomLevel;
+        QSize size;
+        int left;
+        int width;
+        std::vector<int> binforx;
+        std::vector<double> binfory;
+        int peakCacheIndex;
+        ColourScale colourScale { ColourScale::Parameters() };
+        int colourGeneration;
+        QImage image;
+        std::vector<MagnitudeRange> magRanges;
+        std::vector<float> values; // empty if loaded from disk cache
+        std::vector<char> drawn;
+        int attainedWidth;
+        double secondsPerXPixel;
+    };
+
+    BackgroundRenderThread *m_backgroundThread;
+
+    // Guards m_pendingTile and m_completedTile, which are shared with
+    // the background thread
+    mutable QMutex m_tileMutex;
+    std::shared_ptr<BackgroundTile> m_pendingTile;
+    std::shared_ptr<BackgroundTile> m_completedTile;
+
+    void renderBackgroundTile(BackgroundTile &tile) const;
+    void applyCompletedTile(const LayerGeometryProvider *v);
+    void requestBackgroundTile(const LayerGeometryProvider *v, int x0, int x1);
+
+    // Return the disk tile cache if it is enabled and we have an
+    // identity to key it with, otherwise nullptr
+    RenderTileDiskCache *getDiskCache() const;
+    QString getDiskCacheKey(const BackgroundTile &tile) const;
+
     int renderDrawBufferPeakFrequencies(const LayerGeometryProvider *v,
                                         int w, int h,
                                         const std::vector<int> &binforx,
                                         const std::vector<double> &binfory,
                                         bool rightToLeft,
                                         bool timeConstrained);
+
+    // As getSourceColumnsForX, but for peak-frequency rendering,
+    // which always reads from the fft model itself
+    bool getPeakSourceColumns(const std::vector<int> &binforx,
+                              int w, int x, int &sx0, int &sx1) const;
+    
+    PeakFrequencyCache *getPeakFrequencyCache();
     
+    QImage createDrawBufferImage(int w, int h) const;
+    void storeColumnValues(int cacheLeft, int width, int h,
+                           const float *values, const char *drawn,
+                           int sourceLeft);
     void recreateDrawBuffer(int w, int h);
     void clearDrawBuffer(int w, int h);
 
@@ -328,14 +658,25 @@ private:
         const;
     
     ColumnOp::Column getColumn(int sx, int minbin, int nbins,
-                               std::shared_ptr<DenseThreeDimensionalModel> source) const;
-    ColumnOp::Column getColumnRaw(int sx, int minbin, int nbins,
-                                  std::shared_ptr<DenseThreeDimensionalModel> source) const;
+                               std::shared_ptr<DenseThreeDimensionalModel> source,
+                               const ColumnReader *reader = nullptr) const;
+
+    // As getColumn, but write into the given column, reusing its
+    // storage. The work column is used as scratch space
+    void getColumnInto(ColumnOp::Column &column, ColumnOp::Column &work,
+                       int sx, int minbin, int nbins,
+                       std::shared_ptr<DenseThreeDimensionalModel> source,
+                       const ColumnReader *reader) const;
+    void getColumnRawInto(ColumnOp::Column &column,
+                          int sx, int minbin, int nbins,
+                          std::shared_ptr<DenseThreeDimensionalModel> source,
+                          const ColumnReader *reader) const;
 
     void getPreferredPeakCache(const LayerGeometryProvider *,
                                int &peakCacheIndex, int &binsPerPeak) const;
 
     void updateTimings(const RenderTimer &timer, int xPixelCount);
+    void updateTimings(double secondsPerXPixel, int xPixelCount);
 };
 
 #endif
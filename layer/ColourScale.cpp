@@ -20,6 +20,8 @@
 
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <cstring>
 
 using namespace std;
 
@@ -27,7 +29,10 @@ int ColourScale::m_maxPixel = 255;
 
 ColourScale::ColourScale(Parameters parameters) :
     m_params(parameters),
-    m_mapper(m_params.colourMap, m_params.inverted, 1.f, double(m_maxPixel))
+    m_mapper(m_params.colourMap, m_params.inverted, 1.f, double(m_maxPixel)),
+    m_lookupMin(0.f),
+    m_lookupMax(0.f),
+    m_zeroPixel(0)
 {
     if (m_params.minValue >= m_params.maxValue) {
         SVCERR << "ERROR: ColourScale::ColourScale: minValue = "
@@ -86,6 +91,8 @@ ColourScale::ColourScale(Parameters parameters) :
              << ", mapped maxValue = " << m_mappedMax << endl;
         throw std::logic_error("maxValue must be greater than minValue [after mapping]");
     }
+
+    buildPixelLookup();
 }
 
 ColourScale::~ColourScale()
@@ -154,6 +161,138 @@ ColourScale::getPixel(double value) const
     return pixel;
 }
 
+// Map between float values and integers in such a way that the
+// ordering of the integers matches the ordering of the floats, so
+// that we can bisect across the set of all floats in a range
+
+static inline int32_t
+floatToOrdered(float f)
+{
+    int32_t i;
+    memcpy(&i, &f, sizeof(i));
+    if (i >= 0) return i;
+    return std::numeric_limits<int32_t>::min() - i;
+}
+
+static inline float
+orderedToFloat(int32_t i)
+{
+    if (i < 0) i = std::numeric_limits<int32_t>::min() - i;
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+void
+ColourScale::buildPixelLookup()
+{
+    m_lookup.clear();
+    m_buckets.clear();
+
+    m_zeroPixel = getPixel(0.0);
+    
+    if (m_params.scaleType == ColourScaleType::Phase) {
+        // cheap enough anyway
+        return;
+    }
+
+    if (!(m_params.gain > 0.0) || m_maxPixel != 255) {
+        return;
+    }
+
+    // Log and Absolute scales fold negative values onto positive
+    // ones (and Log treats zero specially), so they are only
+    // monotonic for positive values. The others are monotonic
+    // throughout. Values outside the range are handled by getPixel.
+    
+    if (m_params.scaleType == ColourScaleType::Log ||
+        m_params.scaleType == ColourScaleType::Absolute) {
+        m_lookupMin = std::numeric_limits<float>::denorm_min();
+    } else {
+        m_lookupMin = -std::numeric_limits<float>::max();
+    }
+    m_lookupMax = std::numeric_limits<float>::max();
+
+    m_lookup = std::vector<float>(m_maxPixel + 1,
+                                  std::numeric_limits<float>::infinity());
+
+    int64_t lo = floatToOrdered(m_lookupMin);
+    int64_t hi = floatToOrdered(m_lookupMax);
+    int highest = getPixel(m_lookupMax);
+
+    for (int k = 1; k <= highest; ++k) {
+        // The smallest value mapping to at least k can't be below
+        // the one for k-1, so we start from there
+        int64_t a = lo, b = hi;
+        while (a < b) {
+            int64_t mid = a + (b - a) / 2;
+            if (getPixel(orderedToFloat(int32_t(mid))) >= k) {
+                b = mid;
+            } else {
+                a = mid + 1;
+            }
+        }
+        m_lookup[k-1] = orderedToFloat(int32_t(a));
+        lo = a;
+    }
+
+    int32_t orderedMin = floatToOrdered(m_lookupMin);
+    int bucketCount = 1 << (32 - m_bucketShift);
+    m_buckets = std::vector<unsigned char>(bucketCount, 0);
+    int pixel = 0;
+    
+    for (int b = 0; b < bucketCount; ++b) {
+        int32_t ordered =
+            int32_t((uint32_t(b) << m_bucketShift) ^ 0x80000000u);
+        if (ordered < orderedMin) {
+            // below the range we look up, leave as zero
+            continue;
+        }
+        float value = orderedToFloat(ordered);
+        if (value != value) {
+            continue;
+        }
+        while (pixel < m_maxPixel && m_lookup[pixel] <= value) {
+            ++pixel;
+        }
+        m_buckets[b] = (unsigned char)pixel;
+    }
+}
+
+void
+ColourScale::getPixels(const float *values, int n, unsigned char *pixels) const
+{
+    if (m_lookup.empty()) {
+        for (int i = 0; i < n; ++i) {
+            pixels[i] = (unsigned char)getPixel(values[i]);
+        }
+        return;
+    }
+
+    const float *lookup = m_lookup.data();
+    const unsigned char *buckets = m_buckets.data();
+    
+    for (int i = 0; i < n; ++i) {
+
+        float value = values[i];
+
+        if (value >= m_lookupMin && value <= m_lookupMax) {
+            uint32_t bucket =
+                (uint32_t(floatToOrdered(value)) ^ 0x80000000u) >> m_bucketShift;
+            int pixel = buckets[bucket];
+            // The final lookup entry is always +inf, which ends this
+            while (lookup[pixel] <= value) {
+                ++pixel;
+            }
+            pixels[i] = (unsigned char)pixel;
+        } else if (value == 0.f) {
+            pixels[i] = (unsigned char)m_zeroPixel;
+        } else {
+            pixels[i] = (unsigned char)getPixel(value);
+        }
+    }
+}
+
 QColor
 ColourScale::getColourForPixel(int pixel, int rotation) const
 {
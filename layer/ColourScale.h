@@ -18,6 +18,8 @@
 
 #include "ColourMapper.h"
 
+#include <vector>
+
 enum class ColourScaleType {
     Linear,
     Meter,
@@ -87,6 +89,13 @@ public:
      * Return the general type of scale this is.
      */
     ColourScaleType getScale() const;
+
+    /**
+     * Return the parameters this scale was constructed with.
+     */
+    Parameters getParameters() const {
+        return m_params;
+    }
     
     /**
      * Return a pixel number (in the range 0-255 inclusive)
@@ -96,6 +105,17 @@ public:
      */
     int getPixel(double value) const;
 
+    /**
+     * Map a series of n values to pixel numbers, writing the results
+     * to the given pixel array, which must have room for n
+     * values. The result for each value is exactly that which
+     * getPixel would return, but for most scale types this is much
+     * faster than calling getPixel repeatedly, as it uses a lookup
+     * of precalculated pixel boundaries instead of mapping each
+     * value through the scale.
+     */
+    void getPixels(const float *values, int n, unsigned char *pixels) const;
+
     /**
      * Return the colour for the given pixel number (which must be in
      * the range 0-255). The pixel 0 is always the background
@@ -118,6 +138,29 @@ private:
     double m_mappedMin;
     double m_mappedMax;
     static int m_maxPixel;
+
+    // Pixel lookup for getPixels. Across the range of float values
+    // from m_lookupMin to m_lookupMax inclusive, getPixel is
+    // monotonic, and m_lookup[k-1] holds the smallest value in that
+    // range that maps to pixel k or above (or +inf if none does). So
+    // the pixel for a value in range is the number of entries in the
+    // lookup that it equals or exceeds. Empty if the scale type
+    // doesn't support this.
+    std::vector<float> m_lookup;
+    float m_lookupMin;
+    float m_lookupMax;
+    int m_zeroPixel;
+
+    // To avoid searching the whole lookup for every value, the space
+    // of float bit patterns is divided into buckets of equal size,
+    // and m_buckets records the pixel for the lowest value in each
+    // bucket. A search then only needs to step through the lookup
+    // entries within a single bucket, of which there are rarely
+    // more than one or two.
+    std::vector<unsigned char> m_buckets;
+    static const int m_bucketShift = 19;
+
+    void buildPixelLookup();
 };
 
 #endif
@@ -204,13 +204,6 @@ FlexiNoteLayer::setVerticalScale(VerticalScale scale)
     emit layerParametersChanged();
 }
 
-bool
-FlexiNoteLayer::isLayerScrollable(const LayerGeometryProvider *v) const
-{
-    QPoint discard;
-    return !v->shouldIlluminateLocalFeatures(this, discard);
-}
-
 bool
 FlexiNoteLayer::shouldConvertMIDIToHz() const
 {
@@ -809,94 +802,112 @@ FlexiNoteLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
 //    SVDEBUG << "FlexiNoteLayer::paint: resolution is "
 //        << model->getResolution() << " frames" << endl;
 
-    double min = model->getValueMinimum();
-    double max = model->getValueMaximum();
-    if (max == min) max = min + 1.0;
-
-    QPoint localPos;
-    Event illuminatePoint(0);
-    bool shouldIlluminate = false;
-
-    if (v->shouldIlluminateLocalFeatures(this, localPos)) {
-        shouldIlluminate = getPointToDrag(v, localPos.x(), localPos.y(),
-                                          illuminatePoint);
-    }
+    // The note nearest the mouse is illuminated in paintIllumination,
+    // so that what we draw here does not depend on the mouse position
+    // and the layer can remain scrollable
 
     paint.save();
     paint.setRenderHint(QPainter::Antialiasing, false);
-
-    int noteNumber = -1;
+    paint.setPen(getBaseQColor());
+    paint.setBrush(brushColour);
 
     for (EventVector::const_iterator i = points.begin();
          i != points.end(); ++i) {
+        paint.drawRect(getNoteRect(v, *i, model->getValueQuantization()));
+    }
 
-        const Event &p(*i);
+    paint.restore();
+}
 
-        if (noteNumber < 0) {
-            noteNumber = model->getIndexForEvent(p);
-        } else {
-            noteNumber ++;
-        }
+void
+FlexiNoteLayer::paintIllumination(LayerGeometryProvider *v, QPainter &paint,
+                                  QRect) const
+{
+    auto model = ModelById::getAs<NoteModel>(m_model);
+    if (!model || !model->isOK()) return;
 
-        int x = v->getXForFrame(p.getFrame());
-        int y = getYForValue(v, p.getValue());
-        int w = v->getXForFrame(p.getFrame() + p.getDuration()) - x;
-        int h = NOTE_HEIGHT; //GF: larger notes
-    
-        if (model->getValueQuantization() != 0.0) {
-            h = y - getYForValue(v, p.getValue() + model->getValueQuantization());
-            if (h < NOTE_HEIGHT) h = NOTE_HEIGHT; //GF: larger notes
-        }
+    QPoint localPos;
+    if (!v->shouldIlluminateLocalFeatures(this, localPos)) return;
 
-        if (w < 1) w = 1;
-        paint.setPen(getBaseQColor());
-        paint.setBrush(brushColour);
+    Event p;
+    if (!getPointToDrag(v, localPos.x(), localPos.y(), p)) return;
 
-        if (shouldIlluminate && illuminatePoint == p) {
+    QRect r = getNoteRect(v, p, model->getValueQuantization());
+    int x = r.x();
+    int y = r.y() + r.height()/2;
+    int w = r.width();
+    int h = r.height();
+
+    int noteNumber = model->getIndexForEvent(p);
+
+    paint.save();
+    paint.setRenderHint(QPainter::Antialiasing, false);
+    paint.setPen(getBaseQColor());
 
-            paint.drawLine(x, -1, x, v->getPaintHeight() + 1);
-            paint.drawLine(x+w, -1, x+w, v->getPaintHeight() + 1);
+    paint.drawLine(x, -1, x, v->getPaintHeight() + 1);
+    paint.drawLine(x+w, -1, x+w, v->getPaintHeight() + 1);
         
-            paint.setPen(v->getForeground());
+    paint.setPen(v->getForeground());
         
-            QString vlabel = tr("freq: %1%2")
-                .arg(p.getValue()).arg(model->getScaleUnits());
-            PaintAssistant::drawVisibleText
-                (v, paint, 
-                 x,
-                 y - h/2 - 2 - paint.fontMetrics().height()
-                 - paint.fontMetrics().descent(), 
-                 vlabel, PaintAssistant::OutlinedText);
-
-            QString hlabel = tr("dur: %1")
-                .arg(RealTime::frame2RealTime
-                     (p.getDuration(), model->getSampleRate()).toText(true)
-                     .c_str());
-            PaintAssistant::drawVisibleText
-                (v, paint, 
-                 x,
-                 y - h/2 - paint.fontMetrics().descent() - 2,
-                 hlabel, PaintAssistant::OutlinedText);
-
-            QString llabel = QString("%1").arg(p.getLabel());
-            PaintAssistant::drawVisibleText
-                (v, paint, 
-                 x,
-                 y + h + 2 + paint.fontMetrics().descent(),
-                 llabel, PaintAssistant::OutlinedText);
-
-            QString nlabel = QString("%1").arg(noteNumber);
-            PaintAssistant::drawVisibleText
-                (v, paint, 
-                 x + paint.fontMetrics().averageCharWidth() / 2,
-                 y + h/2 - paint.fontMetrics().descent(),
-                 nlabel, PaintAssistant::OutlinedText);
-        }
+    QString vlabel = tr("freq: %1%2")
+        .arg(p.getValue()).arg(model->getScaleUnits());
+    PaintAssistant::drawVisibleText
+        (v, paint, 
+         x,
+         y - h/2 - 2 - paint.fontMetrics().height()
+         - paint.fontMetrics().descent(), 
+         vlabel, PaintAssistant::OutlinedText);
+
+    QString hlabel = tr("dur: %1")
+        .arg(RealTime::frame2RealTime
+             (p.getDuration(), model->getSampleRate()).toText(true)
+             .c_str());
+    PaintAssistant::drawVisibleText
+        (v, paint, 
+         x,
+         y - h/2 - paint.fontMetrics().descent() - 2,
+         hlabel, PaintAssistant::OutlinedText);
+
+    QString llabel = QString("%1").arg(p.getLabel());
+    PaintAssistant::drawVisibleText
+        (v, paint, 
+         x,
+         y + h + 2 + paint.fontMetrics().descent(),
+         llabel, PaintAssistant::OutlinedText);
+
+    QString nlabel = QString("%1").arg(noteNumber);
+    PaintAssistant::drawVisibleText
+        (v, paint, 
+         x + paint.fontMetrics().averageCharWidth() / 2,
+         y + h/2 - paint.fontMetrics().descent(),
+         nlabel, PaintAssistant::OutlinedText);
+
+    // The note itself is already drawn and filled, so outline it
+    // again without adding to its fill
+    paint.setPen(getBaseQColor());
+    paint.setBrush(Qt::NoBrush);
+    paint.drawRect(r);
     
-        paint.drawRect(x, y - h/2, w, h);
+    paint.restore();
+}
+
+QRect
+FlexiNoteLayer::getNoteRect(LayerGeometryProvider *v, const Event &p,
+                            double quantization) const
+{
+    int x = v->getXForFrame(p.getFrame());
+    int y = getYForValue(v, p.getValue());
+    int w = v->getXForFrame(p.getFrame() + p.getDuration()) - x;
+    int h = NOTE_HEIGHT; //GF: larger notes
+    
+    if (quantization != 0.0) {
+        h = y - getYForValue(v, p.getValue() + quantization);
+        if (h < NOTE_HEIGHT) h = NOTE_HEIGHT; //GF: larger notes
     }
 
-    paint.restore();
+    if (w < 1) w = 1;
+
+    return QRect(x, y - h/2, w, h);
 }
 
 int
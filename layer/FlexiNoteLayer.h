@@ -37,6 +37,7 @@ public:
     FlexiNoteLayer();
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void paintIllumination(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
 
     int getVerticalScaleWidth(LayerGeometryProvider *v, bool, QPainter &) const override;
     void paintVerticalScale(LayerGeometryProvider *v, bool, QPainter &paint, QRect rect) const override;
@@ -114,8 +115,6 @@ public:
     void setVerticalScale(VerticalScale scale);
     VerticalScale getVerticalScale() const { return m_verticalScale; }
 
-    bool isLayerScrollable(const LayerGeometryProvider *v) const override;
-
     bool isLayerEditable() const override { return true; }
 
     int getCompletion(LayerGeometryProvider *) const override;
@@ -180,6 +179,9 @@ protected:
     bool updateNoteValueFromPitchCurve(LayerGeometryProvider *v, Event &note) const;
     void splitNotesAt(LayerGeometryProvider *v, sv_frame_t frame, QMouseEvent *e);
 
+    QRect getNoteRect(LayerGeometryProvider *v, const Event &,
+                      double quantization) const;
+
     ModelId m_model;
     bool m_editing;
     bool m_intelligentActions;
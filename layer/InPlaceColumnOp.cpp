@@ -0,0 +1,213 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "InPlaceColumnOp.h"
+
+#include <cmath>
+
+// The arithmetic in each of these follows the corresponding ColumnOp
+// function step for step, including the order of operations and the
+// precision they are carried out in, so that the results are
+// identical. Any change there must be made here too.
+
+void
+InPlaceColumnOp::applyGain(Column &column, double gain)
+{
+    if (gain == 1.0) {
+        return;
+    }
+    float *values = column.data();
+    int n = int(column.size());
+    for (int i = 0; i < n; ++i) {
+        values[i] = float(values[i] * gain);
+    }
+}
+
+void
+InPlaceColumnOp::normalize(Column &column, ColumnNormalization n)
+{
+    if (n == ColumnNormalization::None || column.empty()) {
+        return;
+    }
+
+    float shift = 0.f;
+    float scale = 1.f;
+
+    if (n == ColumnNormalization::Range01) {
+
+        float min = 0.f;
+        float max = 0.f;
+        bool have = false;
+        for (auto v: column) {
+            if (v < min || !have) {
+                min = v;
+            }
+            if (v > max || !have) {
+                max = v;
+            }
+            have = true;
+        }
+        if (min != 0.f) {
+            shift = -min;
+            max -= min;
+        }
+        if (max != 0.f) {
+            scale = 1.f / max;
+        }
+
+    } else if (n == ColumnNormalization::Sum1) {
+
+        float sum = 0.f;
+
+        for (auto v: column) {
+            sum += v;
+        }
+
+        if (sum != 0.f) {
+            scale = 1.f / sum;
+        }
+
+    } else {
+
+        float max = 0.f;
+
+        for (auto v: column) {
+            if (v > max) {
+                max = v;
+            }
+        }
+
+        if (n == ColumnNormalization::Max1) {
+            if (max != 0.f) {
+                scale = 1.f / max;
+            }
+        } else if (n == ColumnNormalization::Hybrid) {
+            if (max > 0.f) {
+                scale = log10f(max + 1.f) / max;
+            }
+        }
+    }
+
+    if (shift != 0.f) {
+        for (auto &v: column) {
+            v += shift;
+        }
+    }
+
+    applyGain(column, scale);
+}
+
+void
+InPlaceColumnOp::peakPick(const Column &in, Column &out)
+{
+    int n = int(in.size());
+    out.assign(n, 0.f);
+    for (int i = 0; i < n; ++i) {
+        if (ColumnOp::isPeak(in, i)) {
+            out[i] = in[i];
+        }
+    }
+}
+
+void
+InPlaceColumnOp::distribute(const Column &in, Column &out, int h,
+                            const std::vector<double> &binfory,
+                            int minbin, bool interpolate)
+{
+    out.assign(h, 0.f);
+    int bins = int(in.size());
+
+    if (interpolate) {
+        // If the bins are closer together than the pixels at both
+        // ends of the scale, there is nothing to interpolate between
+        double eps = 1e-9;
+        bool binsAreCloser = true;
+        if (h > 1) {
+            if (binfory[1] - binfory[0] + eps < 1.0 ||
+                binfory[h-1] - binfory[h-2] + eps < 1.0) {
+                binsAreCloser = false;
+            }
+        }
+        if (binsAreCloser) {
+            interpolate = false;
+        }
+    }
+
+    float *values = out.data();
+    
+    for (int y = 0; y < h; ++y) {
+
+        if (interpolate) {
+
+            double sy = binfory[y] - minbin - 0.5;
+            double syf = floor(sy);
+
+            int mainbin = int(syf);
+            int other = mainbin;
+            if (sy > syf) {
+                other = mainbin + 1;
+            } else if (sy < syf) {
+                other = mainbin - 1;
+            }
+
+            if (mainbin < 0) {
+                mainbin = 0;
+            }
+            if (mainbin >= bins) {
+                mainbin = bins - 1;
+            }
+
+            if (other < 0) {
+                other = 0;
+            }
+            if (other >= bins) {
+                other = bins - 1;
+            }
+
+            double prop = 1.0 - fabs(sy - syf);
+
+            double v0 = in[mainbin];
+            double v1 = in[other];
+
+            values[y] = float(prop * v0 + (1.0 - prop) * v1);
+
+        } else {
+
+            double sy0 = binfory[y] - minbin;
+
+            double sy1;
+            if (y+1 < h) {
+                sy1 = binfory[y+1] - minbin;
+            } else {
+                sy1 = bins;
+            }
+
+            int by0 = int(sy0 + 0.0001);
+            int by1 = int(sy1 + 0.0001);
+
+            if (by0 < 0 || by0 >= bins || by1 > bins) {
+                values[y] = 0.f;
+                continue;
+            }
+
+            for (int bin = by0; bin == by0 || bin < by1; ++bin) {
+                float value = in[bin];
+                if (bin == by0 || value > values[y]) {
+                    values[y] = value;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef IN_PLACE_COLUMN_OP_H
+#define IN_PLACE_COLUMN_OP_H
+
+#include "base/ColumnOp.h"
+
+#include <vector>
+
+/**
+ * Versions of the ColumnOp functions used in rendering that work on
+ * caller-owned columns instead of returning new ones, so that a
+ * renderer can prepare column after column without allocating. Each
+ * produces exactly the same values as the ColumnOp function of the
+ * same name. Output columns are resized as necessary, which only
+ * allocates if they have never been that large before.
+ */
+class InPlaceColumnOp
+{
+public:
+    typedef ColumnOp::Column Column;
+
+    /**
+     * Scale the given column by the given gain, as
+     * ColumnOp::applyGain.
+     */
+    static void applyGain(Column &column, double gain);
+
+    /**
+     * Normalise the given column, as ColumnOp::normalize.
+     */
+    static void normalize(Column &column, ColumnNormalization n);
+
+    /**
+     * Write into out a copy of in with every value that is not a
+     * peak set to zero, as ColumnOp::peakPick. The two columns must
+     * be different objects.
+     */
+    static void peakPick(const Column &in, Column &out);
+
+    /**
+     * Write into out the result of distributing in across h pixels,
+     * as ColumnOp::distribute. The two columns must be different
+     * objects.
+     */
+    static void distribute(const Column &in, Column &out, int h,
+                           const std::vector<double> &binfory,
+                           int minbin, bool interpolate);
+};
+
+#endif
@@ -124,6 +124,22 @@ public:
      */
     virtual void paint(LayerGeometryProvider *, QPainter &, QRect) const = 0;   
 
+    /**
+     * Paint any illumination of local features (the highlighting of
+     * the feature nearest the mouse, or of the one being edited) over
+     * the top of what paint() has drawn for the given rectangle. The
+     * view calls this after painting the layer, before painting any
+     * non-scrollable layers in front of it.
+     *
+     * A layer that illuminates features here rather than in paint()
+     * draws the same thing in paint() whether illuminating or not,
+     * so it can remain scrollable, and thus be cached by the view,
+     * while the mouse is moving over it. The default implementation
+     * does nothing.
+     */
+    virtual void paintIllumination(LayerGeometryProvider *, QPainter &,
+                                   QRect) const { }
+
     /**
      * Enable or disable synchronous painting.  If synchronous
      * painting is enabled, a call to paint() must complete painting
@@ -137,6 +153,26 @@ public:
      */
     virtual void setSynchronousPainting(bool /* synchronous */) { }
 
+    /**
+     * Create anything that the layer would otherwise create lazily
+     * when first painted, such as models derived from its own. This
+     * is called from the GUI thread before the layer is painted from
+     * other threads, for example when rendering several strips of an
+     * image at once. Simple layer types create nothing while painting
+     * and may ignore it.
+     */
+    virtual void prepareForPainting(LayerGeometryProvider *) const { }
+
+    /**
+     * Discard anything the layer is keeping on behalf of the view (or
+     * other geometry provider) with the given id, such as caches of
+     * rendered data. This is called from the GUI thread when a
+     * provider that will not paint the layer again is finished with
+     * it, for example an offscreen proxy used to render an image.
+     * Layers that keep no per-view state may ignore it.
+     */
+    virtual void discardViewState(int /* viewId */) const { }
+
     enum VerticalPosition {
         PositionTop, PositionMiddle, PositionBottom
     };
@@ -0,0 +1,53 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ModelAccessLock.h"
+
+#include <QMutexLocker>
+
+#include <map>
+
+ModelAccessLock::ModelAccessLock(ModelId model) :
+    m_mutex(getMutexFor(model))
+{
+    m_mutex->lock();
+}
+
+ModelAccessLock::~ModelAccessLock()
+{
+    m_mutex->unlock();
+}
+
+QMutex *
+ModelAccessLock::getMutexFor(ModelId model)
+{
+    // The mutexes are never deleted, as a lock may still be in use
+    // at the moment its model goes away. There is one per model that
+    // has ever been locked, which is not many
+    
+    static QMutex registryMutex;
+    static std::map<ModelId, QMutex *> mutexes;
+
+    QMutexLocker locker(&registryMutex);
+
+    auto itr = mutexes.find(model);
+    if (itr != mutexes.end()) {
+        return itr->second;
+    }
+
+    QMutex *mutex = new QMutex(QMutex::Recursive);
+    mutexes[model] = mutex;
+    return mutex;
+}
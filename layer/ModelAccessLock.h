@@ -0,0 +1,57 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_MODEL_ACCESS_LOCK_H
+#define SV_MODEL_ACCESS_LOCK_H
+
+#include "data/model/Model.h"
+
+#include <QMutex>
+
+/**
+ * A scoped lock on a process-wide mutex associated with a model id,
+ * for serialising reads from models that are not safe to read from
+ * more than one thread at once. FFTModel, for example, has a column
+ * cache and FFT plan shared by all its callers, and a
+ * Dense3DModelPeakCache fills its columns lazily from its source.
+ *
+ * Anything in this library that may read from such a model while
+ * another thread is also reading from it (rendering threads, the
+ * background tile renderer, exporters, and the GUI thread reading
+ * the same models) should hold the lock for the model while reading.
+ * Derived models such as peak caches read from their source as they
+ * go, so they are locked using the id of the model they derive from:
+ * one lock covers the whole family.
+ *
+ * The lock is recursive, so a reader may take it again while already
+ * holding it. It should be held only around the reads themselves,
+ * never while waiting for other threads.
+ */
+class ModelAccessLock
+{
+public:
+    ModelAccessLock(ModelId model);
+    ~ModelAccessLock();
+
+private:
+    QMutex *m_mutex;
+
+    static QMutex *getMutexFor(ModelId model);
+
+    ModelAccessLock(const ModelAccessLock &) = delete;
+    ModelAccessLock &operator=(const ModelAccessLock &) = delete;
+};
+
+#endif
@@ -211,13 +211,6 @@ NoteLayer::setVerticalScale(VerticalScale scale)
     emit layerParametersChanged();
 }
 
-bool
-NoteLayer::isLayerScrollable(const LayerGeometryProvider *v) const
-{
-    QPoint discard;
-    return !v->shouldIlluminateLocalFeatures(this, discard);
-}
-
 double
 NoteLayer::valueOf(const Event &e) const
 {
@@ -731,87 +724,110 @@ NoteLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const
 //    SVDEBUG << "NoteLayer::paint: resolution is "
 //              << model->getResolution() << " frames" << endl;
 
-    double min = convertValueFromEventValue(model->getValueMinimum());
-    double max = convertValueFromEventValue(model->getValueMaximum());
-    if (max == min) max = min + 1.0;
-
-    QPoint localPos;
-    Event illuminatePoint;
-    bool shouldIlluminate = false;
-
-    if (m_editing || m_editIsOpen) {
-        shouldIlluminate = true;
-        illuminatePoint = m_editingPoint;
-    } else if (v->shouldIlluminateLocalFeatures(this, localPos)) {
-        shouldIlluminate = getPointToDrag(v, localPos.x(), localPos.y(),
-                                          illuminatePoint);
-    }
+    double quantization = model->getValueQuantization();
 
+    // The note being edited, or nearest the mouse, is illuminated in
+    // paintIllumination, so that what we draw here does not depend
+    // on the mouse position and the layer can remain scrollable
+    
     paint.save();
     paint.setRenderHint(QPainter::Antialiasing, false);
+    paint.setPen(getBaseQColor());
+    paint.setBrush(brushColour);
     
     for (EventVector::const_iterator i = points.begin();
          i != points.end(); ++i) {
+        paint.drawRect(getNoteRect(v, *i, quantization));
+    }
 
-        const Event &p(*i);
+    paint.restore();
+}
 
-        int x = v->getXForFrame(p.getFrame());
-        int y = getYForValue(v, valueOf(p));
-        int w = v->getXForFrame(p.getFrame() + p.getDuration()) - x;
-        int h = 3;
-        
-        if (model->getValueQuantization() != 0.0) {
-            h = y - getYForValue
-                (v, convertValueFromEventValue
-                 (p.getValue() + model->getValueQuantization()));
-            if (h < 3) h = 3;
-        }
+void
+NoteLayer::paintIllumination(LayerGeometryProvider *v, QPainter &paint,
+                             QRect) const
+{
+    auto model = ModelById::getAs<NoteModel>(m_model);
+    if (!model || !model->isOK()) return;
 
-        if (w < 1) w = 1;
-        paint.setPen(getBaseQColor());
-        paint.setBrush(brushColour);
+    Event p;
 
-        if (shouldIlluminate && illuminatePoint == p) {
+    if (m_editing || m_editIsOpen) {
+        p = m_editingPoint;
+    } else {
+        QPoint localPos;
+        if (!v->shouldIlluminateLocalFeatures(this, localPos)) {
+            return;
+        }
+        if (!getPointToDrag(v, localPos.x(), localPos.y(), p)) {
+            return;
+        }
+    }
 
-            paint.setPen(v->getForeground());
-            paint.setBrush(v->getForeground());
+    QRect r = getNoteRect(v, p, model->getValueQuantization());
+    int x = r.x();
+    int y = r.y() + r.height()/2;
+    
+    paint.save();
+    paint.setRenderHint(QPainter::Antialiasing, false);
+    paint.setPen(v->getForeground());
+    paint.setBrush(v->getForeground());
 
     // Qt 5.13 deprecates QFontMetrics::width(), but its suggested
     // replacement (horizontalAdvance) was only added in Qt 5.11
     // which is too new for us
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 
-            QString vlabel;
-            if (m_modelUsesHz) {
-                vlabel = QString("%1%2")
-                    .arg(p.getValue())
-                    .arg(model->getScaleUnits());
-            } else {
-                vlabel = QString("%1 %2")
-                    .arg(p.getValue())
-                    .arg(model->getScaleUnits());
-            }
+    QString vlabel;
+    if (m_modelUsesHz) {
+        vlabel = QString("%1%2")
+            .arg(p.getValue())
+            .arg(model->getScaleUnits());
+    } else {
+        vlabel = QString("%1 %2")
+            .arg(p.getValue())
+            .arg(model->getScaleUnits());
+    }
             
-            PaintAssistant::drawVisibleText(v, paint, 
-                               x - paint.fontMetrics().width(vlabel) - 2,
-                               y + paint.fontMetrics().height()/2
-                                 - paint.fontMetrics().descent(), 
-                               vlabel, PaintAssistant::OutlinedText);
-
-            QString hlabel = RealTime::frame2RealTime
-                (p.getFrame(), model->getSampleRate()).toText(true).c_str();
-            PaintAssistant::drawVisibleText(v, paint, 
-                               x,
-                               y - h/2 - paint.fontMetrics().descent() - 2,
-                               hlabel, PaintAssistant::OutlinedText);
-        }
+    PaintAssistant::drawVisibleText(v, paint, 
+                                    x - paint.fontMetrics().width(vlabel) - 2,
+                                    y + paint.fontMetrics().height()/2
+                                    - paint.fontMetrics().descent(), 
+                                    vlabel, PaintAssistant::OutlinedText);
+
+    QString hlabel = RealTime::frame2RealTime
+        (p.getFrame(), model->getSampleRate()).toText(true).c_str();
+    PaintAssistant::drawVisibleText(v, paint, 
+                                    x,
+                                    r.y() - paint.fontMetrics().descent() - 2,
+                                    hlabel, PaintAssistant::OutlinedText);
         
-        paint.drawRect(x, y - h/2, w, h);
-    }
+    paint.drawRect(r);
 
     paint.restore();
 }
 
+QRect
+NoteLayer::getNoteRect(LayerGeometryProvider *v, const Event &p,
+                       double quantization) const
+{
+    int x = v->getXForFrame(p.getFrame());
+    int y = getYForValue(v, valueOf(p));
+    int w = v->getXForFrame(p.getFrame() + p.getDuration()) - x;
+    int h = 3;
+        
+    if (quantization != 0.0) {
+        h = y - getYForValue
+            (v, convertValueFromEventValue
+             (float(p.getValue() + quantization)));
+        if (h < 3) h = 3;
+    }
+
+    if (w < 1) w = 1;
+
+    return QRect(x, y - h/2, w, h);
+}
+
 int
 NoteLayer::getVerticalScaleWidth(LayerGeometryProvider *v, bool, QPainter &paint) const
 {
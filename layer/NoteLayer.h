@@ -47,6 +47,7 @@ public:
     NoteLayer();
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void paintIllumination(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
 
     int getVerticalScaleWidth(LayerGeometryProvider *v, bool, QPainter &) const override;
     void paintVerticalScale(LayerGeometryProvider *v, bool, QPainter &paint, QRect rect) const override;
@@ -102,8 +103,6 @@ public:
     void setVerticalScale(VerticalScale scale);
     VerticalScale getVerticalScale() const { return m_verticalScale; }
 
-    bool isLayerScrollable(const LayerGeometryProvider *v) const override;
-
     bool isLayerEditable() const override { return true; }
 
     int getCompletion(LayerGeometryProvider *) const override;
@@ -156,6 +155,9 @@ protected:
 
     bool getPointToDrag(LayerGeometryProvider *v, int x, int y, Event &) const;
 
+    QRect getNoteRect(LayerGeometryProvider *v, const Event &,
+                      double quantization) const;
+
     double convertValueFromEventValue(float eventValue) const;
     float convertValueToEventValue(double value) const;
     
@@ -0,0 +1,176 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "PeakFrequencyCache.h"
+#include "ModelAccessLock.h"
+#include "RenderThreadPool.h"
+
+#include "base/HitCount.h"
+#include "base/Debug.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+//#define DEBUG_PEAK_FREQUENCY_CACHE 1
+
+using std::vector;
+
+// Enough for several screen widths of densely-peaked columns
+static const size_t maxBytes = 32 * 1024 * 1024;
+
+PeakFrequencyCache::PeakFrequencyCache(ModelId fftModel,
+                                       vector<ModelId> fftReaders) :
+    m_fftModel(fftModel),
+    m_fftReaders(fftReaders),
+    m_bytes(0)
+{
+}
+
+size_t
+PeakFrequencyCache::getEntryBytes(const FFTModel::PeakSet &peaks)
+{
+    // A PeakSet is a std::map, so each peak has a tree node of its
+    // own (three pointers and a colour, besides the value), as does
+    // each entry in our own map
+    const size_t nodeOverhead = 4 * sizeof(void *);
+    return sizeof(Key) + sizeof(FFTModel::PeakSet) + nodeOverhead +
+        peaks.size() * (sizeof(int) + sizeof(double) + nodeOverhead);
+}
+
+void
+PeakFrequencyCache::prepare(const vector<int> &columns,
+                            int minbin, int maxbin)
+{
+    static HitCount count("PeakFrequencyCache: columns");
+
+    vector<int> missing;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        for (int column : columns) {
+            if (m_columns.find(Key(column, minbin, maxbin)) !=
+                m_columns.end()) {
+                count.hit();
+            } else {
+                count.miss();
+                missing.push_back(column);
+            }
+        }
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    // Calculate without our own lock held, so that other users can
+    // carry on retrieving what is already there. Each FFT model can
+    // only be read from one thread at once, so each thread uses a
+    // reader of its own, under the reader's lock in case another
+    // cache or renderer is using it too. Without readers, everything
+    // is calculated from the FFT model on the calling thread
+
+    vector<ModelId> sources = m_fftReaders;
+    if (sources.empty()) {
+        sources.push_back(m_fftModel);
+    }
+
+    vector<std::shared_ptr<FFTModel>> models;
+    for (auto id : sources) {
+        auto fft = ModelById::getAs<FFTModel>(id);
+        if (!fft) {
+            return; // models have gone away
+        }
+        models.push_back(fft);
+    }
+    
+    int n = int(missing.size());
+    vector<FFTModel::PeakSet> results(n);
+    
+    int threadCount = std::min(int(models.size()), n);
+    threadCount = std::min(threadCount, RenderThreadPool::getThreadCount());
+    if (threadCount < 1) threadCount = 1;
+
+    RenderThreadPool::run(threadCount, [&](int t) {
+            ModelAccessLock locker(sources[t]);
+            for (int i = t; i < n; i += threadCount) {
+                results[i] = models[t]->getPeakFrequencies
+                    (FFTModel::AllPeaks, missing[i], minbin, maxbin);
+            }
+        });
+    
+    QMutexLocker locker(&m_mutex);
+
+    for (int i = 0; i < n; ++i) {
+        Key key(missing[i], minbin, maxbin);
+        if (m_columns.find(key) != m_columns.end()) {
+            continue; // calculated by another thread meanwhile
+        }
+        m_bytes += getEntryBytes(results[i]);
+        m_columns[key] = std::move(results[i]);
+    }
+
+#ifdef DEBUG_PEAK_FREQUENCY_CACHE
+    SVDEBUG << "PeakFrequencyCache::prepare: calculated " << n
+            << " columns using " << threadCount
+            << " thread(s), cache now has " << m_columns.size()
+            << " entries in about " << m_bytes << " bytes" << endl;
+#endif
+
+    trim(missing[n/2]);
+}
+
+FFTModel::PeakSet
+PeakFrequencyCache::getPeakFrequencies(int column, int minbin, int maxbin)
+{
+    Key key(column, minbin, maxbin);
+    
+    {
+        QMutexLocker locker(&m_mutex);
+        auto itr = m_columns.find(key);
+        if (itr != m_columns.end()) {
+            return itr->second;
+        }
+    }
+
+    prepare({ column }, minbin, maxbin);
+
+    QMutexLocker locker(&m_mutex);
+    auto itr = m_columns.find(key);
+    if (itr != m_columns.end()) {
+        return itr->second;
+    } else {
+        return {}; // no FFT model
+    }
+}
+
+void
+PeakFrequencyCache::trim(int centre)
+{
+    // Called with m_mutex held. Entries are ordered by column first,
+    // so those furthest from the centre are at one end or other of
+    // the map
+
+    while (m_bytes > maxBytes && !m_columns.empty()) {
+        int first = std::get<0>(m_columns.begin()->first);
+        int last = std::get<0>(m_columns.rbegin()->first);
+        auto itr = m_columns.begin();
+        if (centre - first <= last - centre) {
+            itr = std::prev(m_columns.end());
+        }
+        m_bytes -= getEntryBytes(itr->second);
+        m_columns.erase(itr);
+    }
+}
@@ -0,0 +1,81 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_PEAK_FREQUENCY_CACHE_H
+#define SV_PEAK_FREQUENCY_CACHE_H
+
+#include "data/model/FFTModel.h"
+
+#include <QMutex>
+
+#include <vector>
+#include <map>
+#include <tuple>
+
+/**
+ * A cache of the peak frequencies found in the columns of an
+ * FFTModel, for use when rendering a spectrogram that displays peak
+ * frequencies. Finding these requires phase-vocoder calculations
+ * across the whole visible bin range of each column, which are too
+ * slow to repeat every time a column scrolls into view.
+ *
+ * Columns are stored by column and bin range, so that views showing
+ * different frequency ranges of the same model can share a cache
+ * without displacing one another's columns. The memory used is
+ * limited; when the limit is exceeded, the columns furthest from the
+ * most recently requested one are discarded.
+ *
+ * One cache may be shared between renderers for several views of
+ * the same FFT model. All methods are thread-safe. The FFT model
+ * can't be read from more than one thread at once, so missing
+ * columns are calculated in parallel only if further FFT models
+ * with the same parameters are supplied as readers, one for each
+ * thread. Otherwise they are calculated on the calling thread, under
+ * the FFT model's ModelAccessLock.
+ */
+class PeakFrequencyCache
+{
+public:
+    PeakFrequencyCache(ModelId fftModel,
+                       std::vector<ModelId> fftReaders = {});
+
+    /**
+     * Ensure that the peaks for the given columns, within the given
+     * bin range, are in the cache, calculating any that are missing.
+     */
+    void prepare(const std::vector<int> &columns,
+                 int minbin, int maxbin);
+
+    /**
+     * Return the peaks for the given column within the given bin
+     * range, calculating them on the calling thread if they are not
+     * yet in the cache.
+     */
+    FFTModel::PeakSet getPeakFrequencies(int column, int minbin, int maxbin);
+
+private:
+    ModelId m_fftModel;
+    std::vector<ModelId> m_fftReaders;
+
+    typedef std::tuple<int, int, int> Key; // column, minbin, maxbin
+    std::map<Key, FFTModel::PeakSet> m_columns;
+    size_t m_bytes; // estimated memory used by m_columns
+    QMutex m_mutex;
+
+    static size_t getEntryBytes(const FFTModel::PeakSet &);
+    void trim(int centre);
+};
+
+#endif
@@ -267,6 +267,9 @@ RegionLayer::setVerticalScale(VerticalScale scale)
 bool
 RegionLayer::isLayerScrollable(const LayerGeometryProvider *v) const
 {
+    // The illuminated feature's label is replaced by its value and
+    // time labels, rather than drawn over, so illumination happens in
+    // paint() and cannot be overlaid from paintIllumination()
     QPoint discard;
     return !v->shouldIlluminateLocalFeatures(this, discard);
 }
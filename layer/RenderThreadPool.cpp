@@ -0,0 +1,91 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "RenderThreadPool.h"
+
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QSemaphore>
+
+namespace {
+
+thread_local bool inPoolTask = false;
+
+QThreadPool *
+getPool()
+{
+    // Never deleted, so that no render can find it gone at exit
+    static QThreadPool *pool = []() {
+        QThreadPool *p = new QThreadPool;
+        int n = QThread::idealThreadCount();
+        p->setMaxThreadCount(n > 1 ? n - 1 : 1);
+        p->setExpiryTimeout(-1);
+        return p;
+    }();
+    return pool;
+}
+
+class Task : public QRunnable
+{
+public:
+    Task(const std::function<void(int)> &task, int i, QSemaphore &done) :
+        m_task(task), m_i(i), m_done(done) { }
+
+    void run() override {
+        inPoolTask = true;
+        m_task(m_i);
+        inPoolTask = false;
+        m_done.release();
+    }
+
+private:
+    const std::function<void(int)> &m_task;
+    int m_i;
+    QSemaphore &m_done;
+};
+
+}
+
+int
+RenderThreadPool::getThreadCount()
+{
+    int n = QThread::idealThreadCount();
+    return n > 1 ? n : 1;
+}
+
+void
+RenderThreadPool::run(int n, std::function<void(int)> task)
+{
+    if (n <= 0) return;
+    
+    if (n == 1 || inPoolTask) {
+        for (int i = 0; i < n; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    QThreadPool *pool = getPool();
+    QSemaphore done;
+
+    for (int i = 1; i < n; ++i) {
+        pool->start(new Task(task, i, done)); // pool takes ownership
+    }
+
+    task(0);
+
+    done.acquire(n - 1);
+}
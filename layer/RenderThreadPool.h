@@ -0,0 +1,51 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_RENDER_THREAD_POOL_H
+#define SV_RENDER_THREAD_POOL_H
+
+#include <functional>
+
+/**
+ * A process-wide pool of persistent threads for the data-parallel
+ * parts of rendering, such as preparing the columns of a draw buffer
+ * or recolouring a cached image. Threads are created once, when first
+ * needed, and kept for the rest of the session, so a render that
+ * shares its work out pays only for handing over the tasks and not
+ * for starting and joining threads each time.
+ */
+class RenderThreadPool
+{
+public:
+    /**
+     * Return the greatest number of tasks that run() will execute at
+     * once, including the one on the calling thread.
+     */
+    static int getThreadCount();
+
+    /**
+     * Call task(i) for each i from 0 to n-1, each on a separate
+     * thread, and return when all have completed. Task 0 is always
+     * called on the calling thread, and the rest in the pool. The
+     * tasks must not themselves wait for one another.
+     *
+     * If called from within a task already running in the pool, all
+     * of the tasks are called in turn on the calling thread, so that
+     * the pool can never be waiting on itself.
+     */
+    static void run(int n, std::function<void(int)> task);
+};
+
+#endif
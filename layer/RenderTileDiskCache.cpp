@@ -0,0 +1,336 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "RenderTileDiskCache.h"
+
+#include "base/Debug.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QUrl>
+
+#include <cstring>
+
+//#define DEBUG_RENDER_TILE_DISK_CACHE 1
+
+using std::vector;
+
+static const char tileMagic[8] = { 'S', 'V', 'R', 'T', 'I', 'L', 'E', '1' };
+static const quint32 tileByteOrder = 0x01020304;
+static const char *tileSuffix = ".svtile";
+
+// The file starts with this header, followed by rangeCount pairs of
+// floats (min and max magnitude for each rendered column) and then
+// width * height bytes of colour indices, row by row with no padding
+struct TileHeader {
+    char magic[8];
+    quint32 byteOrder;
+    qint32 width;
+    qint32 height;
+    qint32 rangeCount;
+};
+
+RenderTileDiskCache *
+RenderTileDiskCache::m_instance = nullptr;
+
+QMutex
+RenderTileDiskCache::m_instanceMutex;
+
+RenderTileDiskCache *
+RenderTileDiskCache::getInstance()
+{
+    QMutexLocker locker(&m_instanceMutex);
+    return m_instance;
+}
+
+void
+RenderTileDiskCache::enable(QString directory, qint64 maxBytes)
+{
+    QMutexLocker locker(&m_instanceMutex);
+
+    if (m_instance) return;
+
+    if (!QDir().mkpath(directory)) {
+        SVCERR << "WARNING: RenderTileDiskCache::enable: Failed to create "
+               << "cache directory \"" << directory
+               << "\", not enabling disk cache" << endl;
+        return;
+    }
+
+    m_instance = new RenderTileDiskCache(directory, maxBytes);
+}
+
+QString
+RenderTileDiskCache::getFileIdentity(QString location)
+{
+    QString path = location;
+    
+    QUrl url(location);
+    if (url.isValid() && url.scheme().length() > 1) { // not a drive letter
+        if (!url.isLocalFile()) return "";
+        path = url.toLocalFile();
+    }
+
+    QFileInfo info(path);
+    if (!info.exists() || !info.isFile()) return "";
+
+    return QString("%1|%2|%3")
+        .arg(info.canonicalFilePath())
+        .arg(info.size())
+        .arg(info.lastModified().toMSecsSinceEpoch());
+}
+
+RenderTileDiskCache::RenderTileDiskCache(QString directory, qint64 maxBytes) :
+    m_directory(directory),
+    m_maxBytes(maxBytes),
+    m_totalBytes(0),
+    m_useCounter(0)
+{
+    // Pick up tiles left from earlier sessions, oldest first so that
+    // the most recently written end up as the most recently used
+
+    QDir dir(m_directory);
+    QFileInfoList files = dir.entryInfoList
+        (QStringList() << (QString("*") + tileSuffix),
+         QDir::Files, QDir::Time | QDir::Reversed);
+
+    for (const QFileInfo &info : files) {
+        QString key = info.completeBaseName();
+        m_entries[key] = { info.size(), ++m_useCounter };
+        m_totalBytes += info.size();
+    }
+
+    SVDEBUG << "RenderTileDiskCache: Using directory \"" << m_directory
+            << "\" with " << m_entries.size() << " existing tiles totalling "
+            << m_totalBytes << " bytes (limit " << m_maxBytes << ")" << endl;
+
+    evict();
+}
+
+QString
+RenderTileDiskCache::getFilePath(QString key) const
+{
+    return m_directory + "/" + key + tileSuffix;
+}
+
+bool
+RenderTileDiskCache::retrieve(QString key, QImage &image,
+                              vector<MagnitudeRange> &magRanges)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_entries.find(key) == m_entries.end()) {
+        return false;
+    }
+
+    QString path = getFilePath(key);
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        m_totalBytes -= m_entries[key].size;
+        m_entries.erase(key);
+        return false;
+    }
+
+    qint64 size = file.size();
+    if (size < qint64(sizeof(TileHeader))) {
+        SVDEBUG << "RenderTileDiskCache: Tile file \"" << path
+                << "\" is truncated, removing it" << endl;
+        file.close();
+        file.remove();
+        m_totalBytes -= m_entries[key].size;
+        m_entries.erase(key);
+        return false;
+    }
+
+    uchar *data = file.map(0, size);
+    if (!data) {
+        return false;
+    }
+
+    TileHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    int w = image.width();
+    int h = image.height();
+
+    qint64 expected = qint64(sizeof(header)) +
+        qint64(header.rangeCount) * 2 * qint64(sizeof(float)) +
+        qint64(header.width) * qint64(header.height);
+
+    if (memcmp(header.magic, tileMagic, sizeof(tileMagic)) ||
+        header.byteOrder != tileByteOrder ||
+        header.rangeCount < 0 ||
+        header.rangeCount > header.width ||
+        size != expected) {
+        SVDEBUG << "RenderTileDiskCache: Tile file \"" << path
+                << "\" is not in the expected format, removing it" << endl;
+        file.unmap(data);
+        file.close();
+        file.remove();
+        m_totalBytes -= m_entries[key].size;
+        m_entries.erase(key);
+        return false;
+    }
+
+    if (header.width != w || header.height != h ||
+        image.format() != QImage::Format_Indexed8) {
+        // Valid, just not what the caller wanted - a key collision
+        // or a caller error, but not a reason to delete the tile
+        file.unmap(data);
+        return false;
+    }
+
+    const uchar *p = data + sizeof(header);
+
+    vector<MagnitudeRange> ranges;
+    ranges.reserve(header.rangeCount);
+    for (int i = 0; i < header.rangeCount; ++i) {
+        float minmax[2];
+        memcpy(minmax, p, sizeof(minmax));
+        p += sizeof(minmax);
+        ranges.push_back(MagnitudeRange(minmax[0], minmax[1]));
+    }
+
+    for (int y = 0; y < h; ++y) {
+        memcpy(image.scanLine(y), p, w);
+        p += w;
+    }
+
+    file.unmap(data);
+
+    magRanges = ranges;
+    touch(key, size);
+
+#ifdef DEBUG_RENDER_TILE_DISK_CACHE
+    SVDEBUG << "RenderTileDiskCache: Retrieved tile " << key
+            << " (" << w << "x" << h << ")" << endl;
+#endif
+
+    return true;
+}
+
+void
+RenderTileDiskCache::store(QString key, const QImage &image,
+                           const vector<MagnitudeRange> &magRanges)
+{
+    if (image.format() != QImage::Format_Indexed8 ||
+        int(magRanges.size()) > image.width()) {
+        SVCERR << "WARNING: RenderTileDiskCache::store: Image must be in "
+               << "Format_Indexed8 with no more magnitude ranges than "
+               << "columns" << endl;
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    TileHeader header;
+    memcpy(header.magic, tileMagic, sizeof(tileMagic));
+    header.byteOrder = tileByteOrder;
+    header.width = image.width();
+    header.height = image.height();
+    header.rangeCount = int(magRanges.size());
+
+    // QSaveFile writes to a temporary file and renames it into place
+    // on commit, so a reader never sees a partly-written tile
+    QString path = getFilePath(key);
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        SVCERR << "WARNING: RenderTileDiskCache::store: Failed to open \""
+               << path << "\" for writing" << endl;
+        return;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (const auto &r : magRanges) {
+        float minmax[2] = { r.getMin(), r.getMax() };
+        file.write(reinterpret_cast<const char *>(minmax), sizeof(minmax));
+    }
+
+    for (int y = 0; y < header.height; ++y) {
+        file.write(reinterpret_cast<const char *>(image.constScanLine(y)),
+                   header.width);
+    }
+
+    if (!file.commit()) {
+        SVCERR << "WARNING: RenderTileDiskCache::store: Failed to write \""
+               << path << "\"" << endl;
+        return;
+    }
+
+    qint64 size = qint64(sizeof(header)) +
+        qint64(header.rangeCount) * 2 * qint64(sizeof(float)) +
+        qint64(header.width) * qint64(header.height);
+
+    touch(key, size);
+    evict();
+
+#ifdef DEBUG_RENDER_TILE_DISK_CACHE
+    SVDEBUG << "RenderTileDiskCache: Stored tile " << key
+            << " (" << header.width << "x" << header.height
+            << "), total size now " << m_totalBytes << endl;
+#endif
+}
+
+qint64
+RenderTileDiskCache::getTotalSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_totalBytes;
+}
+
+void
+RenderTileDiskCache::touch(QString key, qint64 size)
+{
+    // Called with m_mutex held
+
+    auto itr = m_entries.find(key);
+    if (itr != m_entries.end()) {
+        m_totalBytes -= itr->second.size;
+    }
+    m_entries[key] = { size, ++m_useCounter };
+    m_totalBytes += size;
+}
+
+void
+RenderTileDiskCache::evict()
+{
+    // Called with m_mutex held. A linear search for the least
+    // recently used entry each time is fine, as eviction happens at
+    // most once or twice per tile stored
+
+    while (m_totalBytes > m_maxBytes && !m_entries.empty()) {
+
+        auto oldest = m_entries.begin();
+        for (auto itr = m_entries.begin(); itr != m_entries.end(); ++itr) {
+            if (itr->second.lastUsed < oldest->second.lastUsed) {
+                oldest = itr;
+            }
+        }
+
+#ifdef DEBUG_RENDER_TILE_DISK_CACHE
+        SVDEBUG << "RenderTileDiskCache: Evicting tile " << oldest->first
+                << endl;
+#endif
+
+        QFile::remove(getFilePath(oldest->first));
+        m_totalBytes -= oldest->second.size;
+        m_entries.erase(oldest);
+    }
+}
@@ -0,0 +1,124 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_RENDER_TILE_DISK_CACHE_H
+#define SV_RENDER_TILE_DISK_CACHE_H
+
+#include "base/MagnitudeRange.h"
+
+#include <QString>
+#include <QImage>
+#include <QMutex>
+
+#include <vector>
+#include <map>
+
+/**
+ * A size-bounded store on disk for rendered colour-plot tiles, so
+ * that areas already rendered (in this session or an earlier one)
+ * can be reloaded rather than recalculated.
+ *
+ * Each tile is an 8-bit indexed image together with the per-column
+ * magnitude ranges that were found when rendering it. Only the
+ * colour indices are stored, not the colour table, so a tile remains
+ * valid when the colour map changes. Tiles are identified by a key
+ * which the caller must construct so as to capture everything that
+ * affects the rendered result; the cache itself knows nothing about
+ * what the tiles contain.
+ *
+ * Each tile is held in a file of its own, in a simple uncompressed
+ * native-endian format that is read through a memory mapping. When
+ * the total size exceeds the limit, the least recently used tiles
+ * are deleted.
+ *
+ * The cache is disabled unless the application enables it with a
+ * directory and size limit. All methods are thread-safe.
+ */
+class RenderTileDiskCache
+{
+public:
+    /**
+     * Return the cache instance, or nullptr if the disk cache has
+     * not been enabled.
+     */
+    static RenderTileDiskCache *getInstance();
+
+    /**
+     * Enable the disk cache, using the given directory (which will
+     * be created if it does not exist) and keeping the total size of
+     * the stored tiles below maxBytes. Tiles already found in the
+     * directory from an earlier session are retained, subject to
+     * the size limit. Has no effect if already enabled.
+     */
+    static void enable(QString directory, qint64 maxBytes);
+
+    /**
+     * Return a string identifying the current content of the file at
+     * the given location (a local path or file URL), for use in tile
+     * keys: the location together with the file's size and
+     * modification time, so that tiles rendered from a file that has
+     * since been replaced are not reused. Return an empty string if
+     * the location is not a local file that can be examined, in
+     * which case tiles for it should not be stored at all.
+     */
+    static QString getFileIdentity(QString location);
+
+    /**
+     * Look up the tile with the given key. If it is found and has the
+     * same size as the supplied image, which must be in
+     * Format_Indexed8, copy its colour indices into the image and
+     * its magnitude ranges into magRanges and return true.
+     * Otherwise leave both unchanged and return false.
+     */
+    bool retrieve(QString key, QImage &image,
+                  std::vector<MagnitudeRange> &magRanges);
+
+    /**
+     * Store a tile (an image in Format_Indexed8, and the magnitude
+     * ranges for its columns) under the given key, replacing any
+     * existing tile with that key and evicting others as necessary.
+     */
+    void store(QString key, const QImage &image,
+               const std::vector<MagnitudeRange> &magRanges);
+
+    /**
+     * Return the total size in bytes of the tiles currently stored.
+     */
+    qint64 getTotalSize() const;
+
+private:
+    RenderTileDiskCache(QString directory, qint64 maxBytes);
+
+    QString getFilePath(QString key) const;
+    void touch(QString key, qint64 size);
+    void evict();
+
+    struct Entry {
+        qint64 size;
+        quint64 lastUsed;
+    };
+
+    QString m_directory;
+    qint64 m_maxBytes;
+    qint64 m_totalBytes;
+    quint64 m_useCounter;
+    std::map<QString, Entry> m_entries;
+    mutable QMutex m_mutex;
+
+    static RenderTileDiskCache *m_instance;
+    static QMutex m_instanceMutex;
+};
+
+#endif
@@ -17,10 +17,215 @@
 #include "base/HitCount.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+
 using namespace std;
 
 //#define DEBUG_SCROLLABLE_IMAGE_CACHE 1
 
+static const int maxRetainedLevels = 4;
+
+// Memory for the images retained at other zoom levels, which are
+// each the size of the whole cache
+static const qint64 maxRetainedBytes = 32 * 1024 * 1024;
+
+static double
+framesPerPixel(ZoomLevel zoom)
+{
+    if (zoom.zone == ZoomLevel::FramesPerPixel) {
+        return double(zoom.level);
+    } else {
+        return 1.0 / double(zoom.level);
+    }
+}
+
+static double
+zoomDistance(ZoomLevel a, ZoomLevel b)
+{
+    // Distance in octaves, so that levels twice and half as zoomed
+    // are equally near
+    return fabs(log2(framesPerPixel(a) / framesPerPixel(b)));
+}
+
+int
+ScrollableImageCache::getRetainedLevelLimit(QSize size)
+{
+    qint64 bytes = qint64(size.width()) * size.height() * 4;
+    if (bytes <= 0) {
+        return maxRetainedLevels;
+    }
+    return int(std::min(qint64(maxRetainedLevels), maxRetainedBytes / bytes));
+}
+
+void
+ScrollableImageCache::setZoomLevel(ZoomLevel zoom)
+{
+    using namespace std::rel_ops;
+    
+    if (m_zoomLevel == zoom) {
+        return;
+    }
+
+    static HitCount count("ScrollableImageCache: retained zoom levels");
+
+#ifdef DEBUG_SCROLLABLE_IMAGE_CACHE
+    cerr << "ScrollableImageCache::setZoomLevel: " << m_zoomLevel
+         << " -> " << zoom << endl;
+#endif
+
+    // The ring buffer is retained as it stands, with its origin,
+    // rather than being unrolled into a new image. The retained level
+    // takes over the image data, and we carry on with either a
+    // restored level or a new image
+    
+    int limit = getRetainedLevelLimit(getSize());
+    bool retaining = (isValid() && limit > 0);
+    RetainedLevel current;
+    if (retaining) {
+        current.image = m_image;
+        current.origin = m_origin;
+        current.validLeft = m_validLeft;
+        current.validWidth = m_validWidth;
+        current.startFrame = m_startFrame;
+        current.zoomLevel = m_zoomLevel;
+    }
+
+    m_zoomLevel = zoom;
+    invalidate();
+
+    auto match = m_retained.begin();
+    while (match != m_retained.end() && match->zoomLevel != zoom) {
+        ++match;
+    }
+
+    if (match != m_retained.end()) {
+#ifdef DEBUG_SCROLLABLE_IMAGE_CACHE
+        cerr << "ScrollableImageCache::setZoomLevel: restoring retained "
+             << "level with valid left " << match->validLeft
+             << ", width " << match->validWidth << endl;
+#endif
+        m_image = match->image;
+        m_origin = match->origin;
+        m_validLeft = match->validLeft;
+        m_validWidth = match->validWidth;
+        m_startFrame = match->startFrame;
+        m_retained.erase(match);
+        count.hit();
+    } else {
+        if (retaining) {
+            m_image = QImage(m_image.size(), m_image.format());
+            m_origin = 0;
+        }
+        count.miss();
+    }
+
+    if (retaining) {
+        m_retained.push_back(current);
+    }
+    
+    while (int(m_retained.size()) > limit) {
+        auto furthest = m_retained.begin();
+        for (auto itr = m_retained.begin(); itr != m_retained.end(); ++itr) {
+            if (zoomDistance(itr->zoomLevel, zoom) >
+                zoomDistance(furthest->zoomLevel, zoom)) {
+                furthest = itr;
+            }
+        }
+        m_retained.erase(furthest);
+    }
+}
+
+bool
+ScrollableImageCache::drawApproximation(const LayerGeometryProvider *v,
+                                        QPainter &paint,
+                                        QRect rect) const
+{
+    if (m_retained.empty()) {
+        return false;
+    }
+
+    // Paint the levels furthest from the current zoom first, so that
+    // nearer ones, which are better approximations, end up on top
+    
+    vector<const RetainedLevel *> levels;
+    for (const auto &r : m_retained) {
+        if (r.image.height() == m_image.height()) {
+            levels.push_back(&r);
+        }
+    }
+    std::sort(levels.begin(), levels.end(),
+              [this](const RetainedLevel *a, const RetainedLevel *b) {
+                  return zoomDistance(a->zoomLevel, m_zoomLevel) >
+                      zoomDistance(b->zoomLevel, m_zoomLevel);
+              });
+
+    bool drawn = false;
+
+    paint.save();
+    paint.setRenderHint(QPainter::SmoothPixmapTransform, true);
+    
+    for (const RetainedLevel *r : levels) {
+
+        double fpp = framesPerPixel(r->zoomLevel);
+
+        // The frame range covered by the valid part of the retained
+        // image, and so the part of our rect it can fill
+        sv_frame_t f0 = r->startFrame + sv_frame_t(r->validLeft * fpp);
+        sv_frame_t f1 = r->startFrame +
+            sv_frame_t((r->validLeft + r->validWidth) * fpp);
+
+        int x0 = v->getXForFrame(f0);
+        int x1 = v->getXForFrame(f1);
+        
+        QRect target = QRect(x0, rect.y(), x1 - x0, rect.height()) & rect;
+        if (target.isEmpty()) {
+            continue;
+        }
+
+        double sx0 = double(v->getFrameForX(target.x()) - r->startFrame)
+            / fpp;
+        double sx1 = double(v->getFrameForX(target.x() + target.width())
+                            - r->startFrame) / fpp;
+        if (sx1 <= sx0) {
+            continue;
+        }
+
+        // The retained image is a ring buffer like our own, so the
+        // source range is split at the cache column held at the
+        // image's left edge
+        
+        int w = r->image.width();
+        double wrap = double(w - r->origin);
+        double scale = double(target.width()) / (sx1 - sx0);
+        
+        auto drawPart = [&](double s0, double s1) {
+            double imageLeft = s0 + r->origin;
+            if (imageLeft >= w) imageLeft -= w;
+            paint.drawImage(QRectF(target.x() + (s0 - sx0) * scale,
+                                   target.y(),
+                                   (s1 - s0) * scale,
+                                   target.height()),
+                            r->image,
+                            QRectF(imageLeft, target.y(),
+                                   s1 - s0, target.height()));
+        };
+
+        if (sx0 < wrap && sx1 > wrap) {
+            drawPart(sx0, wrap);
+            drawPart(wrap, sx1);
+        } else {
+            drawPart(sx0, sx1);
+        }
+        
+        drawn = true;
+    }
+
+    paint.restore();
+    
+    return drawn;
+}
+
 void
 ScrollableImageCache::scrollTo(const LayerGeometryProvider *v,
                                sv_frame_t newStartFrame)
@@ -65,21 +270,12 @@ ScrollableImageCache::scrollTo(const LayerGeometryProvider *v,
 
     count.partial();
         
-    // dx is in range, cache is scrollable
-
-    int dxp = dx;
-    if (dxp < 0) dxp = -dxp;
+    // dx is in range, cache is scrollable. Content that was at x is
+    // now at x + dx, without moving: only the origin changes
+    
+    m_origin = (m_origin - dx) % w;
+    if (m_origin < 0) m_origin += w;
 
-    int copylen = (w - dxp) * int(sizeof(QRgb));
-    for (int y = 0; y < m_image.height(); ++y) {
-        QRgb *line = (QRgb *)m_image.scanLine(y);
-        if (dx < 0) {
-            memmove(line, line + dxp, copylen);
-        } else {
-            memmove(line + dxp, line, copylen);
-        }
-    }
-        
     // update valid area
         
     int px = m_validLeft;
@@ -110,6 +306,30 @@ ScrollableImageCache::scrollTo(const LayerGeometryProvider *v,
     m_validWidth = pw;
 }
 
+QImage
+ScrollableImageCache::getImage() const
+{
+    if (m_origin == 0) {
+        return m_image;
+    }
+
+    QImage image(m_image.size(), m_image.format());
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    drawContents(painter, image.rect());
+    painter.end();
+    return image;
+}
+
+void
+ScrollableImageCache::drawContents(QPainter &paint, QRect rect) const
+{
+    forEachSegment(rect.x(), rect.width(), [&](int imageLeft, int x, int w) {
+        paint.drawImage(x, rect.y(), m_image,
+                        imageLeft, rect.y(), w, rect.height());
+    });
+}
+
 void
 ScrollableImageCache::adjustToTouchValidArea(int &left, int &width,
                                              bool &isLeftOfValidArea) const
@@ -167,10 +387,16 @@ ScrollableImageCache::drawImage(int left,
         throw std::logic_error("Source area out of bounds in ScrollableImageCache::drawImage");
     }
         
+    // If the target wraps, split the source in proportion
+    double scale = (width > 0 ? double(imageWidth) / double(width) : 1.0);
+    
     QPainter painter(&m_image);
-    painter.drawImage(QRect(left, 0, width, m_image.height()),
-                      image,
-                      QRect(imageLeft, 0, imageWidth, image.height()));
+    forEachSegment(left, width, [&](int cacheImageLeft, int x, int w) {
+        painter.drawImage(QRectF(cacheImageLeft, 0, w, m_image.height()),
+                          image,
+                          QRectF(imageLeft + (x - left) * scale, 0,
+                                 w * scale, image.height()));
+    });
     painter.end();
 
     if (!isValid()) {
@@ -23,6 +23,9 @@
 #include <QRect>
 #include <QPainter>
 
+#include <vector>
+#include <algorithm>
+
 /**
  * A cached image for a view that scrolls horizontally, such as a
  * spectrogram. The cache object holds an image, reports the size of
@@ -33,11 +36,18 @@
  *
  * The only way to *update* the valid area in a cache is to draw to it
  * using the drawImage call.
+ *
+ * The image is held as a ring buffer: scrolling moves the column at
+ * which the cache's left edge is stored, rather than moving any
+ * pixels, and an area that wraps around the right edge of the
+ * underlying image is split in two only when it is drawn to or from.
+ * Use drawContents() to paint from the cache.
  */
 class ScrollableImageCache
 {
 public:
     ScrollableImageCache() :
+        m_origin(0),
         m_validLeft(0),
         m_validWidth(0),
         m_startFrame(0)
@@ -62,6 +72,8 @@ public:
     void resize(QSize newSize) {
         if (getSize() != newSize) {
             m_image = QImage(newSize, QImage::Format_ARGB32_Premultiplied);
+            m_origin = 0;
+            m_retained.clear();
             invalidate();
         }
     }
@@ -88,17 +100,25 @@ public:
 
     /**
      * Set the zoom level. If the new zoom level differs from the
-     * current one, the cache is invalidated. (Determining whether to
-     * invalidate the cache here is the only thing the zoom level is
-     * used for.)
+     * current one, the cache is invalidated, but any valid contents
+     * are first retained along with the zoom level and start frame
+     * they were rendered at. If the new zoom level is one for which
+     * contents were retained earlier, those are restored (with their
+     * original start frame, so the caller should scroll as usual
+     * afterwards) instead of leaving the cache empty.
+     *
+     * A few levels are retained, as many as getRetainedLevelLimit()
+     * allows, those furthest from the current zoom being discarded
+     * first. Resizing the cache discards them all.
      */
-    void setZoomLevel(ZoomLevel zoom) {
-        using namespace std::rel_ops;
-        if (m_zoomLevel != zoom) {
-            m_zoomLevel = zoom;
-            invalidate();
-        }
-    }
+    void setZoomLevel(ZoomLevel zoom);
+
+    /**
+     * Return the number of zoom levels a cache of the given size
+     * retains. This is bounded by a fixed memory budget for the
+     * retained images as well as by a fixed count.
+     */
+    static int getRetainedLevelLimit(QSize size);
 
     sv_frame_t getStartFrame() const {
         return m_startFrame;
@@ -117,9 +137,20 @@ public:
         }
     }
     
-    const QImage &getImage() const {
-        return m_image;
-    }
+    /**
+     * Return the cache contents as an image with the cache's left
+     * edge at x = 0. This is cheap if the cache has not scrolled
+     * since its contents were last reset, but otherwise involves
+     * copying the whole image, so for painting use drawContents()
+     * instead.
+     */
+    QImage getImage() const;
+
+    /**
+     * Paint the given area of the cache onto the painter, at the same
+     * coordinates. The area should lie within the valid area.
+     */
+    void drawContents(QPainter &paint, QRect rect) const;
 
     /**
      * Set the new start frame for the cache, according to the
@@ -151,13 +182,63 @@ public:
                    QImage image,
                    int imageLeft,
                    int imageWidth);
+
+    /**
+     * Paint into the given rect an approximation of its contents,
+     * scaled from the contents retained at other zoom levels, as a
+     * placeholder to show until the area has been properly
+     * rendered. This takes no account of the current valid area, so
+     * it should be called before painting from the cache itself.
+     * Return true if anything was painted.
+     */
+    bool drawApproximation(const LayerGeometryProvider *v,
+                           QPainter &paint,
+                           QRect rect) const;
+
+    /**
+     * Discard the contents retained for other zoom levels, for
+     * example because the way the image is coloured has changed.
+     */
+    void discardRetained() {
+        m_retained.clear();
+    }
     
 private:
     QImage m_image;
+    int m_origin; // column of m_image at which the cache's x = 0 is held
     int m_validLeft;
     int m_validWidth;
     sv_frame_t m_startFrame;
     ZoomLevel m_zoomLevel;
+
+    struct RetainedLevel {
+        QImage image;
+        int origin;
+        int validLeft;
+        int validWidth;
+        sv_frame_t startFrame;
+        ZoomLevel zoomLevel;
+    };
+    std::vector<RetainedLevel> m_retained;
+
+    /**
+     * Call f(imageLeft, left, width) once or twice, so as to cover
+     * the given range of cache columns, split where the range wraps
+     * around the right edge of m_image. The imageLeft argument is
+     * the column of m_image at which the cache column left is held.
+     */
+    template <typename F>
+    void forEachSegment(int left, int width, F f) const {
+        int w = m_image.width();
+        if (w <= 0 || width <= 0) return;
+        int imageLeft = (left + m_origin) % w;
+        if (imageLeft < 0) imageLeft += w;
+        int first = std::min(width, w - imageLeft);
+        f(imageLeft, left, first);
+        if (first < width) {
+            f(0, left + first, width - first);
+        }
+    }
 };
 
 #endif
@@ -18,10 +18,71 @@
 #include "base/Debug.h"
 
 #include <iostream>
+#include <cmath>
+
 using namespace std;
 
 //#define DEBUG_SCROLLABLE_MAG_RANGE_CACHE 1
 
+static const int maxRetainedLevels = 4;
+
+static double
+zoomDistance(ZoomLevel a, ZoomLevel b)
+{
+    auto framesPerPixel = [](ZoomLevel z) {
+        if (z.zone == ZoomLevel::FramesPerPixel) return double(z.level);
+        else return 1.0 / double(z.level);
+    };
+    return fabs(log2(framesPerPixel(a) / framesPerPixel(b)));
+}
+
+void
+ScrollableMagRangeCache::setZoomLevel(ZoomLevel zoom)
+{
+    using namespace std::rel_ops;
+    
+    if (m_zoomLevel == zoom) {
+        return;
+    }
+
+    // Retain if anything is set, which is the equivalent of the image
+    // cache's valid area being non-empty
+    bool anySet = false;
+    for (const auto &r : m_ranges) {
+        if (r.isSet()) {
+            anySet = true;
+            break;
+        }
+    }
+    
+    if (anySet) {
+        m_retained.push_back({ m_ranges, m_startFrame, m_zoomLevel });
+    }
+
+    m_zoomLevel = zoom;
+    invalidate();
+
+    for (auto itr = m_retained.begin(); itr != m_retained.end(); ++itr) {
+        if (itr->zoomLevel == zoom) {
+            m_ranges = itr->ranges;
+            m_startFrame = itr->startFrame;
+            m_retained.erase(itr);
+            return;
+        }
+    }
+
+    while (int(m_retained.size()) > maxRetainedLevels) {
+        auto furthest = m_retained.begin();
+        for (auto itr = m_retained.begin(); itr != m_retained.end(); ++itr) {
+            if (zoomDistance(itr->zoomLevel, zoom) >
+                zoomDistance(furthest->zoomLevel, zoom)) {
+                furthest = itr;
+            }
+        }
+        m_retained.erase(furthest);
+    }
+}
+
 void
 ScrollableMagRangeCache::scrollTo(const LayerGeometryProvider *v,
                                   sv_frame_t newStartFrame)
@@ -54,6 +54,7 @@ public:
     void resize(int newWidth) {
         if (getWidth() != newWidth) {
             m_ranges = std::vector<MagnitudeRange>(newWidth);
+            m_retained.clear();
         }
     }
         
@@ -63,17 +64,15 @@ public:
 
     /**
      * Set the zoom level. If the new zoom level differs from the
-     * current one, the cache is invalidated. (Determining whether to
-     * invalidate the cache here is the only thing the zoom level is
-     * used for.)
+     * current one, the cache is invalidated, after retaining its
+     * contents in the same way as ScrollableImageCache::setZoomLevel
+     * so that they can be restored on returning to the same zoom
+     * level. The ranges are small, so this has no memory limit and
+     * may retain levels whose images the image cache has discarded
+     * under its own. Ranges restored without an image are still
+     * correct for their columns.
      */
-    void setZoomLevel(ZoomLevel zoom) {
-        using namespace std::rel_ops;
-        if (m_zoomLevel != zoom) {
-            m_zoomLevel = zoom;
-            invalidate();
-        }
-    }
+    void setZoomLevel(ZoomLevel zoom);
 
     sv_frame_t getStartFrame() const {
         return m_startFrame;
@@ -134,6 +133,13 @@ private:
     std::vector<MagnitudeRange> m_ranges;
     sv_frame_t m_startFrame;
     ZoomLevel m_zoomLevel;
+
+    struct RetainedLevel {
+        std::vector<MagnitudeRange> ranges;
+        sv_frame_t startFrame;
+        ZoomLevel zoomLevel;
+    };
+    std::vector<RetainedLevel> m_retained;
 };
 
 #endif
@@ -0,0 +1,192 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ScrollableValueCache.h"
+#include "ScrollableImageCache.h"
+
+#include "base/Debug.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+
+//#define DEBUG_SCROLLABLE_VALUE_CACHE 1
+
+static double
+zoomDistance(ZoomLevel a, ZoomLevel b)
+{
+    auto framesPerPixel = [](ZoomLevel z) {
+        if (z.zone == ZoomLevel::FramesPerPixel) return double(z.level);
+        else return 1.0 / double(z.level);
+    };
+    return fabs(log2(framesPerPixel(a) / framesPerPixel(b)));
+}
+
+void
+ScrollableValueCache::invalidate()
+{
+    // Keep the column storage, as it is likely to be refilled at the
+    // same size
+    std::fill(m_set.begin(), m_set.end(), false);
+}
+
+void
+ScrollableValueCache::resize(QSize newSize)
+{
+    if (getWidth() != newSize.width() || m_height != newSize.height()) {
+        m_columns = vector<vector<float>>(newSize.width());
+        m_set = vector<bool>(newSize.width(), false);
+        m_height = newSize.height();
+        m_retained.clear();
+    }
+}
+
+void
+ScrollableValueCache::setZoomLevel(ZoomLevel zoom)
+{
+    using namespace std::rel_ops;
+    
+    if (m_zoomLevel == zoom) {
+        return;
+    }
+
+    int limit = ScrollableImageCache::getRetainedLevelLimit
+        (QSize(getWidth(), m_height));
+
+    // Retain if anything is set, which is the equivalent of the image
+    // cache's valid area being non-empty. The column vectors are
+    // moved into the retained level rather than copied
+    
+    bool retaining = (limit > 0 &&
+                      std::find(m_set.begin(), m_set.end(), true) !=
+                      m_set.end());
+    
+    RetainedLevel current;
+    if (retaining) {
+        current.columns = std::move(m_columns);
+        current.set = m_set;
+        current.startFrame = m_startFrame;
+        current.zoomLevel = m_zoomLevel;
+        m_columns = vector<vector<float>>(current.columns.size());
+    }
+
+    m_zoomLevel = zoom;
+    invalidate();
+
+    auto match = m_retained.begin();
+    while (match != m_retained.end() && match->zoomLevel != zoom) {
+        ++match;
+    }
+
+    if (match != m_retained.end()) {
+#ifdef DEBUG_SCROLLABLE_VALUE_CACHE
+        SVDEBUG << "ScrollableValueCache::setZoomLevel: restoring retained "
+                << "level at " << zoom << endl;
+#endif
+        m_columns = std::move(match->columns);
+        m_set = match->set;
+        m_startFrame = match->startFrame;
+        m_retained.erase(match);
+    }
+
+    if (retaining) {
+        m_retained.push_back(std::move(current));
+    }
+    
+    while (int(m_retained.size()) > limit) {
+        auto furthest = m_retained.begin();
+        for (auto itr = m_retained.begin(); itr != m_retained.end(); ++itr) {
+            if (zoomDistance(itr->zoomLevel, zoom) >
+                zoomDistance(furthest->zoomLevel, zoom)) {
+                furthest = itr;
+            }
+        }
+        m_retained.erase(furthest);
+    }
+}
+
+void
+ScrollableValueCache::scrollTo(const LayerGeometryProvider *v,
+                               sv_frame_t newStartFrame)
+{
+    int dx = (v->getXForFrame(m_startFrame) -
+              v->getXForFrame(newStartFrame));
+
+#ifdef DEBUG_SCROLLABLE_VALUE_CACHE
+    SVDEBUG << "ScrollableValueCache::scrollTo: start frame " << m_startFrame
+            << " -> " << newStartFrame << ", dx = " << dx << endl;
+#endif
+
+    if (m_startFrame == newStartFrame) {
+        return;
+    }
+    
+    m_startFrame = newStartFrame;
+
+    if (dx == 0) {
+        return;
+    }
+        
+    int w = getWidth();
+
+    if (dx <= -w || dx >= w) {
+        invalidate();
+        return;
+    }
+
+    // Rotating moves the column vectors around without copying their
+    // contents; then the columns that have come round from the other
+    // end are marked unset
+    
+    if (dx < 0) {
+        std::rotate(m_columns.begin(), m_columns.begin() - dx, m_columns.end());
+        std::rotate(m_set.begin(), m_set.begin() - dx, m_set.end());
+        std::fill(m_set.begin() + (w + dx), m_set.end(), false);
+    } else {
+        std::rotate(m_columns.begin(), m_columns.end() - dx, m_columns.end());
+        std::rotate(m_set.begin(), m_set.end() - dx, m_set.end());
+        std::fill(m_set.begin(), m_set.begin() + dx, false);
+    }
+}
+
+void
+ScrollableValueCache::setColumn(int column, const float *values)
+{
+    if (!in_range_for(m_columns, column)) {
+        SVCERR << "ERROR: ScrollableValueCache::setColumn: column " << column
+               << " is out of range for cache of width " << getWidth()
+               << endl;
+        throw logic_error("column out of range");
+    }
+
+    if (values) {
+        m_columns[column].assign(values, values + m_height);
+    } else {
+        m_columns[column].clear();
+    }
+    m_set[column] = true;
+}
+
+void
+ScrollableValueCache::unsetColumns(int x, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        if (in_range_for(m_set, x + i)) {
+            m_set[x + i] = false;
+        }
+    }
+}
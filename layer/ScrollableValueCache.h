@@ -0,0 +1,162 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_SCROLLABLE_VALUE_CACHE_H
+#define SV_SCROLLABLE_VALUE_CACHE_H
+
+#include "base/BaseTypes.h"
+#include "base/ZoomLevel.h"
+
+#include "LayerGeometryProvider.h"
+
+#include <QSize>
+
+#include <vector>
+
+/**
+ * A cached set of pixel values for a view that scrolls horizontally,
+ * such as a spectrogram, used alongside a ScrollableImageCache. The
+ * cache holds, for each pixel column of the view, the values that
+ * were mapped through a colour scale to produce the corresponding
+ * column of the image, so that the image can later be recoloured
+ * without recalculating them.
+ *
+ * A column may be unset (nothing is known about it), set to a full
+ * column of values (one per pixel, from the top of the view down),
+ * or set to blank (nothing was drawn there, so it contains only the
+ * background colour).
+ *
+ * Like the image and magnitude range caches, this retains its
+ * contents across zoom level changes, so that an image restored by
+ * the image cache can still be recoloured.
+ */
+class ScrollableValueCache
+{
+public:
+    ScrollableValueCache() :
+        m_height(0),
+        m_startFrame(0)
+    {}
+
+    void invalidate();
+
+    int getWidth() const {
+        return int(m_columns.size());
+    }
+
+    int getHeight() const {
+        return m_height;
+    }
+    
+    /**
+     * Set the size of the cache. If the new size differs from the
+     * current size, the cache is invalidated.
+     */
+    void resize(QSize newSize);
+
+    ZoomLevel getZoomLevel() const {
+        return m_zoomLevel;
+    }
+
+    /**
+     * Set the zoom level. If the new zoom level differs from the
+     * current one, the cache is invalidated, after retaining its
+     * columns in the same way as ScrollableImageCache::setZoomLevel,
+     * and with the same limit on the number of levels retained, so
+     * that they can be restored on returning to the same zoom level.
+     */
+    void setZoomLevel(ZoomLevel zoom);
+
+    /**
+     * Discard the columns retained for other zoom levels, for
+     * example because the images they were retained alongside have
+     * been discarded.
+     */
+    void discardRetained() {
+        m_retained.clear();
+    }
+    
+    sv_frame_t getStartFrame() const {
+        return m_startFrame;
+    }
+
+    /**
+     * Set the start frame. If the new start frame differs from the
+     * current one, the cache is invalidated. To scroll, use
+     * scrollTo() instead.
+     */
+    void setStartFrame(sv_frame_t frame) {
+        if (m_startFrame != frame) {
+            m_startFrame = frame;
+            invalidate();
+        }
+    }
+
+    /**
+     * Set the new start frame for the cache, according to the
+     * geometry of the supplied LayerGeometryProvider, moving along
+     * any existing columns so that they continue to be valid for the
+     * new start frame.
+     */
+    void scrollTo(const LayerGeometryProvider *v, sv_frame_t newStartFrame);
+    
+    bool isColumnSet(int column) const {
+        return in_range_for(m_set, column) && m_set[column];
+    }
+
+    bool areColumnsSet(int x, int count) const {
+        for (int i = 0; i < count; ++i) {
+            if (!isColumnSet(x + i)) return false;
+        }
+        return true;
+    }
+
+    /**
+     * Return the values for a column, or an empty vector if the
+     * column is blank. The column must be set.
+     */
+    const std::vector<float> &getColumn(int column) const {
+        return m_columns.at(column);
+    }
+
+    /**
+     * Set the values for a column from getHeight() values starting
+     * at the given pointer, or mark it blank if the pointer is null.
+     */
+    void setColumn(int column, const float *values);
+
+    /**
+     * Mark a range of columns as unset, for example because they
+     * have been drawn by some means that did not produce values.
+     */
+    void unsetColumns(int x, int count);
+    
+private:
+    std::vector<std::vector<float>> m_columns;
+    std::vector<bool> m_set;
+    int m_height;
+    sv_frame_t m_startFrame;
+    ZoomLevel m_zoomLevel;
+
+    struct RetainedLevel {
+        std::vector<std::vector<float>> columns;
+        std::vector<bool> set;
+        sv_frame_t startFrame;
+        ZoomLevel zoomLevel;
+    };
+    std::vector<RetainedLevel> m_retained;
+};
+
+#endif
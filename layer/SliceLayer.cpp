@@ -23,6 +23,7 @@
 #include "ColourDatabase.h"
 
 #include "PaintAssistant.h"
+#include "ModelAccessLock.h"
 
 #include "base/Profiler.h"
 
@@ -446,6 +447,14 @@ SliceLayer::getValueForY(const LayerGeometryProvider *v, double y) const
     return value / m_gain;
 }
 
+void
+SliceLayer::discardViewState(int viewId) const
+{
+    m_xorigins.erase(viewId);
+    m_yorigins.erase(viewId);
+    m_heights.erase(viewId);
+}
+
 void
 SliceLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const
 {
@@ -541,6 +550,10 @@ SliceLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const
     getBiasCurve(curve);
     int cs = int(curve.size());
 
+    // A spectrogram's renderers may be reading from the same model in
+    // the background
+    ModelAccessLock locker(m_sliceableModel);
+
     for (int col = col0; col <= col1; ++col) {
         DenseThreeDimensionalModel::Column column =
             sliceableModel->getColumn(col);
@@ -39,6 +39,7 @@ public:
     void setSliceableModel(ModelId model);
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void discardViewState(int viewId) const override;
 
     QString getFeatureDescription(LayerGeometryProvider *v, QPoint &) const override;
 
@@ -35,6 +35,10 @@
 #include "PaintAssistant.h"
 #include "Colour3DPlotRenderer.h"
 #include "Colour3DPlotExporter.h"
+#include "PeakFrequencyCache.h"
+#include "ModelAccessLock.h"
+#include "RenderTileDiskCache.h"
+#include "RenderThreadPool.h"
 
 #include <QPainter>
 #include <QImage>
@@ -181,6 +185,9 @@ void
 SpectrogramLayer::deleteDerivedModels()
 {
     ModelById::release(m_fftModel);
+    for (auto reader: m_fftReaders) {
+        ModelById::release(reader);
+    }
     ModelById::release(m_peakCache);
     ModelById::release(m_wholeCache);
 
@@ -194,8 +201,10 @@ SpectrogramLayer::deleteDerivedModels()
     m_exporters.clear();
     
     m_fftModel = {};
+    m_fftReaders.clear();
     m_peakCache = {};
     m_wholeCache = {};
+    m_peakFrequencyCache.reset();
 }
 
 pair<ColourScaleType, double>
@@ -731,11 +740,39 @@ SpectrogramLayer::invalidateRenderers()
     cerr << "SpectrogramLayer::invalidateRenderers called" << endl;
 #endif
 
+    // Each renderer is deleted when the last view sharing it lets go
+    m_renderers.clear();
+}
+
+void
+SpectrogramLayer::recolourRenderers()
+{
+    // Called when only the colour scale parameters have changed
+    // (gain, threshold, colour map etc, but not to or from phase). A
+    // renderer that can recolour what it already has is kept, saving
+    // a complete re-render; any other is discarded as usual. A
+    // renderer shared between views is recoloured only once, and is
+    // kept or discarded for all of them
+    
+    std::map<const SharedRenderer *, bool> recoloured;
+    
     for (ViewRendererMap::iterator i = m_renderers.begin();
-         i != m_renderers.end(); ++i) {
-        delete i->second;
+         i != m_renderers.end(); ) {
+        const SharedRenderer *shared = i->second.shared.get();
+        if (recoloured.find(shared) == recoloured.end()) {
+            recoloured[shared] = shared->renderer->setColourScale
+                (makeColourScale(i->first), m_colourRotation);
+        }
+        if (recoloured[shared]) {
+            ++i;
+        } else {
+            i = m_renderers.erase(i);
+        }
     }
-    m_renderers.clear();
+
+    m_crosshairColour =
+        ColourMapper(m_colourMap, m_colourInverted, 1.f, 255.f)
+        .getContrastingColour();
 }
 
 void
@@ -862,9 +899,9 @@ SpectrogramLayer::setGain(float gain)
 
     if (m_gain == gain) return;
 
-    invalidateRenderers();
-    
     m_gain = gain;
+
+    recolourRenderers();
     
     emit layerParametersChanged();
 }
@@ -880,10 +917,10 @@ SpectrogramLayer::setThreshold(float threshold)
 {
     if (m_threshold == threshold) return;
 
-    invalidateRenderers();
-    
     m_threshold = threshold;
 
+    recolourRenderers();
+
     emit layerParametersChanged();
 }
 
@@ -954,11 +991,9 @@ SpectrogramLayer::setColourRotation(int r)
         m_colourRotation = r;
     }
 
-    // Initially the idea with colour rotation was that we would just
-    // rotate the palette of an already-generated cache. That's not
-    // really practical now that cacheing is handled in a separate
-    // class in which the main cache no longer has a palette.
-    invalidateRenderers();
+    // The renderers can recolour their caches from the values they
+    // retain, which is much cheaper than re-rendering
+    recolourRenderers();
     
     emit layerParametersChanged();
 }
@@ -968,9 +1003,18 @@ SpectrogramLayer::setColourScale(ColourScaleType colourScale)
 {
     if (m_colourScale == colourScale) return;
 
-    invalidateRenderers();
+    // Switching to or from phase changes the data being rendered,
+    // not just its colouring
+    bool phaseChanged = (m_colourScale == ColourScaleType::Phase ||
+                         colourScale == ColourScaleType::Phase);
     
     m_colourScale = colourScale;
+
+    if (phaseChanged) {
+        invalidateRenderers();
+    } else {
+        recolourRenderers();
+    }
     
     emit layerParametersChanged();
 }
@@ -986,9 +1030,9 @@ SpectrogramLayer::setColourScaleMultiple(double multiple)
 {
     if (m_colourScaleMultiple == multiple) return;
 
-    invalidateRenderers();
-    
     m_colourScaleMultiple = multiple;
+
+    recolourRenderers();
     
     emit layerParametersChanged();
 }
@@ -1004,10 +1048,10 @@ SpectrogramLayer::setColourMap(int map)
 {
     if (m_colourMap == map) return;
 
-    invalidateRenderers();
-    
     m_colourMap = map;
 
+    recolourRenderers();
+
     emit layerParametersChanged();
 }
 
@@ -1351,6 +1395,10 @@ const
     bool peaksOnly = (m_binDisplay == BinDisplay::PeakBins ||
                       m_binDisplay == BinDisplay::PeakFrequencies);
 
+    // The renderers may be reading from the FFT model in the
+    // background
+    ModelAccessLock locker(m_fftModel);
+
     for (int q = q0i; q <= q1i; ++q) {
 
         for (int s = s0i; s <= s1i; ++s) {
@@ -1415,6 +1463,8 @@ SpectrogramLayer::getXYBinSourceRange(LayerGeometryProvider *v, int x, int y,
 
     if (fft) {
 
+        ModelAccessLock locker(m_fftModel);
+
         int cw = fft->getWidth();
         int ch = fft->getHeight();
 
@@ -1487,6 +1537,33 @@ SpectrogramLayer::recreateFFTModel()
     
     m_fftModel = ModelById::add(newFFTModel);
 
+    // Further FFT models with the same parameters, so that renderers
+    // can calculate columns on several threads at once, each reading
+    // from its own (see Colour3DPlotRenderer::Sources). They cache
+    // only a few columns each, and are shared by the renderers for
+    // all views
+    int readerCount = RenderThreadPool::getThreadCount();
+    if (readerCount > 1) {
+        for (int i = 0; i < readerCount; ++i) {
+            auto reader = std::make_shared<FFTModel>(m_model,
+                                                     m_channel,
+                                                     m_windowType,
+                                                     m_windowSize,
+                                                     getWindowIncrement(),
+                                                     getFFTSize());
+            if (!reader->isOK()) break;
+            if (m_verticallyFixed) {
+                reader->setMaximumFrequency(getMaxFrequency());
+            }
+            m_fftReaders.push_back(ModelById::add(reader));
+        }
+    }
+
+    // Shared by the renderers for all views, as the peaks depend
+    // only on the FFT
+    m_peakFrequencyCache = std::make_shared<PeakFrequencyCache>
+        (m_fftModel, m_fftReaders);
+
     bool createWholeCache = false;
     checkCacheSpace(&m_peakCacheDivisor, &createWholeCache);
     
@@ -1570,82 +1647,200 @@ SpectrogramLayer::setSynchronousPainting(bool synchronous)
     m_synchronous = synchronous;
 }
 
+void
+SpectrogramLayer::discardViewState(int viewId) const
+{
+    // Only this view's reference to its renderer goes: any other
+    // views sharing the renderer keep it
+    m_renderers.erase(viewId);
+    m_viewMags.erase(viewId);
+    m_lastRenderedMags.erase(viewId);
+}
+
 Colour3DPlotRenderer *
 SpectrogramLayer::getRenderer(LayerGeometryProvider *v) const
 {
     int viewId = v->getId();
-    
-    if (m_renderers.find(viewId) == m_renderers.end()) {
 
-        Colour3DPlotRenderer::Sources sources;
-        sources.verticalBinLayer = this;
-        sources.fft = m_fftModel;
-        sources.source = sources.fft;
-        if (!m_peakCache.isNone()) sources.peakCaches.push_back(m_peakCache);
-        if (!m_wholeCache.isNone()) sources.peakCaches.push_back(m_wholeCache);
+    RendererKey key { v->getPaintSize(), v->getZoomLevel(),
+                      v->getStartFrame() };
 
-        ColourScale::Parameters cparams;
-        cparams.colourMap = m_colourMap;
-        cparams.scaleType = m_colourScale;
-        cparams.multiple = m_colourScaleMultiple;
-
-        if (m_colourScale != ColourScaleType::Phase) {
-            cparams.gain = m_gain;
-            cparams.threshold = m_threshold;
-        }
+    auto itr = m_renderers.find(viewId);
+    if (itr != m_renderers.end() && itr->second.shared->key == key) {
+        itr->second.key = key;
+        return itr->second.shared->renderer;
+    }
 
-        double minValue = 0.0f;
-        double maxValue = 1.0f;
-        
-        if (m_normalizeVisibleArea && m_viewMags[viewId].isSet()) {
-            minValue = m_viewMags[viewId].getMin();
-            maxValue = m_viewMags[viewId].getMax();
-        } else if (m_colourScale == ColourScaleType::Linear &&
-                   m_normalization == ColumnNormalization::None) {
-            maxValue = 0.1f;
-        }
+    // Another view may already have a renderer for this geometry
 
-        if (maxValue <= minValue) {
-            maxValue = minValue + 0.1f;
+    std::shared_ptr<SharedRenderer> match;
+    for (const auto &r : m_renderers) {
+        if (r.first != viewId && r.second.shared->key == key) {
+            match = r.second.shared;
+            break;
         }
-        if (maxValue <= m_threshold) {
-            maxValue = m_threshold + 0.1f;
+    }
+    if (match) {
+#ifdef DEBUG_SPECTROGRAM_REPAINT
+        cerr << "SpectrogramLayer::getRenderer: view " << viewId
+             << " sharing renderer with matching geometry" << endl;
+#endif
+        m_renderers[viewId] = { match, key };
+        return match->renderer;
+    }
+
+    // If this view has its renderer to itself, or was the last to
+    // use it with the geometry it had before, it can take the
+    // renderer along to the new geometry: the renderer adapts its
+    // own cache. Any other views sharing it will either catch up
+    // when they next paint (if they are scrolling together with
+    // this one) or find it gone and part company. A view whose
+    // shared renderer has already been moved on by another view
+    // gets a new one, so that views that are not scrolled together
+    // don't take turns dragging the cache back and forth.
+    
+    if (itr != m_renderers.end()) {
+        ViewRenderer &vr = itr->second;
+        if (vr.shared.use_count() == 1 || vr.shared->key == vr.key) {
+            vr.shared->key = key;
+            vr.key = key;
+            return vr.shared->renderer;
         }
+    }
 
-        cparams.minValue = minValue;
-        cparams.maxValue = maxValue;
-
-        m_lastRenderedMags[viewId] = MagnitudeRange(float(minValue),
-                                                    float(maxValue));
-
-        Colour3DPlotRenderer::Parameters params;
-        params.colourScale = ColourScale(cparams);
-        params.normalization = m_normalization;
-        params.binDisplay = m_binDisplay;
-        params.binScale = m_binScale;
-        params.alwaysOpaque = true;
-        params.invertVertical = false;
-        params.scaleFactor = 1.0;
-        params.colourRotation = m_colourRotation;
-
-        if (m_colourScale != ColourScaleType::Phase &&
-            m_normalization != ColumnNormalization::Hybrid) {
-            params.scaleFactor *= 2.f / float(getWindowSize());
-        }
+    Colour3DPlotRenderer::Sources sources;
+    sources.verticalBinLayer = this;
+    sources.fft = m_fftModel;
+    sources.source = sources.fft;
+    sources.fftReaders = m_fftReaders;
+    if (!m_peakCache.isNone()) sources.peakCaches.push_back(m_peakCache);
+    if (!m_wholeCache.isNone()) sources.peakCaches.push_back(m_wholeCache);
+    sources.peakFrequencyCache = m_peakFrequencyCache;
+    sources.cacheIdentity = getRenderCacheIdentity();
+
+    Colour3DPlotRenderer::Parameters params;
+    params.colourScale = makeColourScale(viewId);
+    params.normalization = m_normalization;
+    params.binDisplay = m_binDisplay;
+    params.binScale = m_binScale;
+    params.alwaysOpaque = true;
+    params.invertVertical = false;
+    params.scaleFactor = 1.0;
+    params.colourRotation = m_colourRotation;
+    params.threadCount = 0; // one per core
+
+    if (m_colourScale != ColourScaleType::Phase &&
+        m_normalization != ColumnNormalization::Hybrid) {
+        params.scaleFactor *= 2.f / float(getWindowSize());
+    }
 
-        Preferences::SpectrogramSmoothing smoothing = 
-            Preferences::getInstance()->getSpectrogramSmoothing();
-        params.interpolate = 
-            (smoothing != Preferences::NoSpectrogramSmoothing);
+    Preferences::SpectrogramSmoothing smoothing = 
+        Preferences::getInstance()->getSpectrogramSmoothing();
+    params.interpolate = 
+        (smoothing != Preferences::NoSpectrogramSmoothing);
 
-        m_renderers[viewId] = new Colour3DPlotRenderer(sources, params);
+    m_renderers[viewId] = {
+        std::make_shared<SharedRenderer>
+        (new Colour3DPlotRenderer(sources, params), key),
+        key
+    };
+
+    m_crosshairColour =
+        ColourMapper(m_colourMap, m_colourInverted, 1.f, 255.f)
+        .getContrastingColour();
+
+    return m_renderers[viewId].shared->renderer;
+}
 
-        m_crosshairColour =
-            ColourMapper(m_colourMap, m_colourInverted, 1.f, 255.f)
-            .getContrastingColour();
+ColourScale
+SpectrogramLayer::makeColourScale(int viewId) const
+{
+    ColourScale::Parameters cparams;
+    cparams.colourMap = m_colourMap;
+    cparams.scaleType = m_colourScale;
+    cparams.multiple = m_colourScaleMultiple;
+
+    if (m_colourScale != ColourScaleType::Phase) {
+        cparams.gain = m_gain;
+        cparams.threshold = m_threshold;
     }
 
-    return m_renderers[viewId];
+    double minValue = 0.0f;
+    double maxValue = 1.0f;
+    
+    if (m_normalizeVisibleArea && m_viewMags[viewId].isSet()) {
+        minValue = m_viewMags[viewId].getMin();
+        maxValue = m_viewMags[viewId].getMax();
+    } else if (m_colourScale == ColourScaleType::Linear &&
+               m_normalization == ColumnNormalization::None) {
+        maxValue = 0.1f;
+    }
+
+    if (maxValue <= minValue) {
+        maxValue = minValue + 0.1f;
+    }
+    if (maxValue <= m_threshold) {
+        maxValue = m_threshold + 0.1f;
+    }
+
+    cparams.minValue = minValue;
+    cparams.maxValue = maxValue;
+
+    m_lastRenderedMags[viewId] = MagnitudeRange(float(minValue),
+                                                float(maxValue));
+
+    return ColourScale(cparams);
+}
+
+void
+SpectrogramLayer::discardRenderer(int viewId) const
+{
+    // Called when the view's renderer has failed to take a new colour
+    // scale, so that its cache is left in the old colours. Any other
+    // views sharing it are in the same position, and leaving the
+    // renderer with them would also allow this view to find and
+    // rejoin it by geometry. So it goes for all of them, as in
+    // recolourRenderers
+    
+    auto itr = m_renderers.find(viewId);
+    if (itr == m_renderers.end()) return;
+
+    std::shared_ptr<SharedRenderer> shared = itr->second.shared;
+    
+    for (ViewRendererMap::iterator i = m_renderers.begin();
+         i != m_renderers.end(); ) {
+        if (i->second.shared == shared) {
+            i = m_renderers.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+QString
+SpectrogramLayer::getRenderCacheIdentity() const
+{
+    // Identifies the FFT data for the renderer's disk tile cache. We
+    // can only do this for models backed by a file, and only once
+    // they are completely loaded
+
+    auto model = ModelById::getAs<DenseTimeValueModel>(m_model);
+    if (!model || !model->isOK() || !model->isReady()) return "";
+
+    // The file's size and modification time are included, so that a
+    // file replaced at the same location is not taken for the old one
+    QString file = RenderTileDiskCache::getFileIdentity(model->getLocation());
+    if (file == "") return "";
+
+    return QString("spectrogram|%1|%2|%3|%4|%5|%6|%7|%8")
+        .arg(file)
+        .arg(model->getSampleRate())
+        .arg(qlonglong(model->getEndFrame()))
+        .arg(m_channel)
+        .arg(m_windowSize)
+        .arg(int(m_windowType))
+        .arg(getWindowIncrement())
+        .arg(getOversampling());
 }
 
 void
@@ -1657,6 +1852,33 @@ SpectrogramLayer::paintWithRenderer(LayerGeometryProvider *v, QPainter &paint, Q
     MagnitudeRange magRange;
     int viewId = v->getId();
 
+    // When painting synchronously with the colour scale normalised
+    // to the visible area, find the range of the whole area first,
+    // so that it is rendered once with the right scale instead of
+    // being rendered, checked and rendered again. (The renderer
+    // keeps the ranges of columns that stay in view while
+    // scrolling, so only newly exposed columns are scanned.) We
+    // don't do this when painting asynchronously, as the scan would
+    // block the GUI thread: instead the range is picked up as tiles
+    // arrive, and the renderer recolours what it already has.
+    
+    bool prescanned = false;
+    
+    if (m_synchronous && m_normalizeVisibleArea) {
+        MagnitudeRange range = renderer->scanMagnitudeRange(v);
+        if (range.isSet()) {
+            prescanned = true;
+            m_viewMags[viewId] = range;
+            MagnitudeRange previous = m_lastRenderedMags[viewId];
+            ColourScale scale = makeColourScale(viewId);
+            if (m_lastRenderedMags[viewId] != previous &&
+                !renderer->setColourScale(scale, m_colourRotation)) {
+                discardRenderer(viewId);
+                renderer = getRenderer(v);
+            }
+        }
+    }
+
     bool continuingPaint = !renderer->geometryChanged(v);
     
     if (continuingPaint) {
@@ -1669,7 +1891,7 @@ SpectrogramLayer::paintWithRenderer(LayerGeometryProvider *v, QPainter &paint, Q
 
     } else {
 
-        result = renderer->renderTimeConstrained(v, paint, rect);
+        result = renderer->renderAsynchronous(v, paint, rect);
 
 #ifdef DEBUG_SPECTROGRAM_REPAINT
         cerr << "rect width from this paint: " << result.rendered.width()
@@ -1677,12 +1899,19 @@ SpectrogramLayer::paintWithRenderer(LayerGeometryProvider *v, QPainter &paint, Q
              << result.range.getMax() << endl;
 #endif
         
+        // If a tile is being rendered in the background, the renderer
+        // will ask for a repaint itself when it's ready
         QRect uncached = renderer->getLargestUncachedRect(v);
-        if (uncached.width() > 0) {
+        if (uncached.width() > 0 &&
+            !renderer->hasBackgroundRenderPending()) {
             v->updatePaintRect(uncached);
         }
     }
 
+    if (prescanned) {
+        return;
+    }
+    
     magRange.sample(result.range);
 
     if (magRange.isSet()) {
@@ -1701,8 +1930,10 @@ SpectrogramLayer::paintWithRenderer(LayerGeometryProvider *v, QPainter &paint, Q
         cerr << "mag range has changed from last rendered range: re-rendering"
              << endl;
 #endif
-        delete m_renderers[viewId];
-        m_renderers.erase(viewId);
+        if (!renderer->setColourScale(makeColourScale(viewId),
+                                      m_colourRotation)) {
+            discardRenderer(viewId);
+        }
         v->updatePaintRect(v->getPaintRect());
     }
 }
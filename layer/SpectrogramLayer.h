@@ -35,6 +35,8 @@
 #include <QImage>
 #include <QPixmap>
 
+#include <memory>
+
 class View;
 class QPainter;
 class QImage;
@@ -42,6 +44,7 @@ class QPixmap;
 class QTimer;
 class FFTModel;
 class Dense3DModelPeakCache;
+class PeakFrequencyCache;
 
 /**
  * SpectrogramLayer represents waveform data (obtained from a
@@ -70,6 +73,7 @@ public:
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
     void setSynchronousPainting(bool synchronous) override;
+    void discardViewState(int viewId) const override;
 
     int getVerticalScaleWidth(LayerGeometryProvider *v, bool detailed, QPainter &) const override;
     void paintVerticalScale(LayerGeometryProvider *v, bool detailed, QPainter &paint, QRect rect) const override;
@@ -331,8 +335,10 @@ protected:
     // We take responsibility for registering/deregistering these
     // models and caches with ModelById
     ModelId m_fftModel; // an FFTModel
+    std::vector<ModelId> m_fftReaders; // FFTModels like m_fftModel, see below
     ModelId m_wholeCache; // a Dense3DModelPeakCache
     ModelId m_peakCache; // a Dense3DModelPeakCache
+    std::shared_ptr<PeakFrequencyCache> m_peakFrequencyCache; // for m_fftModel
     int m_peakCacheDivisor;
     
     mutable std::vector<ModelId> m_exporters; // used, waiting to be released
@@ -346,10 +352,43 @@ protected:
     mutable ViewMagMap m_lastRenderedMags; // when in normalizeVisibleArea mode
     void invalidateMagnitudes();
 
-    typedef std::map<int, Colour3DPlotRenderer *> ViewRendererMap; // key is view id
+    // Renderers are shared between views that are showing exactly
+    // the same area at the same size, as they would otherwise
+    // render identical images. Everything else that affects
+    // rendering belongs to the layer, and so is common to all of
+    // its views anyway (apart from the magnitude range used when
+    // normalising the visible area, which follows from the area).
+    struct RendererKey {
+        QSize paintSize;
+        ZoomLevel zoomLevel;
+        sv_frame_t startFrame;
+        bool operator==(const RendererKey &other) const {
+            return paintSize == other.paintSize &&
+                zoomLevel == other.zoomLevel &&
+                startFrame == other.startFrame;
+        }
+    };
+    struct SharedRenderer {
+        SharedRenderer(Colour3DPlotRenderer *r, RendererKey k) :
+            renderer(r), key(k) { }
+        ~SharedRenderer() { delete renderer; }
+        SharedRenderer(const SharedRenderer &) = delete;
+        SharedRenderer &operator=(const SharedRenderer &) = delete;
+        Colour3DPlotRenderer *renderer;
+        RendererKey key; // geometry the renderer was last used with
+    };
+    struct ViewRenderer {
+        std::shared_ptr<SharedRenderer> shared;
+        RendererKey key; // geometry the view last asked for
+    };
+    typedef std::map<int, ViewRenderer> ViewRendererMap; // key is view id
     mutable ViewRendererMap m_renderers;
     Colour3DPlotRenderer *getRenderer(LayerGeometryProvider *) const;
+    void discardRenderer(int viewId) const;
+    ColourScale makeColourScale(int viewId) const;
     void invalidateRenderers();
+    void recolourRenderers();
+    QString getRenderCacheIdentity() const;
 
     void deleteDerivedModels();
     
@@ -31,6 +31,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 TextLayer::TextLayer() :
     SingleColourLayer(),
@@ -114,23 +115,26 @@ TextLayer::getValueExtents(double &, double &, bool &, QString &) const
     return false;
 }
 
-bool
-TextLayer::isLayerScrollable(const LayerGeometryProvider *v) const
-{
-    QPoint discard;
-    return !v->shouldIlluminateLocalFeatures(this, discard);
-}
-
 EventVector
 TextLayer::getLocalPoints(LayerGeometryProvider *v, int x, int y) const
 {
     auto model = ModelById::getAs<TextModel>(m_model);
     if (!model) return {};
 
+    // A label extends at most overlap pixels to the right of its
+    // event, so only events starting between there and x can be
+    // hit. The model looks these up through its own index, so this
+    // costs the same however many labels there are elsewhere in
+    // the view.
+    
     int overlap = ViewManager::scalePixelSize(150);
+
+    int left = std::max(x - overlap, -overlap);
+    int right = std::min(x, v->getPaintWidth() + overlap);
+    if (right < left) return {};
     
-    sv_frame_t frame0 = v->getFrameForX(-overlap);
-    sv_frame_t frame1 = v->getFrameForX(v->getPaintWidth() + overlap);
+    sv_frame_t frame0 = v->getFrameForX(left);
+    sv_frame_t frame1 = v->getFrameForX(right + 1);
     
     EventVector points(model->getEventsSpanning(frame0, frame1 - frame0));
 
@@ -139,7 +143,7 @@ TextLayer::getLocalPoints(LayerGeometryProvider *v, int x, int y) const
 
     for (EventVector::iterator i = points.begin(); i != points.end(); ++i) {
 
-        Event p(*i);
+        const Event &p(*i);
 
         int px = v->getXForFrame(p.getFrame());
         int py = getYForHeight(v, p.getValue());
@@ -321,77 +325,90 @@ TextLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const
 //    SVDEBUG << "TextLayer::paint: resolution is "
 //              << model->getResolution() << " frames" << endl;
 
-    QPoint localPos;
-    Event illuminatePoint(0);
-    bool shouldIlluminate = false;
-
-    if (v->shouldIlluminateLocalFeatures(this, localPos)) {
-        shouldIlluminate = getPointToDrag(v, localPos.x(), localPos.y(),
-                                          illuminatePoint);
-    }
+    // The label nearest the mouse is illuminated in paintIllumination,
+    // so that what we draw here does not depend on the mouse position
+    // and the layer can remain scrollable
 
     int boxMaxWidth = 150;
-    int boxMaxHeight = 200;
 
     paint.save();
     paint.setClipRect(rect.x(), 0, rect.width() + boxMaxWidth, v->getPaintHeight());
+    paint.setPen(penColour);
+    paint.setBrush(brushColour);
     
     for (EventVector::const_iterator i = points.begin();
          i != points.end(); ++i) {
+        drawLabelBox(v, paint, *i);
+    }
 
-        Event p(*i);
+    paint.restore();
 
-        int x = v->getXForFrame(p.getFrame());
-        int y = getYForHeight(v, p.getValue());
+    // looks like save/restore doesn't deal with this:
+    paint.setRenderHint(QPainter::Antialiasing, false);
+}
 
-        if (!shouldIlluminate || illuminatePoint != p) {
-            paint.setPen(penColour);
-            paint.setBrush(brushColour);
-        } else {
-            paint.setBrush(penColour);
-            paint.setPen(v->getBackground());
-        }
+void
+TextLayer::paintIllumination(LayerGeometryProvider *v, QPainter &paint,
+                             QRect) const
+{
+    auto model = ModelById::getAs<TextModel>(m_model);
+    if (!model || !model->isOK()) return;
 
-        QString label = p.getLabel();
-        if (label == "") {
-            label = tr("<no text>");
-        }
+    QPoint localPos;
+    if (!v->shouldIlluminateLocalFeatures(this, localPos)) return;
 
-        QRect boxRect = paint.fontMetrics().boundingRect
-            (QRect(0, 0, boxMaxWidth, boxMaxHeight),
-             Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap, label);
+    Event p;
+    if (!getPointToDrag(v, localPos.x(), localPos.y(), p)) return;
 
-        QRect textRect = QRect(3, 2, boxRect.width(), boxRect.height());
-        boxRect = QRect(0, 0, boxRect.width() + 6, boxRect.height() + 2);
+    // The illuminated label is drawn inverted, entirely covering its
+    // ordinary box
 
-        if (y + boxRect.height() > v->getPaintHeight()) {
-            if (boxRect.height() > v->getPaintHeight()) y = 0;
-            else y = v->getPaintHeight() - boxRect.height() - 1;
-        }
+    paint.save();
+    paint.setBrush(v->getForeground());
+    paint.setPen(v->getBackground());
+    drawLabelBox(v, paint, p);
+    paint.restore();
 
-        boxRect = QRect(x, y, boxRect.width(), boxRect.height());
-        textRect = QRect(x + 3, y + 2, textRect.width(), textRect.height());
+    paint.setRenderHint(QPainter::Antialiasing, false);
+}
 
-//        boxRect = QRect(x, y, boxRect.width(), boxRect.height());
-//        textRect = QRect(x + 3, y + 2, textRect.width(), textRect.height());
+void
+TextLayer::drawLabelBox(LayerGeometryProvider *v, QPainter &paint,
+                        const Event &p) const
+{
+    int boxMaxWidth = 150;
+    int boxMaxHeight = 200;
+
+    int x = v->getXForFrame(p.getFrame());
+    int y = getYForHeight(v, p.getValue());
 
-        paint.setRenderHint(QPainter::Antialiasing, false);
-        paint.drawRect(boxRect);
+    QString label = p.getLabel();
+    if (label == "") {
+        label = tr("<no text>");
+    }
+
+    QRect boxRect = paint.fontMetrics().boundingRect
+        (QRect(0, 0, boxMaxWidth, boxMaxHeight),
+         Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap, label);
 
-        paint.setRenderHint(QPainter::Antialiasing, true);
-        paint.drawText(textRect,
-                       Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap,
-                       label);
+    QRect textRect = QRect(3, 2, boxRect.width(), boxRect.height());
+    boxRect = QRect(0, 0, boxRect.width() + 6, boxRect.height() + 2);
 
-///        if (p.getLabel() != "") {
-///            paint.drawText(x + 5, y - paint.fontMetrics().height() + paint.fontMetrics().ascent(), p.getLabel());
-///        }
+    if (y + boxRect.height() > v->getPaintHeight()) {
+        if (boxRect.height() > v->getPaintHeight()) y = 0;
+        else y = v->getPaintHeight() - boxRect.height() - 1;
     }
 
-    paint.restore();
+    boxRect = QRect(x, y, boxRect.width(), boxRect.height());
+    textRect = QRect(x + 3, y + 2, textRect.width(), textRect.height());
 
-    // looks like save/restore doesn't deal with this:
     paint.setRenderHint(QPainter::Antialiasing, false);
+    paint.drawRect(boxRect);
+
+    paint.setRenderHint(QPainter::Antialiasing, true);
+    paint.drawText(textRect,
+                   Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap,
+                   label);
 }
 
 void
@@ -33,6 +33,7 @@ public:
     TextLayer();
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void paintIllumination(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
 
     QString getFeatureDescription(LayerGeometryProvider *v, QPoint &) const override;
 
@@ -74,8 +75,6 @@ public:
                                           int value) const override;
     void setProperty(const PropertyName &, int value) override;
 
-    bool isLayerScrollable(const LayerGeometryProvider *v) const override;
-
     bool isLayerEditable() const override { return true; }
 
     int getCompletion(LayerGeometryProvider *) const override;
@@ -100,6 +99,9 @@ protected:
 
     bool getPointToDrag(LayerGeometryProvider *v, int x, int y, Event &) const;
 
+    void drawLabelBox(LayerGeometryProvider *v, QPainter &paint,
+                      const Event &) const;
+
     ModelId m_model;
     bool m_editing;
     QPoint m_editOrigin;
@@ -36,6 +36,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 //#define DEBUG_TIME_INSTANT_LAYER 1
 
@@ -165,13 +166,6 @@ TimeInstantLayer::needsTextLabelHeight() const
     else return false;
 }
 
-bool
-TimeInstantLayer::isLayerScrollable(const LayerGeometryProvider *v) const
-{
-    QPoint discard;
-    return !v->shouldIlluminateLocalFeatures(this, discard);
-}
-
 EventVector
 TimeInstantLayer::getLocalPoints(LayerGeometryProvider *v, int x) const
 {
@@ -379,15 +373,9 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
         oddBrushColour.setAlpha(100);
     }
 
-    QPoint localPos;
-    sv_frame_t illuminateFrame = -1;
-
-    if (v->shouldIlluminateLocalFeatures(this, localPos)) {
-        EventVector localPoints = getLocalPoints(v, localPos.x());
-        if (!localPoints.empty()) {
-            illuminateFrame = localPoints.begin()->getFrame();
-        }
-    }
+    // The point nearest the mouse is illuminated in
+    // paintIllumination, so that what we draw here does not depend on
+    // the mouse position and the layer can remain scrollable
         
     int prevX = -1;
     int textY = v->getTextLabelYCoord(this, paint);
@@ -395,7 +383,31 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
     for (EventVector::const_iterator i = points.begin();
          i != points.end(); ++i) {
 
-        Event p(*i);
+        if (m_plotStyle == PlotSegmentation) {
+
+            // Of the segments starting in any one pixel column, only
+            // the last extends beyond it - the rest have no width to
+            // fill and no room for a label. With very dense
+            // segmentations, skip straight to that last one, so that
+            // we draw one segment per column rather than one per
+            // point. Parity flips once for each segment skipped
+            
+            int column = v->getXForFrame(i->getFrame());
+            sv_frame_t columnEnd = v->getFrameForX(column + 1);
+            auto n = std::lower_bound(i, points.end(), columnEnd,
+                                      [](const Event &e, sv_frame_t f) {
+                                          return e.getFrame() < f;
+                                      }) - i;
+            if (n > 1) {
+                EventVector::const_iterator last = i + (n - 1);
+                if (v->getXForFrame(last->getFrame()) == column) {
+                    if ((n - 1) % 2 == 1) odd = !odd;
+                    i = last;
+                }
+            }
+        }
+
+        const Event &p(*i);
         EventVector::const_iterator j = i;
         ++j;
 
@@ -405,8 +417,7 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
         SVCERR << "point frame = " << p.getFrame() << " -> x = " << x << endl;
 #endif
         
-        if (x == prevX && m_plotStyle == PlotInstants &&
-            p.getFrame() != illuminateFrame) {
+        if (x == prevX && m_plotStyle == PlotInstants) {
 #ifdef DEBUG_TIME_INSTANT_LAYER
             SVCERR << "(skipping)" << endl;
 #endif
@@ -426,11 +437,7 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
             }
         }
                 
-        if (p.getFrame() == illuminateFrame) {
-            paint.setPen(getForegroundQColor(v->getView()));
-        } else {
-            paint.setPen(brushColour);
-        }
+        paint.setPen(brushColour);
 
 #ifdef DEBUG_TIME_INSTANT_LAYER
         SVCERR << "m_plotStyle = " << m_plotStyle << ", iw = " << iw << endl;
@@ -450,7 +457,7 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
             int nx;
             
             if (j != points.end()) {
-                Event q(*j);
+                const Event &q(*j);
                 nx = v->getXForFrame(q.getFrame());
             } else {
                 nx = v->getXForFrame(model->getEndFrame());
@@ -458,8 +465,7 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
 
             if (nx >= x) {
                 
-                if (illuminateFrame != p.getFrame() &&
-                    (nx < x + 5 || x >= v->getPaintWidth() - 1)) {
+                if (nx < x + 5 || x >= v->getPaintWidth() - 1) {
                     paint.setPen(Qt::NoPen);
                 }
 
@@ -500,6 +506,80 @@ TimeInstantLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) c
     }
 }
 
+void
+TimeInstantLayer::paintIllumination(LayerGeometryProvider *v, QPainter &paint,
+                                    QRect) const
+{
+    auto model = ModelById::getAs<SparseOneDimensionalModel>(m_model);
+    if (!model || !model->isOK()) return;
+
+    QPoint localPos;
+    if (!v->shouldIlluminateLocalFeatures(this, localPos)) return;
+
+    EventVector localPoints = getLocalPoints(v, localPos.x());
+    if (localPoints.empty()) return;
+
+    sv_frame_t illuminateFrame = localPoints.begin()->getFrame();
+
+    // The illuminated point together with its successor, which we
+    // need for its width or segment extent
+    EventVector points(model->getEventsWithin(illuminateFrame, 1, 1));
+    
+    for (EventVector::const_iterator i = points.begin();
+         i != points.end(); ++i) {
+
+        if (i->getFrame() != illuminateFrame) continue;
+
+        EventVector::const_iterator j = i;
+        ++j;
+
+        int x = v->getXForFrame(illuminateFrame);
+
+        paint.save();
+        paint.setPen(getForegroundQColor(v->getView()));
+        paint.setBrush(Qt::NoBrush);
+        
+        if (m_plotStyle == PlotInstants) {
+
+            int iw = v->getXForFrame(illuminateFrame +
+                                     model->getResolution()) - x;
+            if (iw < 2) {
+                if (iw < 1) {
+                    iw = 2;
+                    if (j != points.end()) {
+                        int nx = v->getXForFrame(j->getFrame());
+                        if (nx < x + 3) iw = 1;
+                    }
+                } else {
+                    iw = 2;
+                }
+            }
+            
+            if (iw > 1) {
+                paint.drawRect(x, 0, iw - 1, v->getPaintHeight() - 1);
+            } else {
+                paint.drawLine(x, 0, x, v->getPaintHeight() - 1);
+            }
+            
+        } else {
+            
+            int nx;
+            if (j != points.end()) {
+                nx = v->getXForFrame(j->getFrame());
+            } else {
+                nx = v->getXForFrame(model->getEndFrame());
+            }
+
+            if (nx >= x) {
+                paint.drawRect(x, -1, nx - x, v->getPaintHeight() + 1);
+            }
+        }
+
+        paint.restore();
+        break;
+    }
+}
+
 void
 TimeInstantLayer::drawStart(LayerGeometryProvider *v, QMouseEvent *e)
 {
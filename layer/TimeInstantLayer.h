@@ -34,6 +34,7 @@ public:
     virtual ~TimeInstantLayer();
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void paintIllumination(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
 
     QString getLabelPreceding(sv_frame_t) const override;
     QString getFeatureDescription(LayerGeometryProvider *v, QPoint &) const override;
@@ -84,7 +85,6 @@ public:
     void setPlotStyle(PlotStyle style);
     PlotStyle getPlotStyle() const { return m_plotStyle; }
 
-    bool isLayerScrollable(const LayerGeometryProvider *v) const override;
 
     bool isLayerEditable() const override { return true; }
 
@@ -340,20 +340,6 @@ TimeValueLayer::setShowDerivative(bool show)
     emit layerParametersChanged();
 }
 
-bool
-TimeValueLayer::isLayerScrollable(const LayerGeometryProvider *v) const
-{
-    // We don't illuminate sections in the line or curve modes, so
-    // they're always scrollable
-
-    if (m_plotStyle == PlotLines ||
-        m_plotStyle == PlotCurve ||
-        m_plotStyle == PlotDiscreteCurves) return true;
-
-    QPoint discard;
-    return !v->shouldIlluminateLocalFeatures(this, discard);
-}
-
 bool
 TimeValueLayer::getValueExtents(double &min, double &max,
                                 bool &logarithmic, QString &unit) const
@@ -934,6 +920,26 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
     
     if (points.empty()) return;
 
+    // A dense track (e.g. a pitch track with a small hop size, zoomed
+    // out) can have many points in each pixel column, most of which
+    // would be painted over by the others. Drop those before drawing
+
+    int sourceCount = int(points.size());
+    bool decimated = false;
+
+    if (sourceCount > x1 - x0 && !m_derivative &&
+        (m_plotStyle == PlotPoints ||
+         m_plotStyle == PlotStems ||
+         m_plotStyle == PlotLines ||
+         m_plotStyle == PlotCurve)) {
+        points = getDecimatedPoints(v, points);
+        decimated = true;
+#ifdef DEBUG_TIME_VALUE_LAYER
+        SVCERR << "TimeValueLayer[" << this << "]::paint: decimated "
+               << sourceCount << " points to " << points.size() << endl;
+#endif
+    }
+
     paint.setPen(getBaseQColor());
 
     QColor brushColour(getBaseQColor());
@@ -952,18 +958,9 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
     int origin = int(nearbyint(v->getPaintHeight() -
                                (-min * v->getPaintHeight()) / (max - min)));
 
-    QPoint localPos;
-    sv_frame_t illuminateFrame = -1;
-
-    if (v->shouldIlluminateLocalFeatures(this, localPos)) {
-        EventVector localPoints = getLocalPoints(v, localPos.x());
-#ifdef DEBUG_TIME_VALUE_LAYER
-        cerr << "TimeValueLayer: " << localPoints.size() << " local points" << endl;
-#endif
-        if (!localPoints.empty()) {
-            illuminateFrame = localPoints.begin()->getFrame();
-        }
-    }
+    // The point nearest the mouse is illuminated in
+    // paintIllumination, so that what we draw here does not depend on
+    // the mouse position and the layer can remain scrollable
 
     int w =
         v->getXForFrame(frame0 + model->getResolution()) -
@@ -1000,7 +997,7 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
 
         if (m_derivative && i == points.begin()) continue;
 
-        Event p(*i);
+        const Event &p(*i);
 
         double value = p.getValue();
         if (m_derivative) {
@@ -1040,7 +1037,7 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
         ++j;
 
         if (j != points.end()) {
-            Event q(*j);
+            const Event &q(*j);
             nvalue = q.getValue();
             if (m_derivative) nvalue -= p.getValue();
             nf = q.getFrame();
@@ -1077,36 +1074,14 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
             }
         }
 
-        bool illuminate = false;
-
-        if (illuminateFrame == p.getFrame()) {
-
-            // not equipped to illuminate the right section in line
-            // or curve mode
-
-            if (m_plotStyle != PlotCurve &&
-                m_plotStyle != PlotDiscreteCurves &&
-                m_plotStyle != PlotLines) {
-                illuminate = true;
-            }
-        }
-
         if (m_plotStyle != PlotLines &&
             m_plotStyle != PlotCurve &&
             m_plotStyle != PlotDiscreteCurves &&
             m_plotStyle != PlotSegmentation) {
-            if (illuminate) {
-                paint.save();
-                paint.setPen(v->scalePen(getForegroundQColor(v)));
-                paint.setBrush(getForegroundQColor(v));
-            }
             if (m_plotStyle != PlotStems ||
                 w > 1) {
                 paint.drawRect(x, y - 1, w, 2);
             }
-            if (illuminate) {
-                paint.restore();
-            }
         }
 
         if (m_plotStyle == PlotConnectedPoints ||
@@ -1180,12 +1155,10 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
 
             paint.setPen(v->scalePen(QPen(getForegroundQColor(v), 2)));
 
-            if (!illuminate) {
-                if (!m_drawSegmentDivisions ||
-                    nx < x + 5 ||
-                    x >= v->getPaintWidth() - 1) {
-                    paint.setPen(Qt::NoPen);
-                }
+            if (!m_drawSegmentDivisions ||
+                nx < x + 5 ||
+                x >= v->getPaintWidth() - 1) {
+                paint.setPen(Qt::NoPen);
             }
 
             paint.drawRect(x, -1, nx - x, v->getPaintHeight() + 1);
@@ -1237,7 +1210,8 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
         paint.drawPath(path);
     } else if ((m_plotStyle == PlotCurve || m_plotStyle == PlotLines)
                && !path.isEmpty()) {
-        paint.setRenderHint(QPainter::Antialiasing, pointCount <= v->getPaintWidth());
+        int density = (decimated ? sourceCount : pointCount);
+        paint.setRenderHint(QPainter::Antialiasing, density <= v->getPaintWidth());
         paint.drawPath(path);
     }
 
@@ -1247,6 +1221,160 @@ TimeValueLayer::paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) con
     paint.setRenderHint(QPainter::Antialiasing, false);
 }
 
+EventVector
+TimeValueLayer::getDecimatedPoints(LayerGeometryProvider *v,
+                                   const EventVector &points) const
+{
+    // For the lines and curve styles, a column is fully described by
+    // the first and last points in it (which join it to its
+    // neighbours) and those with the lowest and highest y
+    // coordinates, taken in their original order. For points and
+    // stems, each point is drawn at its own pixel position, so we
+    // keep one point from every run of consecutive points that share
+    // both x and y. That is the last of the run, as the only one
+    // that could have room after it for a label.
+    
+    bool envelope = (m_plotStyle == PlotLines || m_plotStyle == PlotCurve);
+
+    EventVector decimated;
+    
+    int n = int(points.size());
+    if (n == 0) return decimated;
+
+    std::vector<int> xs(n), ys(n);
+    for (int i = 0; i < n; ++i) {
+        xs[i] = v->getXForFrame(points[i].getFrame());
+        ys[i] = getYForValue(v, points[i].getValue());
+    }
+
+    int i = 0;
+    while (i < n) {
+
+        int j = i + 1;
+        while (j < n && xs[j] == xs[i]) ++j;
+
+        // points i to j-1 share a column
+        
+        if (envelope) {
+
+            int imin = i, imax = i;
+            for (int k = i + 1; k < j; ++k) {
+                if (ys[k] < ys[imin]) imin = k;
+                if (ys[k] > ys[imax]) imax = k;
+            }
+
+            int picks[] = { i, std::min(imin, imax), std::max(imin, imax), j-1 };
+            int prev = -1;
+            for (int k : picks) {
+                if (k != prev) decimated.push_back(points[k]);
+                prev = k;
+            }
+
+        } else {
+
+            for (int k = i; k < j; ++k) {
+                if (k + 1 == j || ys[k + 1] != ys[k]) {
+                    decimated.push_back(points[k]);
+                }
+            }
+        }
+
+        i = j;
+    }
+
+    return decimated;
+}
+
+void
+TimeValueLayer::paintIllumination(LayerGeometryProvider *v, QPainter &paint,
+                                  QRect) const
+{
+    // We are not equipped to illuminate the right section in line or
+    // curve mode
+
+    if (m_plotStyle == PlotLines ||
+        m_plotStyle == PlotCurve ||
+        m_plotStyle == PlotDiscreteCurves) return;
+    
+    auto model = ModelById::getAs<SparseTimeValueModel>(m_model);
+    if (!model || !model->isOK()) return;
+
+    QPoint localPos;
+    if (!v->shouldIlluminateLocalFeatures(this, localPos)) return;
+
+    EventVector localPoints = getLocalPoints(v, localPos.x());
+#ifdef DEBUG_TIME_VALUE_LAYER
+    cerr << "TimeValueLayer: " << localPoints.size() << " local points" << endl;
+#endif
+    if (localPoints.empty()) return;
+
+    sv_frame_t illuminateFrame = localPoints.begin()->getFrame();
+
+    // The illuminated point together with its neighbours, which we
+    // need for its derivative value and segment extent
+    EventVector points(model->getEventsWithin(illuminateFrame, 1, 1));
+
+    for (EventVector::const_iterator i = points.begin();
+         i != points.end(); ++i) {
+
+        if (i->getFrame() != illuminateFrame) continue;
+
+        // paint() has no value to show for the first point
+        if (m_derivative && i == points.begin()) break;
+        
+        int x = v->getXForFrame(illuminateFrame);
+
+        paint.save();
+        paint.setRenderHint(QPainter::Antialiasing, false);
+
+        if (m_plotStyle == PlotSegmentation) {
+
+            EventVector::const_iterator j = i;
+            ++j;
+
+            sv_frame_t nf = v->getModelsEndFrame();
+            if (j != points.end()) nf = j->getFrame();
+            int nx = v->getXForFrame(nf);
+            
+            if (nx > x) {
+                paint.setPen(v->scalePen(QPen(getForegroundQColor(v), 2)));
+                paint.setBrush(Qt::NoBrush);
+                paint.drawRect(x, -1, nx - x, v->getPaintHeight() + 1);
+            }
+
+        } else {
+            
+            double value = i->getValue();
+            if (m_derivative) {
+                EventVector::const_iterator j = i;
+                --j;
+                value -= j->getValue();
+            }
+
+            int y = getYForValue(v, value);
+
+            int w =
+                v->getXForFrame(illuminateFrame + model->getResolution()) - x;
+
+            if (m_plotStyle == PlotStems) {
+                if (w < 2) w = 2;
+            } else {
+                if (w < 1) w = 1;
+            }
+
+            if (m_plotStyle != PlotStems ||
+                w > 1) {
+                paint.setPen(v->scalePen(getForegroundQColor(v)));
+                paint.setBrush(getForegroundQColor(v));
+                paint.drawRect(x, y - 1, w, 2);
+            }
+        }
+
+        paint.restore();
+        break;
+    }
+}
+
 int
 TimeValueLayer::getVerticalScaleWidth(LayerGeometryProvider *v, bool, QPainter &paint) const
 {
@@ -38,6 +38,7 @@ public:
     TimeValueLayer();
 
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void paintIllumination(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
 
     int getVerticalScaleWidth(LayerGeometryProvider *v, bool, QPainter &) const override;
     void paintVerticalScale(LayerGeometryProvider *v, bool, QPainter &paint, QRect rect) const override;
@@ -120,7 +121,6 @@ public:
     void setShowDerivative(bool);
     bool getShowDerivative() const { return m_derivative; }
 
-    bool isLayerScrollable(const LayerGeometryProvider *v) const override;
 
     bool isLayerEditable() const override { return true; }
 
@@ -174,6 +174,16 @@ protected:
 
     EventVector getLocalPoints(LayerGeometryProvider *v, int) const;
 
+    /**
+     * Reduce a time-ordered set of points to those that make a
+     * visible difference when painted in the current plot style,
+     * given that many of them may fall in the same pixel column. Only
+     * meaningful for the points, stems, lines and curve styles
+     * without derivative.
+     */
+    EventVector getDecimatedPoints(LayerGeometryProvider *v,
+                                   const EventVector &points) const;
+
     int getDefaultColourHint(bool dark, bool &impose) override;
 
     ModelId m_model;
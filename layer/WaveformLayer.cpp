@@ -20,25 +20,34 @@
 #include "base/Profiler.h"
 #include "base/RangeMapper.h"
 #include "base/Strings.h"
+#include "base/HitCount.h"
 
 #include "ColourDatabase.h"
+#include "ScrollableImageCache.h"
+#include "WaveformSummaryPrefetcher.h"
 #include "PaintAssistant.h"
+#include "RenderThreadPool.h"
 
 #include "data/model/WaveformOversampler.h"
 
 #include <QPainter>
 #include <QPainterPath>
-#include <QPixmap>
+#include <QImage>
 #include <QTextStream>
 
 #include <iostream>
 #include <cmath>
+#include <atomic>
 
 //#define DEBUG_WAVEFORM_PAINT 1
 //#define DEBUG_WAVEFORM_PAINT_BY_PIXEL 1
 
 using std::vector;
 
+// Minimum number of summary blocks per channel to keep cached for a
+// view, when the view itself spans fewer
+static const int maxSummaryCacheBlocks = 65536;
+
 double
 WaveformLayer::m_dBMin = -80.0;
 
@@ -53,14 +62,13 @@ WaveformLayer::WaveformLayer() :
     m_scale(LinearScale),
     m_middleLineHeight(0.5),
     m_aggressive(false),
-    m_cache(nullptr),
-    m_cacheValid(false)
+    m_prefetcher(nullptr)
 {
 }
 
 WaveformLayer::~WaveformLayer()
 {
-    delete m_cache;
+    delete m_prefetcher;
 }
 
 const ZoomConstraint *
@@ -86,7 +94,11 @@ WaveformLayer::setModel(ModelId modelId)
 
     // NB newModel may legitimately be null
     
-    m_cacheValid = false;
+    invalidateCaches();
+    m_summaryCaches.clear();
+    m_prefetchStartFrames.clear();
+    delete m_prefetcher;
+    m_prefetcher = nullptr;
     
     bool channelsChanged = false;
     if (m_channel == -1) {
@@ -272,7 +284,7 @@ WaveformLayer::setGain(float gain)
 {
     if (m_gain == gain) return;
     m_gain = gain;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
     emit verticalZoomChanged();
 }
@@ -282,7 +294,7 @@ WaveformLayer::setAutoNormalize(bool autoNormalize)
 {
     if (m_autoNormalize == autoNormalize) return;
     m_autoNormalize = autoNormalize;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -291,7 +303,7 @@ WaveformLayer::setShowMeans(bool showMeans)
 {
     if (m_showMeans == showMeans) return;
     m_showMeans = showMeans;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -300,7 +312,7 @@ WaveformLayer::setChannelMode(ChannelMode channelMode)
 {
     if (m_channelMode == channelMode) return;
     m_channelMode = channelMode;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -311,7 +323,7 @@ WaveformLayer::setChannel(int channel)
 
     if (m_channel == channel) return;
     m_channel = channel;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -320,7 +332,7 @@ WaveformLayer::setScale(Scale scale)
 {
     if (m_scale == scale) return;
     m_scale = scale;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -329,7 +341,7 @@ WaveformLayer::setMiddleLineHeight(double height)
 {
     if (m_middleLineHeight == height) return;
     m_middleLineHeight = height;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -338,7 +350,7 @@ WaveformLayer::setAggressiveCacheing(bool aggressive)
 {
     if (m_aggressive == aggressive) return;
     m_aggressive = aggressive;
-    m_cacheValid = false;
+    invalidateCaches();
     emit layerParametersChanged();
 }
 
@@ -577,6 +589,14 @@ WaveformLayer::getNormalizeGain(LayerGeometryProvider *v, int channel) const
     return float(1.0 / std::max(fabs(range.max()), fabs(range.min())));
 }
 
+void
+WaveformLayer::discardViewState(int viewId) const
+{
+    m_caches.erase(viewId);
+    m_summaryCaches.erase(viewId);
+    m_prefetchStartFrames.erase(viewId);
+}
+
 void
 WaveformLayer::paint(LayerGeometryProvider *v, QPainter &viewPainter, QRect rect) const
 {
@@ -585,12 +605,10 @@ WaveformLayer::paint(LayerGeometryProvider *v, QPainter &viewPainter, QRect rect
         return;
     }
   
-    ZoomLevel zoomLevel = v->getZoomLevel();
-
 #ifdef DEBUG_WAVEFORM_PAINT
     Profiler profiler("WaveformLayer::paint", true);
     SVCERR << "WaveformLayer::paint (" << rect.x() << "," << rect.y()
-              << ") [" << rect.width() << "x" << rect.height() << "]: zoom " << zoomLevel << endl;
+              << ") [" << rect.width() << "x" << rect.height() << "]: zoom " << v->getZoomLevel() << endl;
 #endif
 
     int channels = 0, minChannel = 0, maxChannel = 0;
@@ -600,52 +618,144 @@ WaveformLayer::paint(LayerGeometryProvider *v, QPainter &viewPainter, QRect rect
                                      mergingChannels, mixingChannels);
     if (channels == 0) return;
 
-    int w = v->getPaintWidth();
-    int h = v->getPaintHeight();
-
-    QPainter *paint;
-
-    if (m_aggressive) {
+    m_effectiveGains.clear();
+    while ((int)m_effectiveGains.size() <= maxChannel) {
+        m_effectiveGains.push_back(m_gain);
+    }
+    if (m_autoNormalize) {
+        for (int ch = minChannel; ch <= maxChannel; ++ch) {
+            m_effectiveGains[ch] = getNormalizeGain(v, ch);
+        }
+    }
 
+    // Only cache once the model is complete: until then, what we
+    // would cache is liable to change underneath us
+    
+    if (m_aggressive && model->isReady()) {
 #ifdef DEBUG_WAVEFORM_PAINT
         SVCERR << "WaveformLayer::paint: aggressive is true" << endl;
 #endif
+        paintWithCache(v, viewPainter, rect);
+    } else {
+        paintWaveform(v, &viewPainter, rect);
+    }
+}
+
+void
+WaveformLayer::paintWithCache(LayerGeometryProvider *v,
+                              QPainter &viewPainter,
+                              QRect rect) const
+{
+    ViewCache &viewCache = m_caches[v->getId()];
+
+    if (viewCache.gains != m_effectiveGains) {
+        // Only happens without an explicit invalidation if we are
+        // normalising to the visible area and it has changed
+        // scale. Retained zoom levels are no good either then
+        viewCache = ViewCache();
+        viewCache.gains = m_effectiveGains;
+    }
+    
+    ScrollableImageCache &cache = viewCache.image;
+
+    cache.resize(v->getPaintSize());
+    cache.setZoomLevel(v->getZoomLevel());
+
+    sv_frame_t startFrame = v->getStartFrame();
+
+    int x0 = rect.left();
+    int x1 = rect.right() + 1;
+    
+    static HitCount count("WaveformLayer: image cache");
+
+    if (cache.isValid()) {
 
-        using namespace std::rel_ops;
+        if (v->getXForFrame(cache.getStartFrame()) ==
+            v->getXForFrame(startFrame) &&
+            cache.getValidLeft() <= x0 &&
+            cache.getValidRight() >= x1) {
+
+            count.hit();
+            cache.drawContents(viewPainter, rect);
+            return;
+        }
+
+        count.partial();
+
+        // Move along whatever is still visible, and then paint only
+        // what is missing. As in Colour3DPlotRenderer, we don't
+        // handle a valid area in the middle of the requested one:
+        // start again in that case
+        cache.scrollTo(v, startFrame);
         
-        if (m_cacheValid && (zoomLevel != m_cacheZoomLevel)) {
-            m_cacheValid = false;
+        if (cache.getValidLeft() > x0 && cache.getValidRight() < x1) {
+            cache.invalidate();
         }
+        
+    } else {
+        count.miss();
+        cache.setStartFrame(startFrame);
+    }
+
+    if (cache.isValid()) {
+        int left = x0;
+        int width = x1 - x0;
+        bool isLeftOfValidArea = false;
+        cache.adjustToTouchValidArea(left, width, isLeftOfValidArea);
+        x0 = left;
+        x1 = x0 + width;
+    }
 
-        if (!m_cache || m_cache->width() != w || m_cache->height() != h) {
 #ifdef DEBUG_WAVEFORM_PAINT
-            if (m_cache) {
-                SVCERR << "WaveformLayer::paint: cache size " << m_cache->width() << "x" << m_cache->height() << " differs from view size " << w << "x" << h << ": regenerating aggressive cache" << endl;
-            }
+    SVCERR << "WaveformLayer::paintWithCache: painting " << x0 << " to "
+           << x1 << " into cache, valid area is " << cache.getValidLeft()
+           << " to " << cache.getValidRight() << endl;
 #endif
-            delete m_cache;
-            m_cache = new QPixmap(w, h);
-            m_cacheValid = false;
-        }
 
-        if (m_cacheValid) {
-            viewPainter.drawPixmap(rect, *m_cache, rect);
-            return;
-        }
+    if (x1 > x0) {
 
-        paint = new QPainter(m_cache);
+        // Always paint the full height, so that the cache's valid
+        // area is only ever a matter of horizontal extent
+        
+        QImage strip(x1 - x0, cache.getSize().height(),
+                     QImage::Format_ARGB32_Premultiplied);
+        strip.fill(getBackgroundQColor(v));
 
-        paint->setPen(Qt::NoPen);
-        paint->setBrush(getBackgroundQColor(v));
-        paint->drawRect(rect);
+        QPainter paint(&strip);
+        paint.translate(-x0, 0);
+        paint.setPen(getForegroundQColor(v));
+        paint.setBrush(Qt::NoBrush);
 
-        paint->setPen(getForegroundQColor(v));
-        paint->setBrush(Qt::NoBrush);
+        paintWaveform(v, &paint, QRect(x0, 0, x1 - x0, strip.height()));
 
-    } else {
-        paint = &viewPainter;
+        paint.end();
+
+        cache.drawImage(x0, x1 - x0, strip, 0, x1 - x0);
     }
 
+    QRect pr = rect & cache.getValidArea();
+    cache.drawContents(viewPainter, pr);
+}
+
+void
+WaveformLayer::paintWaveform(LayerGeometryProvider *v, QPainter *paint,
+                             QRect rect) const
+{
+    auto model = ModelById::getAs<RangeSummarisableTimeValueModel>(m_model);
+    if (!model) return;
+    
+    ZoomLevel zoomLevel = v->getZoomLevel();
+
+    int channels = 0, minChannel = 0, maxChannel = 0;
+    bool mergingChannels = false, mixingChannels = false;
+
+    channels = getChannelArrangement(minChannel, maxChannel,
+                                     mergingChannels, mixingChannels);
+    if (channels == 0) return;
+
+    int w = v->getPaintWidth();
+    int h = v->getPaintHeight();
+
     paint->setRenderHint(QPainter::Antialiasing, true);
 
     if (m_middleLineHeight != 0.5) {
@@ -698,23 +808,22 @@ WaveformLayer::paint(LayerGeometryProvider *v, QPainter &viewPainter, QRect rect
     SVCERR << "Painting waveform from " << frame0 << " to " << frame1 << " (" << (x1-x0+1) << " pixels at zoom " << zoomLevel << " and model zoom " << blockSize << ")" <<  endl;
 #endif
 
-    m_effectiveGains.clear();
-    while ((int)m_effectiveGains.size() <= maxChannel) {
-        m_effectiveGains.push_back(m_gain);
-    }
-    if (m_autoNormalize) {
-        for (int ch = minChannel; ch <= maxChannel; ++ch) {
-            m_effectiveGains[ch] = getNormalizeGain(v, ch);
-        }
-    }
-
     RangeVec ranges;
 
     if (v->getZoomLevel().zone == ZoomLevel::FramesPerPixel) {
-        getSummaryRanges(minChannel, maxChannel,
-                         mixingChannels || mergingChannels,
-                         frame0, frame1,
-                         blockSize, ranges);
+        if (model->isReady()) {
+            getCachedSummaryRanges(v, minChannel, maxChannel,
+                                   mixingChannels || mergingChannels,
+                                   frame0, frame1,
+                                   blockSize, ranges);
+            schedulePrefetch(v, minChannel, maxChannel,
+                             mixingChannels || mergingChannels);
+        } else {
+            getSummaryRanges(minChannel, maxChannel,
+                             mixingChannels || mergingChannels,
+                             frame0, frame1,
+                             blockSize, ranges);
+        }
     } else {
         getOversampledRanges(minChannel, maxChannel,
                              mixingChannels || mergingChannels,
@@ -723,25 +832,151 @@ WaveformLayer::paint(LayerGeometryProvider *v, QPainter &viewPainter, QRect rect
     }
 
     if (!ranges.empty()) {
-        for (int ch = minChannel; ch <= maxChannel; ++ch) {
-            paintChannel(v, paint, rect, ch, ranges, blockSize,
-                         frame0, frame1);
-        }
+        paintChannels(v, paint, rect, ranges, blockSize, frame0, frame1);
     }
     
     if (m_middleLineHeight != 0.5) {
         paint->restore();
     }
+}
+
+void
+WaveformLayer::getCachedSummaryRanges(LayerGeometryProvider *v,
+                                      int minChannel, int maxChannel,
+                                      bool mixingOrMerging,
+                                      sv_frame_t frame0, sv_frame_t frame1,
+                                      int blockSize, RangeVec &ranges)
+    const
+{
+    // Summaries are independent of gain and scale, so these survive
+    // the invalidation of the image caches and can be reused when
+    // the waveform is repainted at a different gain. As the view
+    // scrolls, newly fetched summaries that adjoin those already
+    // cached are added to them, so that the cache tends to cover
+    // the whole of the visible area
+
+    static HitCount count("WaveformLayer: summary cache");
+    
+    SummaryCache &c = m_summaryCaches[v->getId()];
+
+    if (c.ranges.empty() ||
+        c.minChannel != minChannel ||
+        c.maxChannel != maxChannel ||
+        c.mixingOrMerging != mixingOrMerging ||
+        c.blockSize != blockSize ||
+        frame1 < c.frame0 || frame0 > c.frame1) {
+
+        count.miss();
+        
+        c = SummaryCache();
+        c.minChannel = minChannel;
+        c.maxChannel = maxChannel;
+        c.mixingOrMerging = mixingOrMerging;
+        c.blockSize = blockSize;
+        c.frame0 = frame0;
+        c.frame1 = frame1;
+        getSummaryRanges(minChannel, maxChannel, mixingOrMerging,
+                         frame0, frame1, blockSize, c.ranges);
+        ranges = c.ranges;
+        return;
+    }
 
-    if (m_aggressive) {
-        if (model->isReady() && rect == v->getPaintRect()) {
-            m_cacheValid = true;
-            m_cacheZoomLevel = zoomLevel;
+    if (frame0 >= c.frame0 && frame1 <= c.frame1) {
+        count.hit();
+    } else {
+        count.partial();
+    }
+    
+    // We can only extend the cached ranges if they are complete,
+    // i.e. we got exactly one range per block (which we won't have
+    // done at the end of the model)
+    
+    auto complete = [&](const RangeVec &rv, sv_frame_t f0, sv_frame_t f1) {
+        for (const auto &r : rv) {
+            if (sv_frame_t(r.size()) != (f1 - f0) / blockSize) return false;
+        }
+        return true;
+    };
+
+    if (frame0 < c.frame0) {
+        RangeVec before;
+        getSummaryRanges(minChannel, maxChannel, mixingOrMerging,
+                         frame0, c.frame0, blockSize, before);
+        if (before.size() == c.ranges.size() &&
+            complete(before, frame0, c.frame0)) {
+            for (int i = 0; in_range_for(c.ranges, i); ++i) {
+                c.ranges[i].insert(c.ranges[i].begin(),
+                                   before[i].begin(), before[i].end());
+            }
+            c.frame0 = frame0;
         }
-        paint->end();
-        delete paint;
-        viewPainter.drawPixmap(rect, *m_cache, rect);
     }
+
+    if (frame1 > c.frame1 && complete(c.ranges, c.frame0, c.frame1)) {
+        RangeVec after;
+        getSummaryRanges(minChannel, maxChannel, mixingOrMerging,
+                         c.frame1, frame1, blockSize, after);
+        if (after.size() == c.ranges.size()) {
+            for (int i = 0; in_range_for(c.ranges, i); ++i) {
+                c.ranges[i].insert(c.ranges[i].end(),
+                                   after[i].begin(), after[i].end());
+            }
+            c.frame1 = frame1;
+        }
+    }
+
+    if (frame0 < c.frame0 || frame1 > c.frame1) {
+        // Couldn't extend, so this request just replaces the cache
+        c.frame0 = frame0;
+        c.frame1 = frame1;
+        c.ranges.clear();
+        getSummaryRanges(minChannel, maxChannel, mixingOrMerging,
+                         frame0, frame1, blockSize, c.ranges);
+        ranges = c.ranges;
+        return;
+    }
+
+    // Limit the cache to a few times the visible area, dropping
+    // whichever end is further from this request
+    
+    sv_frame_t limit = std::max(sv_frame_t(maxSummaryCacheBlocks) * blockSize,
+                                (v->getEndFrame() - v->getStartFrame()) * 4);
+    
+    if (c.frame1 - c.frame0 > limit) {
+        sv_frame_t trim = (c.frame1 - c.frame0 - limit) / blockSize;
+        if (frame0 - c.frame0 > c.frame1 - frame1) {
+            trim = std::min(trim, (frame0 - c.frame0) / blockSize);
+            for (auto &r : c.ranges) {
+                r.erase(r.begin(), r.begin() + std::min(sv_frame_t(r.size()),
+                                                        trim));
+            }
+            c.frame0 += trim * blockSize;
+        } else if (complete(c.ranges, c.frame0, c.frame1)) {
+            trim = std::min(trim, (c.frame1 - frame1) / blockSize);
+            for (auto &r : c.ranges) {
+                r.erase(r.end() - trim, r.end());
+            }
+            c.frame1 -= trim * blockSize;
+        }
+    }
+
+    sv_frame_t offset = (frame0 - c.frame0) / blockSize;
+    sv_frame_t n = WaveformSummaryPrefetcher::getRangeCount
+        (frame0, frame1, blockSize);
+
+    ranges.clear();
+    for (const auto &r : c.ranges) {
+        sv_frame_t i0 = std::min(offset, sv_frame_t(r.size()));
+        sv_frame_t i1 = std::min(offset + n, sv_frame_t(r.size()));
+        ranges.push_back(RangeSummarisableTimeValueModel::RangeBlock
+                         (r.begin() + i0, r.begin() + i1));
+    }
+}
+
+void
+WaveformLayer::invalidateCaches()
+{
+    m_caches.clear();
 }
 
 void
@@ -751,29 +986,102 @@ WaveformLayer::getSummaryRanges(int minChannel, int maxChannel,
                                 int blockSize, RangeVec &ranges)
     const
 {
-    auto model = ModelById::getAs<RangeSummarisableTimeValueModel>(m_model);
-    if (!model) return;
-    
-    for (int ch = minChannel; ch <= maxChannel; ++ch) {
-        ranges.push_back({});
-        model->getSummaries(ch, frame0, frame1 - frame0,
-                              ranges[ch - minChannel], blockSize);
+    WaveformSummaryPrefetcher::Request request {
+        minChannel, maxChannel, mixingOrMerging, blockSize, frame0, frame1
+    };
+
+    if (m_prefetcher && m_prefetcher->retrieve(request, ranges)) {
+        return;
+    }
+
+    WaveformSummaryPrefetcher::fetch(m_model, request, ranges);
+
 #ifdef DEBUG_WAVEFORM_PAINT
-            SVCERR << "channel " << ch << ": " << ranges[ch - minChannel].size() << " ranges from " << frame0 << " to " << frame1 << " at zoom level " << blockSize << endl;
+    for (int ch = minChannel; ch <= maxChannel; ++ch) {
+        SVCERR << "channel " << ch << ": " << ranges[ch - minChannel].size() << " ranges from " << frame0 << " to " << frame1 << " at zoom level " << blockSize << endl;
+    }
 #endif
+}
+
+void
+WaveformLayer::schedulePrefetch(LayerGeometryProvider *v,
+                                int minChannel, int maxChannel,
+                                bool mixingOrMerging) const
+{
+    auto model = ModelById::getAs<RangeSummarisableTimeValueModel>(m_model);
+    if (!model || !model->isReady()) return;
+
+    ZoomLevel zoom = v->getZoomLevel();
+    if (zoom.zone != ZoomLevel::FramesPerPixel) return;
+
+    if (!m_prefetcher) {
+        m_prefetcher = new WaveformSummaryPrefetcher(m_model);
     }
+
+    sv_frame_t modelEnd = model->getEndFrame();
+    sv_frame_t start = v->getStartFrame();
+    sv_frame_t end = v->getEndFrame();
+    sv_frame_t extent = end - start;
+    int w = v->getPaintWidth();
+
+    // Which way are we going? If we are scrolling (or following
+    // playback), the next window is the one ahead; if we haven't
+    // moved, it could be either
     
-    if (mixingOrMerging) {
-        if (minChannel != 0 || maxChannel != 0) {
-            throw std::logic_error("Internal error: min & max channels should be 0 when merging or mixing all channels");
-        } else if (m_channelCount > 1) {
-            ranges.push_back({});
-            model->getSummaries
-                (1, frame0, frame1 - frame0, ranges[1], blockSize);
-        } else {
-            ranges.push_back(ranges[0]);
-        }
+    int direction = 0;
+    auto itr = m_prefetchStartFrames.find(v->getId());
+    if (itr != m_prefetchStartFrames.end()) {
+        if (start > itr->second) direction = 1;
+        else if (start < itr->second) direction = -1;
+    }
+    m_prefetchStartFrames[v->getId()] = start;
+
+    vector<WaveformSummaryPrefetcher::Request> requests;
+
+    auto add = [&](int blockSize, sv_frame_t f0, sv_frame_t f1) {
+        if (f0 < 0) f0 = 0;
+        if (f1 > modelEnd) f1 = modelEnd;
+        f0 = (f0 / blockSize) * blockSize;
+        f1 = ((f1 + blockSize - 1) / blockSize) * blockSize;
+        if (f1 <= f0) return;
+        requests.push_back({ minChannel, maxChannel, mixingOrMerging,
+                             blockSize, f0, f1 });
+    };
+    
+    // The windows are snapped to a grid of half their width or more,
+    // and made large enough to cover what we want from anywhere
+    // within a grid cell, so that they stay the same (and are
+    // skipped as already fetched) while the view moves a few pixels
+    // at a time
+    
+    int blockSize = model->getSummaryBlockSize(zoom.level);
+
+    if (extent <= 0) return;
+    
+    if (direction >= 0) {
+        sv_frame_t f0 = (end / extent) * extent;
+        add(blockSize, f0, f0 + 2 * extent);
+    }
+    if (direction <= 0) {
+        sv_frame_t f1 = ((start + extent - 1) / extent) * extent;
+        add(blockSize, f1 - 2 * extent, f1);
     }
+
+    // And the neighbouring zoom levels, assuming a zoom about the
+    // centre of the view
+    
+    sv_frame_t centre = start + extent / 2;
+
+    int levels[] = { zoom.level * 2, zoom.level / 2 };
+    for (int level : levels) {
+        if (level < 1) continue;
+        sv_frame_t span = sv_frame_t(w) * level;
+        sv_frame_t q = std::max(span / 2, sv_frame_t(1));
+        sv_frame_t f0 = ((centre - span / 2) / q) * q;
+        add(model->getSummaryBlockSize(level), f0, f0 + span + q);
+    }
+    
+    m_prefetcher->prefetch(requests);
 }
 
 void
@@ -852,13 +1160,13 @@ WaveformLayer::getOversampledRanges(int minChannel, int maxChannel,
 }
 
 void
-WaveformLayer::paintChannel(LayerGeometryProvider *v,
-                            QPainter *paint,
-                            QRect rect, int ch,
-                            const RangeVec &ranges,
-                            int blockSize,
-                            sv_frame_t frame0,
-                            sv_frame_t frame1)
+WaveformLayer::paintChannels(LayerGeometryProvider *v,
+                             QPainter *paint,
+                             QRect rect,
+                             const RangeVec &ranges,
+                             int blockSize,
+                             sv_frame_t frame0,
+                             sv_frame_t frame1)
     const
 {
     auto model = ModelById::getAs<RangeSummarisableTimeValueModel>(m_model);
@@ -890,44 +1198,124 @@ WaveformLayer::paintChannel(LayerGeometryProvider *v,
         midColour = midColour.lighter(50);
     }
 
-    double gain = m_effectiveGains[ch];
+    QColor clipColour =
+        ColourDatabase::getInstance()->getContrastingColour(m_colour);
 
-    int m = (h / channels) / 2;
-    int my = m + (((ch - minChannel) * h) / channels);
+    // Lay out the channels, and paint the axes and scale guides for
+    // those that are visible
+
+    vector<ChannelLane> lanes;
+    
+    for (int ch = minChannel; ch <= maxChannel; ++ch) {
+
+        int m = (h / channels) / 2;
+        int my = m + (((ch - minChannel) * h) / channels);
 
 #ifdef DEBUG_WAVEFORM_PAINT        
-    SVCERR << "ch = " << ch << ", channels = " << channels << ", m = " << m << ", my = " << my << ", h = " << h << endl;
+        SVCERR << "ch = " << ch << ", channels = " << channels << ", m = " << m << ", my = " << my << ", h = " << h << endl;
 #endif
 
-    if (my - m > y1 || my + m < y0) return;
+        if (my - m > y1 || my + m < y0) continue;
 
-    if ((m_scale == dBScale || m_scale == MeterScale) &&
-        m_channelMode != MergeChannels) {
-        m = (h / channels);
-        my = m + (((ch - minChannel) * h) / channels);
-    }
+        if ((m_scale == dBScale || m_scale == MeterScale) &&
+            m_channelMode != MergeChannels) {
+            m = (h / channels);
+            my = m + (((ch - minChannel) * h) / channels);
+        }
 
-    // Horizontal axis along middle
-    paint->setPen(QPen(midColour, 0));
-    paint->drawLine(QPointF(x0, my + 0.5), QPointF(x1, my + 0.5));
+        // Horizontal axis along middle
+        paint->setPen(QPen(midColour, 0));
+        paint->drawLine(QPointF(x0, my + 0.5), QPointF(x1, my + 0.5));
 
-    paintChannelScaleGuides(v, paint, rect, ch);
-  
-    int rangeix = ch - minChannel;
+        paintChannelScaleGuides(v, paint, rect, ch);
+
+        lanes.push_back({ ch, ch - minChannel, m, my });
+    }
+
+    if (lanes.empty()) return;
 
 #ifdef DEBUG_WAVEFORM_PAINT
-    SVCERR << "paint channel " << ch << ": frame0 = " << frame0 << ", frame1 = " << frame1 << ", blockSize = " << blockSize << ", have " << ranges.size() << " range blocks of which ours is index " << rangeix << " with " << ranges[rangeix].size() << " ranges in it" << endl;
+    SVCERR << "paint channels " << minChannel << " to " << maxChannel << ": frame0 = " << frame0 << ", frame1 = " << frame1 << ", blockSize = " << blockSize << ", have " << ranges.size() << " range blocks" << endl;
 #else
     (void)frame1; // not actually used
 #endif
 
-    QPainterPath waveformPath;
-    QPainterPath meanPath;
-    QPainterPath clipPath;
-    vector<QPointF> individualSamplePoints;
+    // Everything that needs the view is worked out here, so that the
+    // envelopes for the individual channels can then be calculated
+    // in parallel
+    
+    vector<ColumnSource> sources;
+    getColumnSources(v, rect, blockSize, frame0, sources);
 
-    bool firstPoint = true;
-    double prevRangeBottom = 0, prevRangeTop = 0;
+    vector<Envelope> envelopes(lanes.size());
+
+    auto calculate = [&](int i) {
+        const ChannelLane &lane = lanes[i];
+        calculateEnvelope(lane, ranges, sources,
+                          mergingChannels, mixingChannels, envelopes[i]);
+    };
+
+    // An envelope is cheap to calculate, so the lanes are only
+    // shared out across the render thread pool when there are
+    // several of them and enough columns in all to be worth it
+    
+    const int parallelThreshold = 8192; // lanes times columns
+    
+    int laneCount = int(lanes.size());
+    int threadCount = 1;
+    if (laneCount > 1 &&
+        laneCount * int(sources.size()) >= parallelThreshold) {
+        threadCount = std::min(RenderThreadPool::getThreadCount(),
+                               laneCount);
+    }
+    
+    std::atomic<int> next(0);
+    RenderThreadPool::run(threadCount, [&](int) {
+            int i;
+            while ((i = next++) < laneCount) {
+                calculate(i);
+            }
+        });
+
+    QColor waveformColour = (model->isReady() ? baseColour : midColour);
+    
+    if (v->getZoomLevel().zone == ZoomLevel::FramesPerPixel) {
+
+        // At most one summary range per pixel column, so there is
+        // nothing here that needs more than vertical spans of solid
+        // pixels. Fill those directly into an image and draw it once,
+        // rather than building and stroking paths for every channel
+        
+        QImage image(x1 - x0 + 1, h, QImage::Format_ARGB32_Premultiplied);
+        image.fill(0);
+
+        for (const auto &envelope : envelopes) {
+            rasteriseEnvelope(image, x0, envelope,
+                              waveformColour, midColour, clipColour);
+        }
+
+        paint->drawImage(x0, 0, image);
+        
+    } else {
+        for (const auto &envelope : envelopes) {
+            paintEnvelope(v, paint, envelope, baseColour,
+                          waveformColour, midColour, clipColour);
+        }
+    }
+}
+
+void
+WaveformLayer::getColumnSources(LayerGeometryProvider *v,
+                                QRect rect,
+                                int blockSize,
+                                sv_frame_t frame0,
+                                vector<ColumnSource> &sources) const
+{
+    int x0 = rect.left();
+    int x1 = rect.right();
+
+    sources.clear();
+    sources.reserve(x1 - x0 + 1);
     
     for (int x = x0; x <= x1; ++x) {
 
@@ -965,6 +1353,34 @@ WaveformLayer::paintChannel(LayerGeometryProvider *v,
             SVCERR << "WaveformLayer::paint: ERROR: i1 " << i1 << " > i0 " << i0 << " plus one (zoom = " << v->getZoomLevel() << ", model zoom = " << blockSize << ")" << endl;
         }
 
+        sources.push_back({ x, i0, i1, showIndividualSample });
+    }
+}
+
+void
+WaveformLayer::calculateEnvelope(const ChannelLane &lane,
+                                 const RangeVec &ranges,
+                                 const vector<ColumnSource> &sources,
+                                 bool mergingChannels,
+                                 bool mixingChannels,
+                                 Envelope &envelope) const
+{
+    // Called from more than one thread at once; must not touch the
+    // view or the model, or change anything
+
+    int m = lane.m;
+    int my = lane.my;
+    int rangeix = lane.rangeix;
+    double gain = m_effectiveGains[lane.channel];
+
+    envelope.clear();
+    envelope.reserve(sources.size());
+    
+    for (const auto &source : sources) {
+
+        sv_frame_t i0 = source.i0;
+        sv_frame_t i1 = source.i1;
+        
         const auto &r = ranges[rangeix];
         RangeSummarisableTimeValueModel::Range range;
             
@@ -1096,53 +1512,80 @@ WaveformLayer::paintChannel(LayerGeometryProvider *v,
         SVCERR << "range " << rangeBottom << " -> " << rangeTop << ", means " << meanBottom << " -> " << meanTop << ", raw range " << range.min() << " -> " << range.max() << endl;
 #endif
 
-        double rangeMiddle = (rangeTop + rangeBottom) / 2.0;
-        bool trivialRange = (fabs(rangeTop - rangeBottom) < 1.0);
-        double px = x + 0.5;
+        envelope.push_back({ source.x,
+                             rangeTop, rangeBottom,
+                             meanTop, meanBottom,
+                             drawMean, clipped,
+                             source.showIndividualSample });
+    }
+}
+
+void
+WaveformLayer::paintEnvelope(LayerGeometryProvider *v,
+                             QPainter *paint,
+                             const Envelope &envelope,
+                             QColor sampleColour,
+                             QColor waveformColour,
+                             QColor meanColour,
+                             QColor clipColour) const
+{
+    QPainterPath waveformPath;
+    QPainterPath meanPath;
+    QPainterPath clipPath;
+    vector<QPointF> individualSamplePoints;
+
+    bool firstPoint = true;
+    double prevRangeBottom = 0, prevRangeTop = 0;
+    
+    for (const auto &e : envelope) {
+
+        double rangeMiddle = (e.rangeTop + e.rangeBottom) / 2.0;
+        bool trivialRange = (fabs(e.rangeTop - e.rangeBottom) < 1.0);
+        double px = e.x + 0.5;
         
-        if (showIndividualSample) {
-            individualSamplePoints.push_back(QPointF(px, rangeTop));
+        if (e.showIndividualSample) {
+            individualSamplePoints.push_back(QPointF(px, e.rangeTop));
             if (!trivialRange) {
                 // common e.g. in "butterfly" merging mode
-                individualSamplePoints.push_back(QPointF(px, rangeBottom));
+                individualSamplePoints.push_back(QPointF(px, e.rangeBottom));
             }
         }
 
         bool contiguous = true;
-        if (rangeTop > prevRangeBottom + 0.5 ||
-            rangeBottom < prevRangeTop - 0.5) {
+        if (e.rangeTop > prevRangeBottom + 0.5 ||
+            e.rangeBottom < prevRangeTop - 0.5) {
             contiguous = false;
         }
         
         if (firstPoint || (contiguous && !trivialRange)) {
-            waveformPath.moveTo(QPointF(px, rangeTop));
-            waveformPath.lineTo(QPointF(px, rangeBottom));
+            waveformPath.moveTo(QPointF(px, e.rangeTop));
+            waveformPath.lineTo(QPointF(px, e.rangeBottom));
             waveformPath.moveTo(QPointF(px, rangeMiddle));
         } else {
             waveformPath.lineTo(QPointF(px, rangeMiddle));
             if (!trivialRange) {
-                waveformPath.lineTo(QPointF(px, rangeTop));
-                waveformPath.lineTo(QPointF(px, rangeBottom));
+                waveformPath.lineTo(QPointF(px, e.rangeTop));
+                waveformPath.lineTo(QPointF(px, e.rangeBottom));
                 waveformPath.lineTo(QPointF(px, rangeMiddle));
             }
         }
 
         firstPoint = false;
-        prevRangeTop = rangeTop;
-        prevRangeBottom = rangeBottom;
+        prevRangeTop = e.rangeTop;
+        prevRangeBottom = e.rangeBottom;
         
-        if (drawMean) {
-            meanPath.moveTo(QPointF(px, meanBottom));
-            meanPath.lineTo(QPointF(px, meanTop));
+        if (e.drawMean) {
+            meanPath.moveTo(QPointF(px, e.meanBottom));
+            meanPath.lineTo(QPointF(px, e.meanTop));
         }
 
-        if (clipped) {
+        if (e.clipped) {
             if (trivialRange) {
                 clipPath.moveTo(QPointF(px, rangeMiddle));
                 clipPath.lineTo(QPointF(px+1, rangeMiddle));
             } else {
-                clipPath.moveTo(QPointF(px, rangeBottom));
-                clipPath.lineTo(QPointF(px, rangeTop));
+                clipPath.moveTo(QPointF(px, e.rangeBottom));
+                clipPath.lineTo(QPointF(px, e.rangeTop));
             }
         }
     }
@@ -1152,24 +1595,19 @@ WaveformLayer::paintChannel(LayerGeometryProvider *v,
         penWidth = 0.0;
     }
     
-    if (model->isReady()) {
-        paint->setPen(QPen(baseColour, penWidth));
-    } else {
-        paint->setPen(QPen(midColour, penWidth));
-    }
+    paint->setPen(QPen(waveformColour, penWidth));
     paint->drawPath(waveformPath);
 
     if (!clipPath.isEmpty()) {
         paint->save();
-        paint->setPen(QPen(ColourDatabase::getInstance()->
-                           getContrastingColour(m_colour), penWidth));
+        paint->setPen(QPen(clipColour, penWidth));
         paint->drawPath(clipPath);
         paint->restore();
     }
 
     if (!meanPath.isEmpty()) {
         paint->save();
-        paint->setPen(QPen(midColour, penWidth));
+        paint->setPen(QPen(meanColour, penWidth));
         paint->drawPath(meanPath);
         paint->restore();
     }
@@ -1182,7 +1620,7 @@ WaveformLayer::paintChannel(LayerGeometryProvider *v,
             }
         }
         paint->save();
-        paint->setPen(QPen(baseColour, penWidth));
+        paint->setPen(QPen(sampleColour, penWidth));
         for (QPointF p: individualSamplePoints) {
             paint->drawRect(QRectF(p.x() - sz/2, p.y() - sz/2, sz, sz));
         }
@@ -1190,6 +1628,90 @@ WaveformLayer::paintChannel(LayerGeometryProvider *v,
     }
 }
 
+void
+WaveformLayer::rasteriseEnvelope(QImage &image,
+                                 int x0,
+                                 const Envelope &envelope,
+                                 QColor waveformColour,
+                                 QColor meanColour,
+                                 QColor clipColour) const
+{
+    // The equivalent of paintEnvelope for the case where there is
+    // one envelope column per pixel. Where the path drawn by
+    // paintEnvelope would join a column to the last with a line
+    // between their midpoints, we extend both columns' spans to meet
+    // halfway instead.
+
+    int n = int(envelope.size());
+    if (n == 0) return;
+    
+    vector<double> tops(n), bottoms(n);
+
+    for (int i = 0; i < n; ++i) {
+        tops[i] = std::min(envelope[i].rangeTop, envelope[i].rangeBottom);
+        bottoms[i] = std::max(envelope[i].rangeTop, envelope[i].rangeBottom);
+    }
+
+    for (int i = 1; i < n; ++i) {
+        const auto &e = envelope[i];
+        const auto &p = envelope[i-1];
+        bool trivialRange = (fabs(e.rangeTop - e.rangeBottom) < 1.0);
+        bool contiguous = !(e.rangeTop > p.rangeBottom + 0.5 ||
+                            e.rangeBottom < p.rangeTop - 0.5);
+        if (contiguous && !trivialRange) {
+            continue;
+        }
+        double middle = (e.rangeTop + e.rangeBottom) / 2.0;
+        double prevMiddle = (p.rangeTop + p.rangeBottom) / 2.0;
+        double halfway = (middle + prevMiddle) / 2.0;
+        tops[i] = std::min(tops[i], halfway);
+        bottoms[i] = std::max(bottoms[i], halfway);
+        tops[i-1] = std::min(tops[i-1], halfway);
+        bottoms[i-1] = std::max(bottoms[i-1], halfway);
+    }
+
+    uchar *bits = image.bits();
+    int bytesPerLine = image.bytesPerLine();
+    int w = image.width();
+    int h = image.height();
+
+    auto fill = [&](int x, double top, double bottom, QRgb colour) {
+        if (x < 0 || x >= w) return;
+        int ya = int(floor(top));
+        int yb = int(floor(bottom));
+        if (ya < 0) ya = 0;
+        if (yb >= h) yb = h - 1;
+        for (int y = ya; y <= yb; ++y) {
+            reinterpret_cast<QRgb *>(bits + y * bytesPerLine)[x] = colour;
+        }
+    };
+    
+    QRgb waveform = qPremultiply(waveformColour.rgba());
+    QRgb mean = qPremultiply(meanColour.rgba());
+    QRgb clip = qPremultiply(clipColour.rgba());
+    
+    for (int i = 0; i < n; ++i) {
+
+        const auto &e = envelope[i];
+        int x = e.x - x0;
+
+        fill(x, tops[i], bottoms[i], waveform);
+
+        if (e.clipped) {
+            if (fabs(e.rangeTop - e.rangeBottom) < 1.0) {
+                double middle = (e.rangeTop + e.rangeBottom) / 2.0;
+                fill(x, middle, middle, clip);
+            } else {
+                fill(x, tops[i], bottoms[i], clip);
+            }
+        }
+        
+        if (e.drawMean) {
+            fill(x, e.meanTop, e.meanBottom, mean);
+        }
+    }
+}
+
 void
 WaveformLayer::paintChannelScaleGuides(LayerGeometryProvider *v,
                                        QPainter *paint,
@@ -19,14 +19,18 @@
 #include <QRect>
 
 #include "SingleColourLayer.h"
+#include "ScrollableImageCache.h"
 
 #include "base/ZoomLevel.h"
 
 #include "data/model/RangeSummarisableTimeValueModel.h"
 
+#include <map>
+
 class View;
 class QPainter;
-class QPixmap;
+class QImage;
+class WaveformSummaryPrefetcher;
 
 class WaveformLayer : public SingleColourLayer
 {
@@ -39,6 +43,7 @@ public:
     const ZoomConstraint *getZoomConstraint() const override;
     ModelId getModel() const override { return m_model; }
     void paint(LayerGeometryProvider *v, QPainter &paint, QRect rect) const override;
+    void discardViewState(int viewId) const override;
 
     QString getFeatureDescription(LayerGeometryProvider *v, QPoint &) const override;
 
@@ -147,20 +152,20 @@ public:
     double getMiddleLineHeight() const { return m_middleLineHeight; }
 
     /**
-     * Enable or disable aggressive pixmap cacheing.  If enabled,
-     * waveforms will be rendered to an off-screen pixmap and
-     * refreshed from there instead of being redrawn from the peak
-     * data each time.  This may be faster if the data and zoom level
-     * do not change often, but it may be slower for frequently zoomed
-     * data and it will only work if the waveform is the "bottom"
-     * layer on the displayed widget, as each refresh will erase
-     * anything beneath the waveform.
+     * Enable or disable aggressive image cacheing.  If enabled,
+     * waveforms will be rendered to an off-screen image for each
+     * view and refreshed from there instead of being redrawn from the
+     * peak data each time.  When the view scrolls, only the newly
+     * exposed part is rendered, and images are retained for a few
+     * recent zoom levels.  This only works if the waveform is the
+     * "bottom" layer on the displayed widget, as each refresh will
+     * erase anything beneath the waveform.
      *
-     * This is intended specifically for a panner widget display in
-     * which the waveform never moves, zooms, or changes, but some
-     * graphic such as a panner outline is frequently redrawn over the
-     * waveform.  This situation would necessitate a lot of waveform
-     * refresh if the default cacheing strategy was used.
+     * This is intended for displays such as a panner widget, in
+     * which some graphic such as a panner outline is frequently
+     * redrawn over the waveform, or a view that follows playback
+     * through a long recording.  These would necessitate a lot of
+     * waveform refresh if the default cacheing strategy was used.
      *
      * The default is not to use aggressive cacheing.
      */
@@ -205,10 +210,74 @@ protected:
     int getChannelArrangement(int &min, int &max,
                               bool &merging, bool &mixing) const;
 
-    void paintChannel
-    (LayerGeometryProvider *, QPainter *paint, QRect rect, int channel,
+    void paintWithCache(LayerGeometryProvider *, QPainter &paint,
+                        QRect rect) const;
+    
+    void paintWaveform(LayerGeometryProvider *, QPainter *paint,
+                       QRect rect) const;
+
+    void invalidateCaches();
+    
+    void paintChannels
+    (LayerGeometryProvider *, QPainter *paint, QRect rect,
      const RangeVec &ranges,
      int blockSize, sv_frame_t frame0, sv_frame_t frame1) const;
+
+    // Position of a channel on the view: m is the half-height of
+    // the area available to it, and my the y coordinate of its
+    // axis. rangeix is the index of its summary in the RangeVec
+    struct ChannelLane {
+        int channel;
+        int rangeix;
+        int m;
+        int my;
+    };
+
+    // Indices into the range blocks for a pixel column. The same for
+    // every channel, so calculated just once per paint
+    struct ColumnSource {
+        int x;
+        sv_frame_t i0;
+        sv_frame_t i1;
+        bool showIndividualSample;
+    };
+
+    // Vertical extents, in view coordinates, of the waveform and its
+    // mean in a single pixel column for a single channel. There is no
+    // RMS level, as the model's summaries record only the minimum,
+    // maximum and mean absolute value of each block, and an RMS
+    // would have to be calculated from every sample in the column
+    struct EnvelopeColumn {
+        int x;
+        double rangeTop;
+        double rangeBottom;
+        double meanTop;
+        double meanBottom;
+        bool drawMean;
+        bool clipped;
+        bool showIndividualSample;
+    };
+    typedef std::vector<EnvelopeColumn> Envelope;
+
+    void getColumnSources(LayerGeometryProvider *, QRect rect,
+                          int blockSize, sv_frame_t frame0,
+                          std::vector<ColumnSource> &sources) const;
+
+    void calculateEnvelope(const ChannelLane &lane,
+                           const RangeVec &ranges,
+                           const std::vector<ColumnSource> &sources,
+                           bool mergingChannels, bool mixingChannels,
+                           Envelope &envelope) const;
+
+    void paintEnvelope(LayerGeometryProvider *, QPainter *paint,
+                       const Envelope &envelope, QColor sampleColour,
+                       QColor waveformColour, QColor meanColour,
+                       QColor clipColour) const;
+
+    void rasteriseEnvelope(QImage &image, int x0,
+                           const Envelope &envelope,
+                           QColor waveformColour, QColor meanColour,
+                           QColor clipColour) const;
     
     void paintChannelScaleGuides(LayerGeometryProvider *, QPainter *paint,
                                  QRect rect, int channel) const;
@@ -218,6 +287,16 @@ protected:
                           sv_frame_t f0, sv_frame_t f1,
                           int blockSize, RangeVec &ranges) const;
 
+    void schedulePrefetch(LayerGeometryProvider *,
+                          int minChannel, int maxChannel,
+                          bool mixingOrMerging) const;
+
+    void getCachedSummaryRanges(LayerGeometryProvider *,
+                                int minChannel, int maxChannel,
+                                bool mixingOrMerging,
+                                sv_frame_t frame0, sv_frame_t frame1,
+                                int blockSize, RangeVec &ranges) const;
+
     void getOversampledRanges(int minChannel, int maxChannel,
                               bool mixingOrMerging,
                               sv_frame_t f0, sv_frame_t f1,
@@ -232,7 +311,7 @@ protected:
 
     float getNormalizeGain(LayerGeometryProvider *v, int channel) const;
 
-    void flagBaseColourChanged() override { m_cacheValid = false; }
+    void flagBaseColourChanged() override { invalidateCaches(); }
 
     float        m_gain;
     bool         m_autoNormalize;
@@ -248,9 +327,34 @@ protected:
 
     mutable std::vector<float> m_effectiveGains;
 
-    mutable QPixmap *m_cache;
-    mutable bool m_cacheValid;
-    mutable ZoomLevel m_cacheZoomLevel;
+    // Image cache for a view, used in aggressive mode, together with
+    // the effective gains it was painted with
+    struct ViewCache {
+        ScrollableImageCache image;
+        std::vector<float> gains;
+    };
+    typedef std::map<int, ViewCache> ViewCacheMap; // key is view id
+    mutable ViewCacheMap m_caches;
+
+    // Summary ranges for a view, covering frame0 to frame1 at the
+    // given block size
+    struct SummaryCache {
+        int minChannel;
+        int maxChannel;
+        bool mixingOrMerging;
+        int blockSize;
+        sv_frame_t frame0;
+        sv_frame_t frame1;
+        RangeVec ranges;
+        SummaryCache() : minChannel(0), maxChannel(0),
+                         mixingOrMerging(false), blockSize(0),
+                         frame0(0), frame1(0) { }
+    };
+    typedef std::map<int, SummaryCache> ViewSummaryCacheMap; // key is view id
+    mutable ViewSummaryCacheMap m_summaryCaches;
+
+    mutable WaveformSummaryPrefetcher *m_prefetcher;
+    mutable std::map<int, sv_frame_t> m_prefetchStartFrames; // key is view id
 };
 
 #endif
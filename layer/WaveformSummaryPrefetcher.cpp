@@ -0,0 +1,181 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "WaveformSummaryPrefetcher.h"
+#include "BackgroundRenderThread.h"
+
+#include "base/Debug.h"
+#include "base/HitCount.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <stdexcept>
+
+//#define DEBUG_WAVEFORM_SUMMARY_PREFETCHER 1
+
+using std::vector;
+
+// Number of completed prefetches to hold on to. A view scrolling in
+// one direction needs one ahead of it, plus one at each of the
+// neighbouring zoom levels, with a little slack
+static const int maxBlocks = 6;
+
+WaveformSummaryPrefetcher::WaveformSummaryPrefetcher(ModelId model) :
+    m_model(model),
+    m_thread(new BackgroundRenderThread)
+{
+}
+
+WaveformSummaryPrefetcher::~WaveformSummaryPrefetcher()
+{
+    // Waits for any running job, which may refer to us
+    delete m_thread;
+}
+
+void
+WaveformSummaryPrefetcher::fetch(ModelId modelId, const Request &request,
+                                 RangeVec &ranges)
+{
+    auto model = ModelById::getAs<RangeSummarisableTimeValueModel>(modelId);
+    if (!model) return;
+
+    sv_frame_t frame0 = request.frame0;
+    sv_frame_t frame1 = request.frame1;
+    int blockSize = request.blockSize;
+    
+    for (int ch = request.minChannel; ch <= request.maxChannel; ++ch) {
+        ranges.push_back({});
+        model->getSummaries(ch, frame0, frame1 - frame0,
+                            ranges[ch - request.minChannel], blockSize);
+    }
+    
+    if (request.mixingOrMerging) {
+        if (request.minChannel != 0 || request.maxChannel != 0) {
+            throw std::logic_error("Internal error: min & max channels should be 0 when merging or mixing all channels");
+        } else if (model->getChannelCount() > 1) {
+            ranges.push_back({});
+            model->getSummaries
+                (1, frame0, frame1 - frame0, ranges[1], blockSize);
+        } else {
+            ranges.push_back(ranges[0]);
+        }
+    }
+}
+
+bool
+WaveformSummaryPrefetcher::covers(const Request &have,
+                                  const Request &want) const
+{
+    return (have.minChannel == want.minChannel &&
+            have.maxChannel == want.maxChannel &&
+            have.mixingOrMerging == want.mixingOrMerging &&
+            have.blockSize == want.blockSize &&
+            have.frame0 <= want.frame0 &&
+            have.frame1 >= want.frame1 &&
+            (want.frame0 - have.frame0) % have.blockSize == 0);
+}
+
+void
+WaveformSummaryPrefetcher::prefetch(const vector<Request> &requests)
+{
+    if (requests == m_lastRequests) {
+        // Already posted, and either done or in progress
+        return;
+    }
+    m_lastRequests = requests;
+    
+    m_thread->cancelPending();
+
+    for (const Request &request : requests) {
+
+        if (request.blockSize <= 0 || request.frame1 <= request.frame0) {
+            continue;
+        }
+        
+        {
+            QMutexLocker locker(&m_mutex);
+            bool have = false;
+            for (const auto &b : m_blocks) {
+                if (covers(b.request, request)) {
+                    have = true;
+                    break;
+                }
+            }
+            if (have) continue;
+        }
+
+#ifdef DEBUG_WAVEFORM_SUMMARY_PREFETCHER
+        SVDEBUG << "WaveformSummaryPrefetcher::prefetch: posting "
+                << request.frame0 << " to " << request.frame1
+                << " at block size " << request.blockSize << endl;
+#endif
+        
+        ModelId model = m_model;
+        m_thread->post([this, model, request]() {
+                           Block block;
+                           block.request = request;
+                           fetch(model, request, block.ranges);
+                           store(block);
+                       });
+    }
+}
+
+void
+WaveformSummaryPrefetcher::store(const Block &block)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_blocks.push_back(block);
+
+    while (int(m_blocks.size()) > maxBlocks) {
+        m_blocks.pop_front();
+    }
+}
+
+bool
+WaveformSummaryPrefetcher::retrieve(const Request &request, RangeVec &ranges)
+{
+    static HitCount count("WaveformSummaryPrefetcher: prefetched summaries");
+    
+    QMutexLocker locker(&m_mutex);
+
+    // Search most recent first
+    for (auto itr = m_blocks.rbegin(); itr != m_blocks.rend(); ++itr) {
+
+        if (!covers(itr->request, request)) {
+            continue;
+        }
+
+        sv_frame_t offset =
+            (request.frame0 - itr->request.frame0) / request.blockSize;
+        sv_frame_t n = getRangeCount(request.frame0, request.frame1,
+                                     request.blockSize);
+
+        ranges.clear();
+        for (const auto &r : itr->ranges) {
+            sv_frame_t i0 = std::min(offset, sv_frame_t(r.size()));
+            sv_frame_t i1 = std::min(offset + n, sv_frame_t(r.size()));
+            ranges.push_back(RangeSummarisableTimeValueModel::RangeBlock
+                             (r.begin() + i0, r.begin() + i1));
+        }
+
+        count.hit();
+        return true;
+    }
+
+    count.miss();
+    return false;
+}
@@ -0,0 +1,128 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_WAVEFORM_SUMMARY_PREFETCHER_H
+#define SV_WAVEFORM_SUMMARY_PREFETCHER_H
+
+#include "data/model/RangeSummarisableTimeValueModel.h"
+
+#include <QMutex>
+
+#include <vector>
+#include <deque>
+
+class BackgroundRenderThread;
+
+/**
+ * Fetches range summaries from a RangeSummarisableTimeValueModel on
+ * a background thread, ahead of their being needed for painting, and
+ * holds on to a small number of the results.
+ *
+ * A waveform layer posts requests for the areas it expects to paint
+ * next (the region beyond the current view in the direction it is
+ * moving, or the current region at neighbouring zoom levels) and
+ * then, when painting, asks for the summaries it actually needs. If
+ * a completed prefetch covers them, they are returned from it;
+ * otherwise the caller fetches them synchronously as before.
+ *
+ * The model must be complete (isReady) before anything is posted, as
+ * the prefetched summaries are not refreshed if the model changes.
+ */
+class WaveformSummaryPrefetcher
+{
+public:
+    typedef std::vector<RangeSummarisableTimeValueModel::RangeBlock> RangeVec;
+
+    struct Request {
+        int minChannel;
+        int maxChannel;
+        bool mixingOrMerging;
+        int blockSize;
+        sv_frame_t frame0;
+        sv_frame_t frame1;
+
+        bool operator==(const Request &r) const {
+            return minChannel == r.minChannel &&
+                maxChannel == r.maxChannel &&
+                mixingOrMerging == r.mixingOrMerging &&
+                blockSize == r.blockSize &&
+                frame0 == r.frame0 &&
+                frame1 == r.frame1;
+        }
+    };
+
+    WaveformSummaryPrefetcher(ModelId model);
+    ~WaveformSummaryPrefetcher();
+
+    /**
+     * Fetch the summaries for the given request synchronously, in
+     * the calling thread. The result has one RangeBlock per channel
+     * from minChannel to maxChannel, and when mixing or merging also
+     * one for the second channel of the model (or a copy of the
+     * first, if the model has only one).
+     */
+    static void fetch(ModelId model, const Request &request,
+                      RangeVec &ranges);
+
+    /**
+     * Return the number of ranges per channel that fetch() obtains
+     * from a model for the frames from frame0 to frame1, where frame0
+     * lies on a block boundary. The model reads its summary cache up
+     * to and including the cache block that frame1 falls in, so this
+     * is one more than the number of whole blocks in the range. (The
+     * model may return fewer near its end.) Use this when slicing a
+     * request out of a larger set of summaries, so that the slice
+     * has the same length as fetching it directly would give.
+     */
+    static sv_frame_t getRangeCount(sv_frame_t frame0, sv_frame_t frame1,
+                                    int blockSize) {
+        return (frame1 - frame0) / blockSize + 1;
+    }
+
+    /**
+     * Replace any prefetch requests that have not yet been started
+     * with the given ones. Requests already covered by a completed
+     * prefetch are skipped. Does nothing if the requests are the same
+     * as last time.
+     */
+    void prefetch(const std::vector<Request> &requests);
+
+    /**
+     * If a completed prefetch covers the given request, copy the
+     * relevant part of it into ranges and return true. Otherwise
+     * return false and leave ranges unchanged.
+     */
+    bool retrieve(const Request &request, RangeVec &ranges);
+
+private:
+    struct Block {
+        Request request;
+        RangeVec ranges;
+    };
+    
+    bool covers(const Request &have, const Request &want) const;
+    void store(const Block &block);
+    
+    ModelId m_model;
+    BackgroundRenderThread *m_thread;
+    QMutex m_mutex;
+    std::deque<Block> m_blocks;
+    std::vector<Request> m_lastRequests;
+
+    WaveformSummaryPrefetcher(const WaveformSummaryPrefetcher &) = delete;
+    WaveformSummaryPrefetcher &operator=(const WaveformSummaryPrefetcher &) = delete;
+};
+
+#endif
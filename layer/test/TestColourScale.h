@@ -0,0 +1,227 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_COLOUR_SCALE_H
+#define TEST_COLOUR_SCALE_H
+
+#include "../ColourScale.h"
+
+#include <QObject>
+#include <QtTest>
+
+#include <vector>
+#include <limits>
+#include <random>
+#include <cmath>
+
+class TestColourScale : public QObject
+{
+    Q_OBJECT
+
+    static std::vector<ColourScale::Parameters> parameterSets() {
+
+        std::vector<ColourScale::Parameters> sets;
+
+        std::vector<ColourScaleType> types {
+            ColourScaleType::Linear,
+            ColourScaleType::Meter,
+            ColourScaleType::Log,
+            ColourScaleType::Phase,
+            ColourScaleType::PlusMinusOne,
+            ColourScaleType::Absolute
+        };
+
+        struct Range { double min; double max; double threshold; };
+        std::vector<Range> ranges {
+            { 0.0, 1.0, 0.0 },
+            { 0.0, 0.1, 1e-6 },
+            { -1.0, 1.0, 0.0 },
+            { 1e-8, 250.0, 1e-8 },
+            { 0.25, 0.5, 0.3 }
+        };
+
+        for (auto type : types) {
+            for (auto r : ranges) {
+                for (bool inverted : { false, true }) {
+                    for (double gain : { 1.0, 2.0 / 1024.0, 30.0 }) {
+                        for (double multiple : { 1.0, 2.0 }) {
+                            ColourScale::Parameters p;
+                            p.scaleType = type;
+                            p.minValue = r.min;
+                            p.maxValue = r.max;
+                            p.threshold = r.threshold;
+                            p.inverted = inverted;
+                            p.gain = gain;
+                            p.multiple = multiple;
+                            sets.push_back(p);
+                        }
+                    }
+                }
+            }
+        }
+
+        return sets;
+    }
+
+    static std::vector<float> testValues(const ColourScale::Parameters &p) {
+
+        std::vector<float> values {
+            0.f, -0.f, 1.f, -1.f,
+            std::numeric_limits<float>::min(),
+            std::numeric_limits<float>::denorm_min(),
+            -std::numeric_limits<float>::denorm_min(),
+            std::numeric_limits<float>::max(),
+            -std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::infinity(),
+            -std::numeric_limits<float>::infinity(),
+            std::numeric_limits<float>::quiet_NaN(),
+            float(p.minValue), float(p.maxValue), float(p.threshold)
+        };
+
+        // The values either side of every pixel boundary are where
+        // a lookup is most likely to go wrong, so sweep across the
+        // range and, wherever getPixel changes, bisect down to the
+        // adjacent pair of floats it changes between
+        
+        ColourScale scale(p);
+        double lo = std::min(p.minValue, -1.0) - 1.0;
+        double hi = std::max(p.maxValue, 1.0) + 1.0;
+        int steps = 20000;
+        float prevValue = float(lo);
+        int prevPixel = scale.getPixel(prevValue);
+        for (int i = 1; i <= steps; ++i) {
+            float v = float(lo + (hi - lo) * i / steps);
+            int pixel = scale.getPixel(v);
+            if (pixel != prevPixel) {
+                float a = prevValue, b = v;
+                while (true) {
+                    float m = a + (b - a) / 2.f;
+                    if (m <= a || m >= b) break;
+                    if (scale.getPixel(m) == prevPixel) a = m;
+                    else b = m;
+                }
+                for (float w : { a, b }) {
+                    values.push_back(std::nextafter(w, -HUGE_VALF));
+                    values.push_back(w);
+                    values.push_back(std::nextafter(w, HUGE_VALF));
+                }
+            }
+            prevValue = v;
+            prevPixel = pixel;
+        }
+
+        // And plenty of random values across and beyond the range,
+        // including tiny ones
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> dist(lo, hi);
+        std::uniform_real_distribution<double> exponent(-40.0, 3.0);
+        for (int i = 0; i < 20000; ++i) {
+            values.push_back(float(dist(rng)));
+            values.push_back(float(pow(10.0, exponent(rng))));
+        }
+
+        return values;
+    }
+
+    static void generateColumn(std::vector<float> &values, int n) {
+        std::mt19937 rng(1);
+        std::exponential_distribution<float> dist(40.f);
+        values.resize(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = dist(rng);
+        }
+    }
+
+private slots:
+    void getPixelsMatchesGetPixel()
+    {
+        for (const auto &p : parameterSets()) {
+
+            ColourScale scale(p);
+            std::vector<float> values = testValues(p);
+            int n = int(values.size());
+            
+            std::vector<unsigned char> pixels(n);
+            scale.getPixels(values.data(), n, pixels.data());
+
+            for (int i = 0; i < n; ++i) {
+                int expected = scale.getPixel(values[i]);
+                if (int(pixels[i]) != expected) {
+                    qDebug() << "Scale type" << int(p.scaleType)
+                             << "min" << p.minValue << "max" << p.maxValue
+                             << "threshold" << p.threshold
+                             << "inverted" << p.inverted
+                             << "gain" << p.gain
+                             << "multiple" << p.multiple
+                             << "value" << double(values[i]);
+                }
+                QCOMPARE(int(pixels[i]), expected);
+            }
+        }
+    }
+
+    void benchmarkGetPixel_data()
+    {
+        QTest::addColumn<int>("type");
+        QTest::newRow("linear") << int(ColourScaleType::Linear);
+        QTest::newRow("meter") << int(ColourScaleType::Meter);
+        QTest::newRow("log") << int(ColourScaleType::Log);
+    }
+
+    void benchmarkGetPixel()
+    {
+        QFETCH(int, type);
+        ColourScale::Parameters p;
+        p.scaleType = ColourScaleType(type);
+        p.threshold = 1e-8;
+        ColourScale scale(p);
+
+        // One tall column, as rendered for a 4096-pixel high view
+        std::vector<float> values;
+        generateColumn(values, 4096);
+        std::vector<unsigned char> pixels(values.size());
+
+        QBENCHMARK {
+            int n = int(values.size());
+            for (int i = 0; i < n; ++i) {
+                pixels[i] = (unsigned char)scale.getPixel(values[i]);
+            }
+        }
+    }
+
+    void benchmarkGetPixels_data()
+    {
+        benchmarkGetPixel_data();
+    }
+
+    void benchmarkGetPixels()
+    {
+        QFETCH(int, type);
+        ColourScale::Parameters p;
+        p.scaleType = ColourScaleType(type);
+        p.threshold = 1e-8;
+        ColourScale scale(p);
+
+        std::vector<float> values;
+        generateColumn(values, 4096);
+        std::vector<unsigned char> pixels(values.size());
+
+        QBENCHMARK {
+            scale.getPixels(values.data(), int(values.size()), pixels.data());
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,195 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_DRAW_BUFFER_SCALER_H
+#define TEST_DRAW_BUFFER_SCALER_H
+
+#include "../Colour3DPlotRenderer.h"
+#include "../RenderThreadPool.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QImage>
+
+#include <random>
+#include <cstdlib>
+
+class TestDrawBufferScaler : public QObject
+{
+    Q_OBJECT
+
+    // An indexed image like a draw buffer, with an opaque colour
+    // table and random content
+    static QImage makeDrawBuffer(int w, int h, int seed) {
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<int> byte(0, 255);
+        QImage image(w, h, QImage::Format_Indexed8);
+        QVector<QRgb> table;
+        for (int i = 0; i < 256; ++i) {
+            table.push_back(qRgb(byte(rng), byte(rng), byte(rng)));
+        }
+        image.setColorTable(table);
+        for (int y = 0; y < h; ++y) {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < w; ++x) {
+                line[x] = uchar(byte(rng));
+            }
+        }
+        return image;
+    }
+
+    // The straightforward nearest-neighbour scaling that the
+    // renderer used before, one pixel at a time through the table
+    static QImage scaleReference(QImage image, int tw, int th) {
+        int sw = image.width(), sh = image.height();
+        QImage target(tw, th, QImage::Format_ARGB32_Premultiplied);
+        for (int y = 0; y < th; ++y) {
+            int sy = int((uint64_t(y) * sh) / th);
+            if (sy == sh) --sy;
+            for (int x = 0; x < tw; ++x) {
+                int sx = int((uint64_t(x) * sw) / tw);
+                if (sx == sw) --sx;
+                target.setPixel(x, y, qPremultiply(image.pixel(sx, sy)));
+            }
+        }
+        return target;
+    }
+
+    static int maxChannelDifference(const QImage &a, const QImage &b,
+                                    double &meanDifference) {
+        int maxDiff = 0;
+        double total = 0.0;
+        for (int y = 0; y < a.height(); ++y) {
+            const QRgb *la = reinterpret_cast<const QRgb *>(a.constScanLine(y));
+            const QRgb *lb = reinterpret_cast<const QRgb *>(b.constScanLine(y));
+            for (int x = 0; x < a.width(); ++x) {
+                int d[4] = {
+                    std::abs(qRed(la[x]) - qRed(lb[x])),
+                    std::abs(qGreen(la[x]) - qGreen(lb[x])),
+                    std::abs(qBlue(la[x]) - qBlue(lb[x])),
+                    std::abs(qAlpha(la[x]) - qAlpha(lb[x]))
+                };
+                for (int c = 0; c < 4; ++c) {
+                    maxDiff = std::max(maxDiff, d[c]);
+                    total += d[c];
+                }
+            }
+        }
+        meanDifference = total / (4.0 * a.width() * a.height());
+        return maxDiff;
+    }
+
+    static void sizes() {
+        QTest::addColumn<int>("sw");
+        QTest::addColumn<int>("sh");
+        QTest::addColumn<int>("tw");
+        QTest::addColumn<int>("th");
+        QTest::newRow("same size") << 40 << 30 << 40 << 30;
+        QTest::newRow("integer factor") << 40 << 30 << 160 << 90;
+        QTest::newRow("fractional") << 37 << 23 << 401 << 250;
+        QTest::newRow("one column") << 1 << 50 << 13 << 200;
+        QTest::newRow("wide only") << 100 << 64 << 1000 << 64;
+        QTest::newRow("tall") << 64 << 513 << 300 << 2049;
+    }
+    
+private slots:
+    void nearestMatchesReference_data() { sizes(); }
+    
+    void nearestMatchesReference()
+    {
+        QFETCH(int, sw); QFETCH(int, sh); QFETCH(int, tw); QFETCH(int, th);
+        QImage source = makeDrawBuffer(sw, sh, 1);
+        QImage expected = scaleReference(source, tw, th);
+        QImage actual = Colour3DPlotRenderer::scaleIndexedImage
+            (source, tw, th, false, 1);
+        QCOMPARE(actual.format(), expected.format());
+        QCOMPARE(actual, expected);
+    }
+
+    void smoothMatchesQt_data() { sizes(); }
+    
+    void smoothMatchesQt()
+    {
+        // Qt's smooth scaler uses its own fixed-point arithmetic, so
+        // we can't expect bit-identical output, but every channel of
+        // every pixel should come out within a couple of levels
+        
+        QFETCH(int, sw); QFETCH(int, sh); QFETCH(int, tw); QFETCH(int, th);
+        QImage source = makeDrawBuffer(sw, sh, 2);
+        QImage expected = source.scaled(tw, th, Qt::IgnoreAspectRatio,
+                                        Qt::SmoothTransformation)
+            .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        QImage actual = Colour3DPlotRenderer::scaleIndexedImage
+            (source, tw, th, true, 1);
+        QCOMPARE(actual.size(), expected.size());
+        double mean = 0.0;
+        int maxDiff = maxChannelDifference(actual, expected, mean);
+        qDebug() << "Maximum channel difference from Qt" << maxDiff
+                 << "mean" << mean;
+        QVERIFY(maxDiff <= 2);
+    }
+
+    void threadsMatchSerial_data() { sizes(); }
+    
+    void threadsMatchSerial()
+    {
+        QFETCH(int, sw); QFETCH(int, sh); QFETCH(int, tw); QFETCH(int, th);
+        QImage source = makeDrawBuffer(sw, sh, 3);
+        for (bool interpolate : { false, true }) {
+            QImage serial = Colour3DPlotRenderer::scaleIndexedImage
+                (source, tw, th, interpolate, 1);
+            QImage threaded = Colour3DPlotRenderer::scaleIndexedImage
+                (source, tw, th, interpolate, 4);
+            QCOMPARE(threaded, serial);
+        }
+    }
+
+    void benchmark_data()
+    {
+        QTest::addColumn<bool>("qt");
+        QTest::addColumn<bool>("interpolate");
+        QTest::newRow("QImage::scaled fast") << true << false;
+        QTest::newRow("QImage::scaled smooth") << true << true;
+        QTest::newRow("scaleIndexedImage nearest") << false << false;
+        QTest::newRow("scaleIndexedImage bilinear") << false << true;
+    }
+    
+    void benchmark()
+    {
+        // A bin-resolution draw buffer for a 1000x2000 pixel view
+        
+        QFETCH(bool, qt);
+        QFETCH(bool, interpolate);
+
+        QImage source = makeDrawBuffer(250, 512, 4);
+        QImage result;
+        
+        QBENCHMARK {
+            if (qt) {
+                result = source.scaled
+                    (1000, 2000, Qt::IgnoreAspectRatio,
+                     interpolate ?
+                     Qt::SmoothTransformation : Qt::FastTransformation)
+                    .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+            } else {
+                result = Colour3DPlotRenderer::scaleIndexedImage
+                    (source, 1000, 2000, interpolate,
+                     RenderThreadPool::getThreadCount());
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,186 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_IN_PLACE_COLUMN_OP_H
+#define TEST_IN_PLACE_COLUMN_OP_H
+
+#include "../InPlaceColumnOp.h"
+
+#include <QObject>
+#include <QtTest>
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+
+class TestInPlaceColumnOp : public QObject
+{
+    Q_OBJECT
+
+    typedef ColumnOp::Column Column;
+
+    static std::vector<Column> columns() {
+        std::vector<Column> cc;
+        std::mt19937 rng(7);
+        std::exponential_distribution<float> mag(10.f);
+        std::uniform_real_distribution<float> signedValue(-3.f, 3.f);
+        for (int n : { 1, 2, 3, 17, 512, 1025 }) {
+            Column a(n), b(n), c(n, 0.f);
+            for (int i = 0; i < n; ++i) {
+                a[i] = mag(rng);
+                b[i] = signedValue(rng);
+            }
+            cc.push_back(a);
+            cc.push_back(b);
+            cc.push_back(c);
+        }
+        // A column with a plateau and equal neighbours, for the peak
+        // picker's edge cases
+        cc.push_back({ 1.f, 1.f, 2.f, 2.f, 1.f, 3.f, 3.f, 0.f, 0.f, 4.f });
+        return cc;
+    }
+
+    // As the renderer sets up binfory for linear and log frequency
+    // scales: the (fractional) bin at the top of each pixel row
+    static std::vector<double> binforyLinear(int h, int minbin, int nbins) {
+        std::vector<double> binfory(h);
+        for (int y = 0; y < h; ++y) {
+            binfory[y] = minbin + double(y) * nbins / h;
+        }
+        return binfory;
+    }
+
+    static std::vector<double> binforyLog(int h, int minbin, int nbins) {
+        std::vector<double> binfory(h);
+        double lmin = log10(std::max(minbin, 1));
+        double lmax = log10(minbin + nbins);
+        for (int y = 0; y < h; ++y) {
+            binfory[y] = pow(10.0, lmin + (lmax - lmin) * y / h);
+        }
+        return binfory;
+    }
+
+    static bool identical(const Column &a, const Column &b) {
+        return a.size() == b.size() &&
+            (a.empty() ||
+             memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0);
+    }
+    
+private slots:
+    void applyGain()
+    {
+        for (const auto &c : columns()) {
+            for (double gain : { 1.0, 0.5, 2.0 / 4096.0, 3.7 }) {
+                Column expected = ColumnOp::applyGain(c, gain);
+                Column actual = c;
+                InPlaceColumnOp::applyGain(actual, gain);
+                QVERIFY(identical(actual, expected));
+            }
+        }
+    }
+
+    void normalize()
+    {
+        for (const auto &c : columns()) {
+            for (auto n : { ColumnNormalization::None,
+                            ColumnNormalization::Sum1,
+                            ColumnNormalization::Max1,
+                            ColumnNormalization::Range01,
+                            ColumnNormalization::Hybrid }) {
+                Column expected = ColumnOp::normalize(c, n);
+                Column actual = c;
+                InPlaceColumnOp::normalize(actual, n);
+                QVERIFY(identical(actual, expected));
+            }
+        }
+    }
+
+    void peakPick()
+    {
+        Column actual(5, 9.f); // storage is reused, must be overwritten
+        for (const auto &c : columns()) {
+            Column expected = ColumnOp::peakPick(c);
+            InPlaceColumnOp::peakPick(c, actual);
+            QVERIFY(identical(actual, expected));
+        }
+    }
+
+    void distribute()
+    {
+        Column actual(5, 9.f);
+        for (const auto &c : columns()) {
+            int nbins = int(c.size());
+            for (int minbin : { 0, 3 }) {
+                for (int h : { 2, 7, 300, 2000 }) {
+                    for (bool log : { false, true }) {
+                        auto binfory = (log ?
+                                        binforyLog(h, minbin, nbins) :
+                                        binforyLinear(h, minbin, nbins));
+                        for (bool interpolate : { false, true }) {
+                            Column expected = ColumnOp::distribute
+                                (c, h, binfory, minbin, interpolate);
+                            InPlaceColumnOp::distribute
+                                (c, actual, h, binfory, minbin, interpolate);
+                            QVERIFY(identical(actual, expected));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void benchmarkPrepare_data()
+    {
+        QTest::addColumn<bool>("inPlace");
+        QTest::newRow("ColumnOp") << false;
+        QTest::newRow("InPlaceColumnOp") << true;
+    }
+    
+    void benchmarkPrepare()
+    {
+        // The draw-buffer sequence for one column of a 2048-bin
+        // spectrogram in a 1000-pixel high view, with peak bins
+        
+        QFETCH(bool, inPlace);
+
+        Column source(2048);
+        std::mt19937 rng(3);
+        std::exponential_distribution<float> mag(10.f);
+        for (auto &v : source) v = mag(rng);
+        auto binfory = binforyLog(1000, 0, 2048);
+
+        Column column, work, prepared;
+        
+        QBENCHMARK {
+            if (inPlace) {
+                column.assign(source.begin(), source.end());
+                InPlaceColumnOp::applyGain(column, 2.0 / 4096.0);
+                InPlaceColumnOp::normalize(column, ColumnNormalization::Max1);
+                InPlaceColumnOp::peakPick(column, work);
+                InPlaceColumnOp::distribute(work, prepared, 1000, binfory,
+                                            0, true);
+            } else {
+                column = ColumnOp::applyGain(source, 2.0 / 4096.0);
+                column = ColumnOp::normalize(column, ColumnNormalization::Max1);
+                column = ColumnOp::peakPick(column);
+                prepared = ColumnOp::distribute(column, 1000, binfory,
+                                                0, true);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,64 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "TestColourScale.h"
+#include "TestDrawBufferScaler.h"
+#include "TestInPlaceColumnOp.h"
+
+#include <QtTest>
+#include <QApplication>
+
+#include <iostream>
+
+// Each of these compares an optimised path in the layer library with
+// the straightforward one it replaces, for identical output, and
+// benchmarks the two. Run with -iterations or -callgrind etc to
+// control the benchmarks, as for any QtTest test
+
+int main(int argc, char *argv[])
+{
+    int good = 0, bad = 0;
+
+    QApplication app(argc, argv);
+    app.setOrganizationName("sonic-visualiser");
+    app.setApplicationName("test-svgui-layer");
+
+    {
+        TestColourScale t;
+        if (QTest::qExec(&t, argc, argv) == 0) ++good;
+        else ++bad;
+    }
+
+    {
+        TestInPlaceColumnOp t;
+        if (QTest::qExec(&t, argc, argv) == 0) ++good;
+        else ++bad;
+    }
+
+    {
+        TestDrawBufferScaler t;
+        if (QTest::qExec(&t, argc, argv) == 0) ++good;
+        else ++bad;
+    }
+
+    if (bad > 0) {
+        std::cerr << "\n********* " << bad << " test suite(s) failed!\n"
+                  << std::endl;
+        return 1;
+    } else {
+        std::cerr << "All tests passed" << std::endl;
+        return 0;
+    }
+}
@@ -0,0 +1,28 @@
+
+TEMPLATE = app
+
+INCLUDEPATH += ../../../vamp-plugin-sdk
+
+exists(../../config.pri) {
+    include(../../config.pri)
+}
+
+CONFIG += qt thread warn_on stl rtti exceptions console c++11
+QT += network xml gui widgets svg testlib
+
+TARGET = svgui-layer-test
+
+DEPENDPATH += ../.. ../../../svcore
+INCLUDEPATH += ../.. ../../../svcore
+OBJECTS_DIR = o
+MOC_DIR = o
+
+LIBS = -L../.. -L../../../svcore -lsvgui -lsvcore $$LIBS
+
+HEADERS += \
+        TestColourScale.h \
+        TestDrawBufferScaler.h \
+        TestInPlaceColumnOp.h
+
+SOURCES += \
+        svgui-layer-test.cpp
@@ -1173,44 +1173,23 @@ Pane::render(QPainter &paint, int xorigin, sv_frame_t f0, sv_frame_t f1)
     }
 
     if (m_scaleWidth > 0) {
-
-        Layer *layer = getTopLayer();
-
-        if (layer) {
-            
-            paint.save();
-            
-            paint.setPen(getForeground());
-            paint.setBrush(getBackground());
-            paint.drawRect(xorigin, -1, m_scaleWidth, height()+1);
-            
-            paint.setBrush(Qt::NoBrush);
-            layer->paintVerticalScale
-                (this, m_manager->shouldShowVerticalColourScale(),
-                 paint, QRect(xorigin, 0, m_scaleWidth, height()));
-            
-            paint.restore();
-        }
+        paint.save();
+        paint.translate(xorigin, 0);
+        renderMargin(paint);
+        paint.restore();
     }
 
     return true;
 }
 
-QImage *
-Pane::renderPartToNewImage(sv_frame_t f0, sv_frame_t f1)
+int
+Pane::prepareRenderMargin()
 {
-    int x0 = int(round(getZoomLevel().framesToPixels(double(f0))));
-    int x1 = int(round(getZoomLevel().framesToPixels(double(f1))));
-
-    QImage *image = new QImage(x1 - x0 + m_scaleWidth,
-                               height(), QImage::Format_RGB32);
-
-    int formerScaleWidth = m_scaleWidth;
-            
     if (m_manager && m_manager->shouldShowVerticalScale()) {
         Layer *layer = getTopLayer();
         if (layer) {
-            QPainter paint(image);
+            QImage image(100, 100, QImage::Format_RGB32);
+            QPainter paint(&image);
             m_scaleWidth = layer->getVerticalScaleWidth
                 (this, m_manager->shouldShowVerticalColourScale(), paint);
         }
@@ -1218,21 +1197,29 @@ Pane::renderPartToNewImage(sv_frame_t f0, sv_frame_t f1)
         m_scaleWidth = 0;
     }
 
-    if (m_scaleWidth != formerScaleWidth) {
-        delete image;
-        image = new QImage(x1 - x0 + m_scaleWidth,
-                           height(), QImage::Format_RGB32);
-    }        
+    return m_scaleWidth;
+}
 
-    QPainter *paint = new QPainter(image);
-    if (!render(*paint, 0, f0, f1)) {
-        delete paint;
-        delete image;
-        return nullptr;
-    } else {
-        delete paint;
-        return image;
-    }
+void
+Pane::renderMargin(QPainter &paint)
+{
+    if (m_scaleWidth <= 0) return;
+    
+    Layer *layer = getTopLayer();
+    if (!layer) return;
+            
+    paint.save();
+            
+    paint.setPen(getForeground());
+    paint.setBrush(getBackground());
+    paint.drawRect(0, -1, m_scaleWidth, height()+1);
+            
+    paint.setBrush(Qt::NoBrush);
+    layer->paintVerticalScale
+        (this, m_manager->shouldShowVerticalColourScale(),
+         paint, QRect(0, 0, m_scaleWidth, height()));
+            
+    paint.restore();
 }
 
 QSize
@@ -59,8 +59,6 @@ public:
         return View::renderToNewImage();
     }
     
-    virtual QImage *renderPartToNewImage(sv_frame_t f0, sv_frame_t f1) override;
-
     virtual QSize getRenderedImageSize() override {
         return View::getRenderedImageSize();
     }
@@ -142,6 +140,8 @@ protected:
     void drawAlignmentStatus(QRect, QPainter &, ModelId, bool down);
 
     virtual bool render(QPainter &paint, int x0, sv_frame_t f0, sv_frame_t f1) override;
+    virtual int prepareRenderMargin() override;
+    virtual void renderMargin(QPainter &paint) override;
 
     Selection getSelectionAt(int x, bool &closeToLeft, bool &closeToRight) const;
 
@@ -0,0 +1,183 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "StreamedImageWriter.h"
+
+#include "base/Debug.h"
+
+#include <QtEndian>
+
+#include <vector>
+
+//#define DEBUG_STREAMED_IMAGE_WRITER 1
+
+// BITMAPFILEHEADER followed by BITMAPINFOHEADER
+static const int fileHeaderSize = 14;
+static const int infoHeaderSize = 40;
+static const int headerSize = fileHeaderSize + infoHeaderSize;
+
+static void
+put16(uchar *p, quint16 v)
+{
+    qToLittleEndian<quint16>(v, p);
+}
+
+static void
+put32(uchar *p, quint32 v)
+{
+    qToLittleEndian<quint32>(v, p);
+}
+
+StreamedImageWriter::StreamedImageWriter(QString filename,
+                                         int width, int height) :
+    m_file(filename),
+    m_width(width),
+    m_height(height),
+    m_rowBytes(qint64(width) * 4)
+{
+    qint64 imageBytes = m_rowBytes * height;
+    qint64 fileBytes = headerSize + imageBytes;
+
+    if (width <= 0 || height <= 0) {
+        m_error = QString("Image has no size (%1x%2)").arg(width).arg(height);
+        return;
+    }
+    
+    if (fileBytes > qint64(0xffffffffLL)) {
+        m_error = QString("Image (%1x%2) is too large for a BMP file")
+            .arg(width).arg(height);
+        return;
+    }
+
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        m_error = QString("Failed to open \"%1\" for writing: %2")
+            .arg(filename).arg(m_file.errorString());
+        return;
+    }
+
+    uchar header[headerSize] = { 0 };
+
+    header[0] = 'B';
+    header[1] = 'M';
+    put32(header + 2, quint32(fileBytes));
+    put32(header + 10, headerSize);
+
+    uchar *info = header + fileHeaderSize;
+    put32(info, infoHeaderSize);
+    put32(info + 4, quint32(width));
+    put32(info + 8, quint32(-height)); // negative height: top-down rows
+    put16(info + 12, 1); // planes
+    put16(info + 14, 32); // bits per pixel
+    put32(info + 16, 0); // BI_RGB, no compression
+    put32(info + 20, quint32(imageBytes));
+    put32(info + 24, 2835); // 72 dpi, in pixels per metre
+    put32(info + 28, 2835);
+
+    // Set the full size up front, so that strips can be written into
+    // place in any order. Any columns not written remain zero, i.e.
+    // black
+    if (m_file.write(reinterpret_cast<const char *>(header), headerSize)
+        != headerSize ||
+        !m_file.resize(fileBytes)) {
+        m_error = QString("Failed to write to \"%1\": %2")
+            .arg(filename).arg(m_file.errorString());
+        m_file.close();
+        return;
+    }
+
+#ifdef DEBUG_STREAMED_IMAGE_WRITER
+    SVDEBUG << "StreamedImageWriter: Created \"" << filename << "\" at "
+            << width << "x" << height << " (" << fileBytes << " bytes)"
+            << endl;
+#endif
+}
+
+StreamedImageWriter::~StreamedImageWriter()
+{
+    close();
+}
+
+bool
+StreamedImageWriter::writeStrip(int x, const QImage &strip)
+{
+    if (!isOK()) return false;
+
+    if (strip.height() != m_height || x < 0) {
+        SVCERR << "WARNING: StreamedImageWriter::writeStrip: Strip of height "
+               << strip.height() << " at x = " << x
+               << " does not fit image of height " << m_height << endl;
+        return false;
+    }
+
+    int w = strip.width();
+    if (x + w > m_width) {
+        w = m_width - x;
+    }
+    if (w <= 0) {
+        return true;
+    }
+
+    QImage converted;
+    const QImage *source = &strip;
+    if (strip.format() != QImage::Format_RGB32) {
+        converted = strip.convertToFormat(QImage::Format_RGB32);
+        source = &converted;
+    }
+
+    // A RGB32 pixel is a native-endian 0xffRRGGBB, which on a
+    // little-endian system is already in the B, G, R, X byte order
+    // used by a 32-bit BMP
+    
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    std::vector<quint32> row(w);
+#endif
+
+    for (int y = 0; y < m_height; ++y) {
+
+        const char *data = reinterpret_cast<const char *>
+            (source->constScanLine(y));
+        
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+        const quint32 *pixels = reinterpret_cast<const quint32 *>(data);
+        for (int i = 0; i < w; ++i) {
+            row[i] = qToLittleEndian<quint32>(pixels[i]);
+        }
+        data = reinterpret_cast<const char *>(row.data());
+#endif
+
+        if (!m_file.seek(headerSize + y * m_rowBytes + qint64(x) * 4) ||
+            m_file.write(data, qint64(w) * 4) != qint64(w) * 4) {
+            m_error = QString("Failed to write to \"%1\": %2")
+                .arg(m_file.fileName()).arg(m_file.errorString());
+            m_file.close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+StreamedImageWriter::close()
+{
+    if (m_file.isOpen()) {
+        m_file.close();
+        if (m_file.error() != QFile::NoError) {
+            m_error = QString("Failed to write to \"%1\": %2")
+                .arg(m_file.fileName()).arg(m_file.errorString());
+        }
+    }
+    return isOK();
+}
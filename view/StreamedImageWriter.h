@@ -0,0 +1,72 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_STREAMED_IMAGE_WRITER_H
+#define SV_STREAMED_IMAGE_WRITER_H
+
+#include <QString>
+#include <QImage>
+#include <QFile>
+
+/**
+ * Write an image file a vertical strip at a time, so that an image
+ * far wider than could be held in memory can be exported from a
+ * view. Only the strip currently being written needs to exist as a
+ * QImage.
+ *
+ * The file is an uncompressed 32-bit BMP. Its size is fixed by the
+ * image dimensions, so each strip is written straight into its
+ * columns of every row in the file, in any order. Columns that are
+ * never written are left black. BMP files are limited to 4GB, so
+ * the very largest images cannot be written at all; isOK() reports
+ * whether the file was successfully created.
+ */
+class StreamedImageWriter
+{
+public:
+    StreamedImageWriter(QString filename, int width, int height);
+    ~StreamedImageWriter();
+
+    bool isOK() const { return m_error == ""; }
+    QString getError() const { return m_error; }
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+
+    /**
+     * Write the given image as the strip whose left edge is at x in
+     * the output. The strip must have the same height as the output;
+     * any part of it extending beyond the right edge is ignored.
+     * Return false if writing failed.
+     */
+    bool writeStrip(int x, const QImage &strip);
+
+    /**
+     * Close the file. Return false if any write has failed.
+     */
+    bool close();
+
+private:
+    QFile m_file;
+    int m_width;
+    int m_height;
+    qint64 m_rowBytes;
+    QString m_error;
+
+    StreamedImageWriter(const StreamedImageWriter &) = delete;
+    StreamedImageWriter &operator=(const StreamedImageWriter &) = delete;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "StreamedSvgWriter.h"
+
+#include "base/Debug.h"
+
+#include <QSvgGenerator>
+#include <QPainter>
+#include <QBuffer>
+#include <QRegularExpression>
+
+//#define DEBUG_STREAMED_SVG_WRITER 1
+
+StreamedSvgWriter::StreamedSvgWriter(QString filename,
+                                     int width, int height,
+                                     QString title) :
+    m_file(filename),
+    m_width(width),
+    m_height(height),
+    m_stripCount(0)
+{
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        m_error = QString("Failed to open \"%1\" for writing: %2")
+            .arg(filename).arg(m_file.errorString());
+        return;
+    }
+
+    // Nested svg elements are not available in SVG Tiny, which is
+    // what QSvgGenerator declares, so this is plain SVG 1.1
+    QString header = QString
+        ("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+         "<svg width=\"%1\" height=\"%2\" viewBox=\"0 0 %1 %2\"\n"
+         " xmlns=\"http://www.w3.org/2000/svg\""
+         " xmlns:xlink=\"http://www.w3.org/1999/xlink\" version=\"1.1\">\n"
+         "<title>%3</title>\n")
+        .arg(width).arg(height).arg(title.toHtmlEscaped());
+
+    write(header.toUtf8());
+}
+
+StreamedSvgWriter::~StreamedSvgWriter()
+{
+    close();
+}
+
+bool
+StreamedSvgWriter::write(const QByteArray &data)
+{
+    if (!isOK()) return false;
+    
+    if (m_file.write(data) != data.size()) {
+        m_error = QString("Failed to write to \"%1\": %2")
+            .arg(m_file.fileName()).arg(m_file.errorString());
+        m_file.close();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+StreamedSvgWriter::writeStrip(int x, int width, StripPainter painter)
+{
+    if (!isOK()) return false;
+
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+    
+    QSvgGenerator generator;
+    generator.setOutputDevice(&buffer);
+    generator.setSize(QSize(width, m_height));
+    generator.setViewBox(QRect(0, 0, width, m_height));
+
+    QPainter paint;
+    paint.begin(&generator);
+    bool ok = painter(paint);
+    paint.end();
+
+    if (!ok) {
+        return false;
+    }
+
+    // Take the content of the generated document's outer svg
+    // element, without its title or description
+    
+    QString svg = QString::fromUtf8(buffer.data());
+
+    int start = svg.indexOf("<svg");
+    if (start >= 0) start = svg.indexOf('>', start);
+    int end = svg.lastIndexOf("</svg>");
+    if (start < 0 || end < start) {
+        SVCERR << "WARNING: StreamedSvgWriter::writeStrip: Failed to find "
+               << "document element in generated SVG for strip at "
+               << x << endl;
+        return false;
+    }
+
+    QString body = svg.mid(start + 1, end - start - 1);
+
+    QRegularExpression::PatternOptions options =
+        QRegularExpression::DotMatchesEverythingOption;
+    body.remove(QRegularExpression("<title>.*</title>", options));
+    body.remove(QRegularExpression("<desc>.*</desc>", options));
+
+    QString prefix = QString("strip%1_").arg(m_stripCount);
+    body.replace(QRegularExpression("\\bid=\"([^\"]*)\""),
+                 QString("id=\"%1\\1\"").arg(prefix));
+    body.replace(QRegularExpression("url\\(#([^)]*)\\)"),
+                 QString("url(#%1\\1)").arg(prefix));
+    body.replace(QRegularExpression("xlink:href=\"#([^\"]*)\""),
+                 QString("xlink:href=\"#%1\\1\"").arg(prefix));
+
+    QString element = QString
+        ("<svg x=\"%1\" y=\"0\" width=\"%2\" height=\"%3\""
+         " viewBox=\"0 0 %2 %3\" overflow=\"hidden\">%4</svg>\n")
+        .arg(x).arg(width).arg(m_height).arg(body);
+
+#ifdef DEBUG_STREAMED_SVG_WRITER
+    SVDEBUG << "StreamedSvgWriter: Writing strip " << m_stripCount
+            << " at x = " << x << ", width " << width << " ("
+            << element.size() << " chars)" << endl;
+#endif
+    
+    ++m_stripCount;
+
+    return write(element.toUtf8());
+}
+
+bool
+StreamedSvgWriter::close()
+{
+    if (m_file.isOpen()) {
+        write("</svg>\n");
+        m_file.close();
+    }
+    return isOK();
+}
@@ -0,0 +1,74 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SV_STREAMED_SVG_WRITER_H
+#define SV_STREAMED_SVG_WRITER_H
+
+#include <QString>
+#include <QFile>
+
+#include <functional>
+
+class QPainter;
+
+/**
+ * Write an SVG file a vertical strip at a time. QSvgGenerator holds
+ * the whole document in memory until it is finished, which for a
+ * long, detailed export can be far more than the final file size;
+ * here each strip is generated separately and appended to the file
+ * as soon as it is complete, as a nested svg element clipped to the
+ * strip's extent. Element ids are made unique per strip so that
+ * gradients and patterns from different strips do not collide.
+ */
+class StreamedSvgWriter
+{
+public:
+    StreamedSvgWriter(QString filename, int width, int height, QString title);
+    ~StreamedSvgWriter();
+
+    bool isOK() const { return m_error == ""; }
+    QString getError() const { return m_error; }
+
+    typedef std::function<bool(QPainter &)> StripPainter;
+
+    /**
+     * Generate the strip of the given width with its left edge at x,
+     * by calling the given function with a painter whose origin is
+     * at the left edge of the strip, and append it to the file. If
+     * the function returns false, nothing is written and false is
+     * returned; false is also returned if writing fails.
+     */
+    bool writeStrip(int x, int width, StripPainter painter);
+
+    /**
+     * Finish the document and close the file. Return false if any
+     * write has failed.
+     */
+    bool close();
+
+private:
+    QFile m_file;
+    int m_width;
+    int m_height;
+    int m_stripCount;
+    QString m_error;
+
+    bool write(const QByteArray &);
+    
+    StreamedSvgWriter(const StreamedSvgWriter &) = delete;
+    StreamedSvgWriter &operator=(const StreamedSvgWriter &) = delete;
+};
+
+#endif
@@ -22,6 +22,9 @@
 #include "base/Preferences.h"
 #include "base/HitCount.h"
 #include "ViewProxy.h"
+#include "ViewStripProxy.h"
+#include "StreamedImageWriter.h"
+#include "StreamedSvgWriter.h"
 
 #include "layer/TimeRulerLayer.h"
 #include "layer/SingleColourLayer.h"
@@ -42,17 +45,24 @@
 #include <QMessageBox>
 #include <QPushButton>
 #include <QSettings>
-#include <QSvgGenerator>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
 
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include <thread>
+#include <map>
 
 //#define DEBUG_VIEW 1
 //#define DEBUG_VIEW_WIDGET_PAINT 1
 //#define DEBUG_PROGRESS_STUFF 1
 //#define DEBUG_VIEW_SCALE_CHOICE 1
 
+qint64
+View::m_layerCacheMemoryLimit = -1; // not yet read from preferences
+
 View::View(QWidget *w, bool showProgress) :
     QFrame(w),
     m_id(getNextId()),
@@ -64,11 +74,8 @@ View::View(QWidget *w, bool showProgress) :
     m_followPlayIsDetached(false),
     m_playPointerFrame(0),
     m_showProgress(showProgress),
-    m_cache(nullptr),
+    m_splitLayerCaches(false),
     m_buffer(nullptr),
-    m_cacheValid(false),
-    m_cacheCentreFrame(0),
-    m_cacheZoomLevel(ZoomLevel::FramesPerPixel, 1024),
     m_selectionCached(false),
     m_deleting(false),
     m_haveSelectedLayer(false),
@@ -86,7 +93,6 @@ View::~View()
 
     m_deleting = true;
     delete m_propertyContainer;
-    delete m_cache;
     delete m_buffer;
 }
 
@@ -399,7 +405,7 @@ View::propertyContainerSelected(View *client, PropertyContainer *pc)
         return;
     }
 
-    m_cacheValid = false;
+    invalidateLayerCaches();
 
     Layer *selectedLayer = nullptr;
 
@@ -431,7 +437,7 @@ View::toolModeChanged()
 void
 View::overlayModeChanged()
 {
-    m_cacheValid = false;
+    invalidateLayerCaches();
     update();
 }
 
@@ -837,7 +843,7 @@ View::getForeground() const
 void
 View::addLayer(Layer *layer)
 {
-    m_cacheValid = false;
+    invalidateLayerCache(layer);
 
     SingleColourLayer *scl = dynamic_cast<SingleColourLayer *>(layer);
     if (scl) scl->setDefaultColourFor(this);
@@ -908,7 +914,7 @@ View::removeLayer(Layer *layer)
         return;
     }
 
-    m_cacheValid = false;
+    invalidateLayerCache(layer);
 
     for (LayerList::iterator i = m_fixedOrderLayers.begin();
          i != m_fixedOrderLayers.end();
@@ -1107,25 +1113,18 @@ View::modelChanged(ModelId modelId)
     SVCERR << "View[" << getId() << "]::modelChanged(" << modelId << ")" << endl;
 #endif
 
-    // If the model that has changed is not used by any of the cached
-    // layers, we won't need to recreate the cache
+    // Only the cached layers that use the model that has changed need
+    // to be repainted
     
-    bool recreate = false;
-
     bool discard;
     LayerList scrollables = getScrollableBackLayers(false, discard);
     for (LayerList::const_iterator i = scrollables.begin();
          i != scrollables.end(); ++i) {
         if ((*i)->getModel() == modelId) {
-            recreate = true;
-            break;
+            invalidateLayerCache(*i);
         }
     }
 
-    if (recreate) {
-        m_cacheValid = false;
-    }
-
     emit layerModelChanged();
 
     checkProgress(modelId);
@@ -1153,25 +1152,18 @@ View::modelChangedWithin(ModelId modelId,
         return;
     }
 
-    // If the model that has changed is not used by any of the cached
-    // layers, we won't need to recreate the cache
+    // Only the cached layers that use the model that has changed need
+    // to be repainted
     
-    bool recreate = false;
-
     bool discard;
     LayerList scrollables = getScrollableBackLayers(false, discard);
     for (LayerList::const_iterator i = scrollables.begin();
          i != scrollables.end(); ++i) {
         if ((*i)->getModel() == modelId) {
-            recreate = true;
-            break;
+            invalidateLayerCache(*i);
         }
     }
 
-    if (recreate) {
-        m_cacheValid = false;
-    }
-
     if (startFrame < myStartFrame) startFrame = myStartFrame;
     if (endFrame > myEndFrame) endFrame = myEndFrame;
 
@@ -1204,7 +1196,7 @@ View::modelReplaced()
 #ifdef DEBUG_VIEW_WIDGET_PAINT
     SVCERR << "View[" << getId() << "]::modelReplaced()" << endl;
 #endif
-    m_cacheValid = false;
+    invalidateLayerCaches();
     update();
 }
 
@@ -1217,7 +1209,11 @@ View::layerParametersChanged()
     SVDEBUG << "View::layerParametersChanged()" << endl;
 #endif
 
-    m_cacheValid = false;
+    if (layer) {
+        invalidateLayerCache(layer);
+    } else {
+        invalidateLayerCaches();
+    }
     update();
 
     if (layer) {
@@ -1423,7 +1419,7 @@ void
 View::selectionChanged()
 {
     if (m_selectionCached) {
-        m_cacheValid = false;
+        invalidateLayerCaches();
         m_selectionCached = false;
     }
     update();
@@ -2221,6 +2217,121 @@ View::getPaintRect() const
     return rect();
 }
 
+void
+View::setLayerCacheMemoryLimit(qint64 bytes)
+{
+    m_layerCacheMemoryLimit = bytes;
+
+    QSettings settings;
+    settings.beginGroup("Preferences");
+    settings.setValue("layer-cache-memory-mb", int(bytes / (1024 * 1024)));
+    settings.endGroup();
+}
+
+qint64
+View::getLayerCacheMemoryLimit()
+{
+    if (m_layerCacheMemoryLimit < 0) {
+        QSettings settings;
+        settings.beginGroup("Preferences");
+        int mb = settings.value("layer-cache-memory-mb", 128).toInt();
+        settings.endGroup();
+        m_layerCacheMemoryLimit = qint64(std::max(mb, 0)) * 1024 * 1024;
+    }
+    return m_layerCacheMemoryLimit;
+}
+
+void
+View::invalidateLayerCaches()
+{
+    for (LayerCache &cache : m_layerCaches) {
+        cache.valid = false;
+    }
+}
+
+void
+View::invalidateLayerCache(const Layer *layer)
+{
+    for (LayerCache &cache : m_layerCaches) {
+        for (const Layer *cached : cache.layers) {
+            if (cached == layer) {
+                if (cache.layers.size() > 1) {
+                    // Changed without the layers it shares with
+                    m_splitLayerCaches = true;
+                }
+                cache.valid = false;
+                break;
+            }
+        }
+    }
+}
+
+void
+View::updateLayerCaches(const LayerList &scrollables, QSize size)
+{
+    // All the scrollable layers share a single surface until one of
+    // them changes on its own. After that, each gets a surface of its
+    // own, as far as the memory limit allows, with any layers left
+    // over sharing the frontmost surface. Surfaces whose layers are
+    // unchanged are carried over, with whatever they already have
+    // painted on them.
+    //
+    // Separate surfaces cost a composite each on every paint, so once
+    // none of them has anything worth keeping (after a zoom or
+    // resize, say) we go back to a single shared one, which must be
+    // repainted in full just the same.
+
+    if (m_splitLayerCaches && m_layerCaches.size() > 1) {
+        bool anyUsable = false;
+        for (const LayerCache &cache : m_layerCaches) {
+            if (cache.valid && cache.zoomLevel == m_zoomLevel &&
+                cache.pixmap.size() == size) {
+                anyUsable = true;
+                break;
+            }
+        }
+        if (!anyUsable) {
+            m_splitLayerCaches = false;
+        }
+    }
+    
+    qint64 surfaceBytes = qint64(size.width()) * size.height() * 4;
+    qint64 maxSurfaces = 1;
+    if (m_splitLayerCaches && surfaceBytes > 0) {
+        maxSurfaces = std::max(qint64(1),
+                               getLayerCacheMemoryLimit() / surfaceBytes);
+    }
+
+    std::vector<LayerList> groups;
+    for (Layer *layer : scrollables) {
+        if (qint64(groups.size()) < maxSurfaces) {
+            groups.push_back({ layer });
+        } else {
+            groups.rbegin()->push_back(layer);
+        }
+    }
+
+    std::vector<LayerCache> caches;
+    for (const LayerList &group : groups) {
+        LayerCache cache { group, {}, false, 0, m_zoomLevel };
+        for (const LayerCache &existing : m_layerCaches) {
+            if (existing.layers == group) {
+                cache = existing;
+                break;
+            }
+        }
+        caches.push_back(cache);
+    }
+
+#ifdef DEBUG_VIEW_WIDGET_PAINT
+    SVCERR << "View[" << getId() << "]::updateLayerCaches: have "
+           << caches.size() << " cache(s) for " << scrollables.size()
+           << " scrollable layer(s)" << endl;
+#endif
+    
+    m_layerCaches = caches;
+}
+
 void
 View::paintEvent(QPaintEvent *e)
 {
@@ -2242,39 +2353,44 @@ View::paintEvent(QPaintEvent *e)
     m_zoomLevel = getZoomConstraintLevel
         (m_zoomLevel, ZoomConstraint::RoundNearest);
 
-    // We have a cache, which retains the state of scrollable (back)
-    // layers from one paint to the next, and a buffer, which we paint
-    // onto before copying directly to the widget. Both are at scaled
-    // resolution (e.g. 2x on a pixel-doubled display), whereas the
-    // paint event always comes in at formal (1x) resolution.
-
-    // If we touch the cache, we always leave it in a valid state
-    // across its whole extent. When another method invalidates the
-    // cache, it does so by setting m_cacheValid false, so if that
-    // flag is true on entry, then the cache is valid across its whole
-    // extent - although it may be valid for a different centre frame,
-    // zoom level, or view size from those now in effect.
+    // We have a set of caches, which retain the state of scrollable
+    // (back) layers from one paint to the next, and a buffer, which
+    // we paint onto before copying directly to the widget. The
+    // caches and buffer are at scaled resolution (e.g. 2x on a
+    // pixel-doubled display), whereas the paint event always comes
+    // in at formal (1x) resolution.
+
+    // Each cache is a transparent surface holding a group of adjacent
+    // scrollable layers: all of them, until one changes on its own,
+    // and then one layer each (as memory allows), so that a change to
+    // one layer does not require the others to be repainted. See
+    // updateLayerCaches. If we touch a cache, we always
+    // leave it in a valid state across its whole extent. When another
+    // method invalidates a cache, it does so by setting its valid
+    // flag false, so if that flag is true on entry, then the cache is
+    // valid across its whole extent - although it may be valid for a
+    // different centre frame, zoom level, or view size from those now
+    // in effect.
 
     // Our process goes:
     // 
-    // 1. Check whether we have any scrollable (cacheable) layers.  If
-    //    we don't, then invalidate and ignore the cache and go to
-    //    step 5.  Otherwise:
-    // 
-    // 2. Check the cache, scroll as necessary, identify any area that
-    //    needs to be refreshed (this might be the whole cache).
+    // 1. Match up the caches with the current stack of scrollable
+    //    (cacheable) layers. If there are no scrollable layers, there
+    //    are no caches and we go to step 5. Otherwise:
     //
-    // 3. Paint to cache the area that needs to be refreshed, from the
-    //    stack of scrollable layers.
+    // 2. Fill the exposed area of the buffer with the background.
+    // 
+    // 3. For each cache, back to front: check it, scroll as
+    //    necessary, and identify any area that needs to be refreshed
+    //    (this might be the whole cache). Clear that area and paint
+    //    it from the cache's layers.
     //
-    // 4. Paint to buffer from cache: if there are no non-cached areas
-    //    or selections and the cache has not scrolled, then paint the
-    //    union of the area of cache that has changed and the area
-    //    that the paint event reported as exposed; otherwise paint
-    //    the whole.
+    // 4. Composite the exposed area of each cache onto the buffer in
+    //    turn. If a cache is invalid and only a small area has been
+    //    exposed, paint its layers directly to the buffer instead.
     //
-    // 5. Paint the exposed area to the buffer from the cache plus all
-    //    the layers that haven't been cached, plus selections etc.
+    // 5. Paint the exposed area to the buffer from all the layers
+    //    that haven't been cached, plus selections etc.
     //
     // 6. Paint the exposed rect from the buffer.
     //
@@ -2290,7 +2406,7 @@ View::paintEvent(QPaintEvent *e)
     }
 
     // If not all layers are scrollable, but some of the back layers
-    // are, we should store only those in the cache.
+    // are, we should store only those in the caches.
 
     bool layersChanged = false;
     LayerList scrollables = getScrollableBackLayers(true, layersChanged);
@@ -2302,10 +2418,6 @@ View::paintEvent(QPaintEvent *e)
               << " non-scrollable front layers" << endl;
 #endif
 
-    if (layersChanged || scrollables.empty()) {
-        m_cacheValid = false;
-    }
-
     QRect wholeArea(scaledRect(rect(), dpratio));
     QSize wholeSize(scaledSize(size(), dpratio));
 
@@ -2314,35 +2426,107 @@ View::paintEvent(QPaintEvent *e)
         m_buffer = new QPixmap(wholeSize);
     }
 
-    bool shouldUseCache = false;
-    bool shouldRepaintCache = false;
-    QRect cacheAreaToRepaint;
+    updateLayerCaches(scrollables, wholeSize);
+
+    // Create the ViewProxy for geometry provision, using the
+    // device-pixel ratio for pixel-doubled hi-dpi rendering as
+    // appropriate.
+
+    ViewProxy proxy(this, dpratio);
+
+    // Some layers may need an aligning proxy. If a layer's model has
+    // a source model that is the reference model for the aligning
+    // model, and the layer is tagged as to be aligned, then we might
+    // use an aligning proxy. Note this is actually made use of only
+    // if m_useAligningProxy is true further down.
     
+    ModelId alignmentModelId;
+    ModelId alignmentReferenceId;
+    auto aligningModel = ModelById::get(getAligningModel());
+    if (aligningModel) {
+        alignmentModelId = aligningModel->getAlignment();
+        alignmentReferenceId = aligningModel->getAlignmentReference();
+#ifdef DEBUG_VIEW_WIDGET_PAINT
+        SVCERR << "alignmentModelId = " << alignmentModelId << " (reference = " << alignmentReferenceId << ")" << endl;
+#endif
+    } else {
+#ifdef DEBUG_VIEW_WIDGET_PAINT
+        SVCERR << "no aligningModel" << endl;
+#endif
+    }
+    ViewProxy aligningProxy(this, dpratio, alignmentModelId);
+
+    auto getProxyFor = [&](const Layer *layer) -> ViewProxy * {
+        if (m_useAligningProxy) {
+            if (layer->getModel() == alignmentReferenceId ||
+                layer->getSourceModel() == alignmentReferenceId) {
+                return &aligningProxy;
+            }
+        }
+        return &proxy;
+    };
+
+    auto paintScrollables = [&](QPainter &paint, const LayerList &layers,
+                                QRect areaToPaint) {
+
+        setPaintFont(paint);
+        paint.setClipRect(areaToPaint);
+
+        paint.setPen(getForeground());
+        paint.setBrush(Qt::NoBrush);
+        
+        for (Layer *layer : layers) {
+
+            paint.setRenderHint(QPainter::Antialiasing, false);
+            paint.save();
+
+#ifdef DEBUG_VIEW_WIDGET_PAINT
+            SVCERR << "Painting scrollable layer " << layer << " (model " << layer->getModel() << ", source model " << layer->getSourceModel() << ") with useAligningProxy = " << (getProxyFor(layer) == &aligningProxy) << ", dpratio = " << dpratio << ", areaToPaint = " << areaToPaint.x() << "," << areaToPaint.y() << " " << areaToPaint.width() << "x" << areaToPaint.height() << endl;
+#endif
+        
+            layer->paint(getProxyFor(layer), paint, areaToPaint);
+
+            paint.restore();
+        }
+    };
+
+    QPainter paint;
+
+    if (!m_layerCaches.empty()) {
+        paint.begin(m_buffer);
+        paint.setPen(getBackground());
+        paint.setBrush(getBackground());
+        paint.drawRect(requestedPaintArea);
+        paint.end();
+    }
+
     static HitCount count("View cache");
 
-    if (!scrollables.empty()) {
+    for (LayerCache &cache : m_layerCaches) {
 
-        shouldUseCache = true;
-        shouldRepaintCache = true;
-        cacheAreaToRepaint = wholeArea;
+        QPixmap &pixmap = cache.pixmap;
+        
+        bool shouldUseCache = true;
+        bool shouldRepaintCache = true;
+        QRect cacheAreaToRepaint = wholeArea;
 
 #ifdef DEBUG_VIEW_WIDGET_PAINT
-        SVCERR << "View[" << getId() << "]: cache " << m_cache << ", cache zoom "
-                  << m_cacheZoomLevel << ", zoom " << m_zoomLevel << endl;
+        SVCERR << "View[" << getId() << "]: cache for " << cache.layers.size()
+               << " layer(s) from " << cache.layers[0] << ", cache zoom "
+               << cache.zoomLevel << ", zoom " << m_zoomLevel << endl;
 #endif
 
         using namespace std::rel_ops;
     
-        if (!m_cacheValid ||
-            !m_cache ||
-            m_cacheZoomLevel != m_zoomLevel ||
-            m_cache->size() != wholeSize) {
+        if (!cache.valid ||
+            cache.zoomLevel != m_zoomLevel ||
+            pixmap.size() != wholeSize) {
 
             // cache is not valid at all
 
             if (requestedPaintArea.width() < wholeSize.width() / 10) {
 
-                m_cacheValid = false;
+                cache.valid = false;
                 shouldUseCache = false;
                 shouldRepaintCache = false;
 
@@ -2351,10 +2535,13 @@ View::paintEvent(QPaintEvent *e)
 #endif
             } else {
 
-                if (!m_cache ||
-                    m_cache->size() != wholeSize) {
-                    delete m_cache;
-                    m_cache = new QPixmap(wholeSize);
+                if (pixmap.size() != wholeSize) {
+                    // Filling with a transparent colour is what gives
+                    // the pixmap an alpha channel: without it, the
+                    // transparent background below would come out
+                    // black and hide the caches underneath
+                    pixmap = QPixmap(wholeSize);
+                    pixmap.fill(Qt::transparent);
                 }
 
 #ifdef DEBUG_VIEW_WIDGET_PAINT
@@ -2364,25 +2551,25 @@ View::paintEvent(QPaintEvent *e)
 
             count.miss();
             
-        } else if (m_cacheCentreFrame != m_centreFrame) {
+        } else if (cache.centreFrame != m_centreFrame) {
 
 #ifdef DEBUG_VIEW_WIDGET_PAINT
-            SVCERR << "View[" << getId() << "]::paintEvent: cache centre frame is " << m_cacheCentreFrame << endl;
+            SVCERR << "View[" << getId() << "]::paintEvent: cache centre frame is " << cache.centreFrame << endl;
 #endif
 
-            int dx = dpratio * (getXForFrame(m_cacheCentreFrame) -
+            int dx = dpratio * (getXForFrame(cache.centreFrame) -
                                 getXForFrame(m_centreFrame));
 
-            if (dx > -m_cache->width() && dx < m_cache->width()) {
+            if (dx > -pixmap.width() && dx < pixmap.width()) {
 
-                m_cache->scroll(dx, 0, m_cache->rect(), nullptr);
+                pixmap.scroll(dx, 0, pixmap.rect(), nullptr);
 
                 if (dx < 0) {
                     cacheAreaToRepaint = 
-                        QRect(m_cache->width() + dx, 0, -dx, m_cache->height());
+                        QRect(pixmap.width() + dx, 0, -dx, pixmap.height());
                 } else {
                     cacheAreaToRepaint = 
-                        QRect(0, 0, dx, m_cache->height());
+                        QRect(0, 0, dx, pixmap.height());
                 }
 
                 count.partial();
@@ -2404,110 +2591,35 @@ View::paintEvent(QPaintEvent *e)
             count.hit();
             shouldRepaintCache = false;
         }
-    }
-
-#ifdef DEBUG_VIEW_WIDGET_PAINT
-    SVCERR << "View[" << getId() << "]::paintEvent: m_cacheValid = " << m_cacheValid << ", shouldUseCache = " << shouldUseCache << ", shouldRepaintCache = " << shouldRepaintCache << ", cacheAreaToRepaint = " << cacheAreaToRepaint.x() << "," << cacheAreaToRepaint.y() << " " << cacheAreaToRepaint.width() << "x" << cacheAreaToRepaint.height() << endl;
-#endif
-
-    if (shouldRepaintCache && !shouldUseCache) {
-        // If we are repainting the cache, then we paint the
-        // scrollables only to the cache, not to the buffer. So if
-        // shouldUseCache is also false, then the scrollables can't
-        // appear because they will only be on the cache
-        throw std::logic_error("ERROR: shouldRepaintCache is true, but shouldUseCache is false: this can't lead to the correct result");
-    }
-
-    // Create the ViewProxy for geometry provision, using the
-    // device-pixel ratio for pixel-doubled hi-dpi rendering as
-    // appropriate.
-
-    ViewProxy proxy(this, dpratio);
 
-    // Some layers may need an aligning proxy. If a layer's model has
-    // a source model that is the reference model for the aligning
-    // model, and the layer is tagged as to be aligned, then we might
-    // use an aligning proxy. Note this is actually made use of only
-    // if m_useAligningProxy is true further down.
-    
-    ModelId alignmentModelId;
-    ModelId alignmentReferenceId;
-    auto aligningModel = ModelById::get(getAligningModel());
-    if (aligningModel) {
-        alignmentModelId = aligningModel->getAlignment();
-        alignmentReferenceId = aligningModel->getAlignmentReference();
-#ifdef DEBUG_VIEW_WIDGET_PAINT
-        SVCERR << "alignmentModelId = " << alignmentModelId << " (reference = " << alignmentReferenceId << ")" << endl;
-#endif
-    } else {
 #ifdef DEBUG_VIEW_WIDGET_PAINT
-        SVCERR << "no aligningModel" << endl;
+        SVCERR << "View[" << getId() << "]::paintEvent: shouldUseCache = " << shouldUseCache << ", shouldRepaintCache = " << shouldRepaintCache << ", cacheAreaToRepaint = " << cacheAreaToRepaint.x() << "," << cacheAreaToRepaint.y() << " " << cacheAreaToRepaint.width() << "x" << cacheAreaToRepaint.height() << endl;
 #endif
-    }
-    ViewProxy aligningProxy(this, dpratio, alignmentModelId);
-    
-    // Scrollable (cacheable) items first. If we are repainting the
-    // cache, then we paint these to the cache; otherwise straight to
-    // the buffer.
-    QRect areaToPaint;
-    QPainter paint;
-
-    if (shouldRepaintCache) {
-        paint.begin(m_cache);
-        areaToPaint = cacheAreaToRepaint;
-    } else {
-        paint.begin(m_buffer);
-        areaToPaint = requestedPaintArea;
-    }
-
-    setPaintFont(paint);
-    paint.setClipRect(areaToPaint);
-
-    paint.setPen(getBackground());
-    paint.setBrush(getBackground());
-    paint.drawRect(areaToPaint);
 
-    paint.setPen(getForeground());
-    paint.setBrush(Qt::NoBrush);
-        
-    for (LayerList::iterator i = scrollables.begin();
-         i != scrollables.end(); ++i) {
+        if (shouldRepaintCache) {
 
-        paint.setRenderHint(QPainter::Antialiasing, false);
-        paint.save();
+            // The cache holds only its own layers, over a transparent
+            // background, so that it can be composited with the others
+            
+            paint.begin(&pixmap);
+            paint.setCompositionMode(QPainter::CompositionMode_Source);
+            paint.fillRect(cacheAreaToRepaint, Qt::transparent);
+            paint.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            paintScrollables(paint, cache.layers, cacheAreaToRepaint);
+            paint.end();
 
-        Layer *layer = *i;
-        
-        bool useAligningProxy = false;
-        if (m_useAligningProxy) {
-            if (layer->getModel() == alignmentReferenceId ||
-                layer->getSourceModel() == alignmentReferenceId) {
-                useAligningProxy = true;
-            }
+            // and now we have
+            cache.valid = true;
+            cache.centreFrame = m_centreFrame;
+            cache.zoomLevel = m_zoomLevel;
         }
 
-#ifdef DEBUG_VIEW_WIDGET_PAINT
-        SVCERR << "Painting scrollable layer " << layer << " (model " << layer->getModel() << ", source model " << layer->getSourceModel() << ") with shouldRepaintCache = " << shouldRepaintCache << ", useAligningProxy = " << useAligningProxy << ", dpratio = " << dpratio << ", areaToPaint = " << areaToPaint.x() << "," << areaToPaint.y() << " " << areaToPaint.width() << "x" << areaToPaint.height() << endl;
-#endif
-        
-        layer->paint(useAligningProxy ? &aligningProxy : &proxy,
-                     paint, areaToPaint);
-
-        paint.restore();
-    }
-
-    paint.end();
-
-    if (shouldRepaintCache) {
-        // and now we have
-        m_cacheValid = true;
-        m_cacheCentreFrame = m_centreFrame;
-        m_cacheZoomLevel = m_zoomLevel;
-    }
-
-    if (shouldUseCache) {
         paint.begin(m_buffer);
-        paint.drawPixmap(requestedPaintArea, *m_cache, requestedPaintArea);
+        if (shouldUseCache) {
+            paint.drawPixmap(requestedPaintArea, pixmap, requestedPaintArea);
+        } else {
+            paintScrollables(paint, cache.layers, requestedPaintArea);
+        }
         paint.end();
     }
 
@@ -2525,25 +2637,40 @@ View::paintEvent(QPaintEvent *e)
     paint.setPen(getForeground());
     paint.setBrush(Qt::NoBrush);
         
+    // Illumination of local features is painted separately from the
+    // layers' own content, so that a layer whose illumination changes
+    // as the mouse moves need not be repainted (or dropped from its
+    // cache) as a result. Each layer's illumination goes directly
+    // over its own content, so the scrollable layers' illumination
+    // goes here, under the non-scrollables, and each non-scrollable
+    // is illuminated straight after it is painted
+
+    for (LayerList::iterator i = scrollables.begin();
+         i != scrollables.end(); ++i) {
+        
+        Layer *layer = *i;
+
+        paint.save();
+        layer->paintIllumination(getProxyFor(layer), paint,
+                                 requestedPaintArea);
+        paint.restore();
+    }
+        
     for (LayerList::iterator i = nonScrollables.begin(); 
          i != nonScrollables.end(); ++i) {
         
         Layer *layer = *i;
-        
-        bool useAligningProxy = false;
-        if (m_useAligningProxy) {
-            if (layer->getModel() == alignmentReferenceId ||
-                layer->getSourceModel() == alignmentReferenceId) {
-                useAligningProxy = true;
-            }
-        }
 
 #ifdef DEBUG_VIEW_WIDGET_PAINT
-        SVCERR << "Painting non-scrollable layer " << layer << " (model " << layer->getModel() << ", source model " << layer->getSourceModel() << ") with shouldRepaintCache = " << shouldRepaintCache << ", useAligningProxy = " << useAligningProxy << ", dpratio = " << dpratio << ", requestedPaintArea = " << requestedPaintArea.x() << "," << requestedPaintArea.y() << " " << requestedPaintArea.width() << "x" << requestedPaintArea.height() << endl;
+        SVCERR << "Painting non-scrollable layer " << layer << " (model " << layer->getModel() << ", source model " << layer->getSourceModel() << ") with useAligningProxy = " << (getProxyFor(layer) == &aligningProxy) << ", dpratio = " << dpratio << ", requestedPaintArea = " << requestedPaintArea.x() << "," << requestedPaintArea.y() << " " << requestedPaintArea.width() << "x" << requestedPaintArea.height() << endl;
 #endif
 
-        layer->paint(useAligningProxy ? &aligningProxy : &proxy,
-                     paint, requestedPaintArea);
+        layer->paint(getProxyFor(layer), paint, requestedPaintArea);
+
+        paint.save();
+        layer->paintIllumination(getProxyFor(layer), paint,
+                                 requestedPaintArea);
+        paint.restore();
     }
         
     paint.end();
@@ -3074,6 +3201,80 @@ View::waitForLayersToBeReady()
     return true;
 }
 
+std::vector<Layer *>
+View::getRenderableLayers()
+{
+    std::vector<Layer *> layers;
+    for (Layer *layer : m_layerStack) {
+        if (!layer->isLayerDormant(this)) {
+            layers.push_back(layer);
+        }
+    }
+    return layers;
+}
+
+void
+View::renderStrip(QPainter &paint, ViewStripProxy &proxy,
+                  const std::vector<Layer *> &layers, QColor foreground,
+                  const std::vector<QMutex *> *layerMutexes)
+{
+    QRect chunk(proxy.getPaintRect());
+
+    paint.setPen(foreground);
+    paint.setBrush(Qt::NoBrush);
+
+    for (int i = 0; in_range_for(layers, i); ++i) {
+
+        paint.setRenderHint(QPainter::Antialiasing, false);
+
+        paint.save();
+
+#ifdef DEBUG_VIEW
+        SVDEBUG << "View::renderStrip: Painting layer " << i
+                << " with start frame " << proxy.getStartFrame()
+                << " at offset " << proxy.getOffset() << endl;
+#endif
+        
+        if (layerMutexes) {
+            QMutexLocker locker((*layerMutexes)[i]);
+            layers[i]->paint(&proxy, paint, chunk);
+        } else {
+            layers[i]->paint(&proxy, paint, chunk);
+        }
+
+        paint.restore();
+    }
+}
+
+void
+View::renderStripWithBackground(QPainter &paint, ViewStripProxy &proxy,
+                                const std::vector<Layer *> &layers,
+                                QColor background, QColor foreground)
+{
+    paint.setPen(background);
+    paint.setBrush(background);
+    paint.drawRect(proxy.getPaintRect());
+
+    for (Layer *layer : layers) {
+        layer->setSynchronousPainting(true);
+    }
+
+    renderStrip(paint, proxy, layers, foreground, nullptr);
+
+    for (Layer *layer : layers) {
+        layer->setSynchronousPainting(false);
+    }
+}
+
+void
+View::discardStripState(const ViewStripProxy &proxy,
+                        const std::vector<Layer *> &layers)
+{
+    for (Layer *layer : layers) {
+        layer->discardViewState(proxy.getId());
+    }
+}
+
 bool
 View::render(QPainter &paint, int xorigin, sv_frame_t f0, sv_frame_t f1)
 {
@@ -3092,59 +3293,193 @@ View::render(QPainter &paint, int xorigin, sv_frame_t f0, sv_frame_t f1)
         return false;
     }
 
-    sv_frame_t origCentreFrame = m_centreFrame;
+    // Each strip is painted through a proxy positioned relative to
+    // where the view is now, so the view itself is never moved and
+    // nothing changes on screen while rendering
+    
+    ViewStripProxy proxy(this, 0);
+    int offset = proxy.getXForFrame(f0);
+    int sw = proxy.getPaintWidth();
+    if (sw <= 0) {
+        return false;
+    }
+
+    std::vector<Layer *> layers = getRenderableLayers();
+    QColor background = getBackground();
+    QColor foreground = getForeground();
     
     QProgressDialog progress(tr("Rendering image..."),
-                             tr("Cancel"), 0, w / width(), this);
+                             tr("Cancel"), 0, w / sw, this);
+
+    bool ok = true;
 
-    for (int x = 0; x < w; x += width()) {
+    for (int x = 0; x < w; x += sw) {
 
-        progress.setValue(x / width());
+        progress.setValue(x / sw);
         qApp->processEvents();
         if (progress.wasCanceled()) {
-            m_centreFrame = origCentreFrame;
-            update();
-            return false;
+            ok = false;
+            break;
         }
 
-        m_centreFrame = f0 + sv_frame_t(round(m_zoomLevel.pixelsToFrames
-                                              (x + width()/2)));
-        
-        QRect chunk(0, 0, width(), height());
+        proxy.setOffset(offset + x);
 
-        paint.setPen(getBackground());
-        paint.setBrush(getBackground());
+        paint.save();
+        paint.translate(xorigin + x, 0);
+        renderStripWithBackground(paint, proxy, layers,
+                                  background, foreground);
+        paint.restore();
+    }
 
-        paint.drawRect(QRect(xorigin + x, 0, width(), height()));
+    discardStripState(proxy, layers);
 
-        paint.setPen(getForeground());
-        paint.setBrush(Qt::NoBrush);
+    return ok;
+}
+
+bool
+View::renderStrips(sv_frame_t f0, int w, StripSource source, StripSink sink)
+{
+    ViewStripProxy origin(this, 0);
+    int offset = origin.getXForFrame(f0);
+    int sw = origin.getPaintWidth();
+    if (sw <= 0) {
+        return false;
+    }
+
+    int strips = (w + sw - 1) / sw;
+
+    int threadCount = QThread::idealThreadCount();
+    if (threadCount > strips) threadCount = strips;
+    if (threadCount < 1) threadCount = 1;
+
+    std::vector<Layer *> layers = getRenderableLayers();
+    QColor foreground = getForeground();
+
+    // Layers keep per-view state and are not reentrant, so a layer
+    // may only be painting one strip at a time. Layers showing the
+    // same model (or models derived from the same source) may also
+    // read it through shared, non-thread-safe caches, so they share
+    // a mutex too. The strips still run concurrently through the
+    // layer stack, each thread painting a different group of layers
+    // from the others, and any layer that renders with its own
+    // threads (such as a colour plot) gets on with that while the
+    // others paint.
+    std::vector<QMutex> groupMutexes(layers.size());
+    std::vector<QMutex *> layerMutexes(layers.size());
+    std::map<ModelId, QMutex *> modelMutexes;
+    
+    for (int i = 0; in_range_for(layers, i); ++i) {
+        ModelId model = layers[i]->getSourceModel();
+        if (model.isNone()) model = layers[i]->getModel();
+        if (model.isNone()) {
+            layerMutexes[i] = &groupMutexes[i];
+        } else {
+            if (modelMutexes.find(model) == modelMutexes.end()) {
+                modelMutexes[model] = &groupMutexes[i];
+            }
+            layerMutexes[i] = modelMutexes[model];
+        }
+    }
+
+    // Anything a layer would create lazily on first paint must be
+    // created here, on the GUI thread, before the strip threads start
+    for (Layer *layer : layers) {
+        layer->prepareForPainting(&origin);
+    }
+
+    // The GUI thread waits for each batch of strips before
+    // processing events, so the view cannot paint these layers
+    // itself while the strip threads are running. When it does paint
+    // them, between batches, it uses its own per-view state in each
+    // layer rather than that of the strip proxies, which all share
+    // the id of the origin proxy.
+    
+    std::vector<QImage> images(threadCount);
+    
+    auto renderOne = [&](int strip, QImage *image) {
+        QPainter paint(image);
+        ViewStripProxy proxy(origin);
+        proxy.setOffset(offset + strip * sw);
+        renderStrip(paint, proxy, layers, foreground, &layerMutexes);
+    };
+
+#ifdef DEBUG_VIEW
+    SVDEBUG << "View::renderStrips: Rendering " << strips << " strips of "
+            << sw << " pixels using " << threadCount << " thread(s)" << endl;
+#endif
+    
+    QProgressDialog progress(tr("Rendering image..."),
+                             tr("Cancel"), 0, strips, this);
+
+    bool ok = true;
 
-        for (LayerList::iterator i = m_layerStack.begin();
-             i != m_layerStack.end(); ++i) {
-            if (!((*i)->isLayerDormant(this))){
+    for (int s0 = 0; ok && s0 < strips; s0 += threadCount) {
 
-                paint.setRenderHint(QPainter::Antialiasing, false);
+        progress.setValue(s0);
+        qApp->processEvents();
+        if (progress.wasCanceled()) {
+            ok = false;
+            break;
+        }
 
-                paint.save();
-                paint.translate(xorigin + x, 0);
+        int n = std::min(threadCount, strips - s0);
 
-                SVCERR << "Centre frame now: " << m_centreFrame << " drawing to " << chunk.x() + x + xorigin << ", " << chunk.width() << endl;
+        for (int i = 0; i < n; ++i) {
+            int x = (s0 + i) * sw;
+            images[i] = source(x, std::min(sw, w - x));
+        }
+        
+        for (Layer *layer : layers) {
+            layer->setSynchronousPainting(true);
+        }
+        
+        std::vector<std::thread> threads;
+        for (int i = 1; i < n; ++i) {
+            threads.push_back(std::thread(renderOne, s0 + i, &images[i]));
+        }
 
-                (*i)->setSynchronousPainting(true);
+        renderOne(s0, &images[0]);
 
-                (*i)->paint(this, paint, chunk);
+        for (auto &t : threads) {
+            t.join();
+        }
 
-                (*i)->setSynchronousPainting(false);
+        for (Layer *layer : layers) {
+            layer->setSynchronousPainting(false);
+        }
 
-                paint.restore();
+        for (int i = 0; i < n; ++i) {
+            if (ok && sink && !sink((s0 + i) * sw, images[i])) {
+                ok = false;
             }
+            images[i] = QImage();
         }
     }
 
-    m_centreFrame = origCentreFrame;
-    update();
-    return true;
+    discardStripState(origin, layers);
+
+    return ok;
+}
+
+bool
+View::renderToImage(QImage &image, int xorigin, sv_frame_t f0)
+{
+    // Each strip is a QImage sharing the full image's pixel data, so
+    // strips are painted in place with no copying
+    
+    uchar *bits = image.bits();
+    int bytesPerLine = image.bytesPerLine();
+    int bytesPerPixel = image.depth() / 8;
+    int h = image.height();
+    QImage::Format format = image.format();
+
+    return renderStrips
+        (f0, image.width() - xorigin,
+         [&](int x, int sw) {
+             return QImage(bits + (xorigin + x) * bytesPerPixel,
+                           sw, h, bytesPerLine, format);
+         },
+         nullptr);
 }
 
 QImage *
@@ -3165,16 +3500,26 @@ View::renderPartToNewImage(sv_frame_t f0, sv_frame_t f1)
 {
     int x0 = int(round(getZoomLevel().framesToPixels(double(f0))));
     int x1 = int(round(getZoomLevel().framesToPixels(double(f1))));
+
+    if (!waitForLayersToBeReady()) {
+        return nullptr;
+    }
+
+    int margin = prepareRenderMargin();
     
-    QImage *image = new QImage(x1 - x0, height(), QImage::Format_RGB32);
+    QImage *image = new QImage(x1 - x0 + margin, height(),
+                               QImage::Format_RGB32);
+    image->fill(getBackground());
 
-    QPainter *paint = new QPainter(image);
-    if (!render(*paint, 0, f0, f1)) {
-        delete paint;
+    if (margin > 0) {
+        QPainter paint(image);
+        renderMargin(paint);
+    }
+
+    if (!renderToImage(*image, margin, f0)) {
         delete image;
         return nullptr;
     } else {
-        delete paint;
         return image;
     }
 }
@@ -3197,6 +3542,69 @@ View::getRenderedPartImageSize(sv_frame_t f0, sv_frame_t f1)
     return QSize(x1 - x0, height());
 }
 
+bool
+View::renderToImageFile(QString filename)
+{
+    sv_frame_t f0 = getModelsStartFrame();
+    sv_frame_t f1 = getModelsEndFrame();
+
+    return renderPartToImageFile(filename, f0, f1);
+}
+
+bool
+View::renderPartToImageFile(QString filename, sv_frame_t f0, sv_frame_t f1)
+{
+    int x0 = int(round(getZoomLevel().framesToPixels(double(f0))));
+    int x1 = int(round(getZoomLevel().framesToPixels(double(f1))));
+
+    if (!waitForLayersToBeReady()) {
+        return false;
+    }
+
+    int margin = prepareRenderMargin();
+    int h = height();
+    QColor background = getBackground();
+    
+    auto blankStrip = [&](int, int sw) {
+        QImage strip(sw, h, QImage::Format_RGB32);
+        strip.fill(background);
+        return strip;
+    };
+
+    bool ok = true;
+    
+    {
+        StreamedImageWriter writer(filename, x1 - x0 + margin, h);
+        
+        if (margin > 0) {
+            QImage strip = blankStrip(0, margin);
+            QPainter paint(&strip);
+            renderMargin(paint);
+            paint.end();
+            ok = writer.writeStrip(0, strip);
+        }
+
+        ok = ok && renderStrips
+            (f0, x1 - x0, blankStrip,
+             [&](int x, const QImage &strip) {
+                 return writer.writeStrip(margin + x, strip);
+             });
+
+        ok = writer.close() && ok;
+
+        if (!writer.isOK()) {
+            SVCERR << "View::renderPartToImageFile: " << writer.getError()
+                   << endl;
+        }
+    }
+
+    if (!ok) {
+        QFile::remove(filename);
+    }
+    
+    return ok;
+}
+
 bool
 View::renderToSvgFile(QString filename)
 {
@@ -3212,18 +3620,78 @@ View::renderPartToSvgFile(QString filename, sv_frame_t f0, sv_frame_t f1)
     int x0 = int(round(getZoomLevel().framesToPixels(double(f0))));
     int x1 = int(round(getZoomLevel().framesToPixels(double(f1))));
 
-    QSvgGenerator generator;
-    generator.setFileName(filename);
-    generator.setSize(QSize(x1 - x0, height()));
-    generator.setViewBox(QRect(0, 0, x1 - x0, height()));
-    generator.setTitle(tr("Exported image from %1")
-                       .arg(QApplication::applicationName()));
+    int w = x1 - x0;
     
-    QPainter paint;
-    paint.begin(&generator);
-    bool result = render(paint, 0, f0, f1);
-    paint.end();
-    return result;
+    if (!waitForLayersToBeReady()) {
+        return false;
+    }
+
+    // Vector output is generated and written one strip at a time, so
+    // that the whole document never has to be held in memory
+    
+    ViewStripProxy proxy(this, 0);
+    int offset = proxy.getXForFrame(f0);
+    int sw = proxy.getPaintWidth();
+    if (sw <= 0) {
+        return false;
+    }
+
+    int margin = prepareRenderMargin();
+    std::vector<Layer *> layers = getRenderableLayers();
+    QColor background = getBackground();
+    QColor foreground = getForeground();
+
+    bool ok = true;
+
+    {
+        StreamedSvgWriter writer(filename, w + margin, height(),
+                                 tr("Exported image from %1")
+                                 .arg(QApplication::applicationName()));
+
+        if (margin > 0) {
+            ok = writer.writeStrip(0, margin, [&](QPainter &paint) {
+                renderMargin(paint);
+                return true;
+            });
+        }
+    
+        QProgressDialog progress(tr("Rendering image..."),
+                                 tr("Cancel"), 0, w / sw, this);
+
+        for (int x = 0; ok && x < w; x += sw) {
+
+            progress.setValue(x / sw);
+            qApp->processEvents();
+            if (progress.wasCanceled()) {
+                ok = false;
+                break;
+            }
+
+            proxy.setOffset(offset + x);
+
+            ok = writer.writeStrip
+                (margin + x, std::min(sw, w - x), [&](QPainter &paint) {
+                    renderStripWithBackground(paint, proxy, layers,
+                                              background, foreground);
+                    return true;
+                });
+        }
+
+        ok = writer.close() && ok;
+
+        if (!writer.isOK()) {
+            SVCERR << "View::renderPartToSvgFile: " << writer.getError()
+                   << endl;
+        }
+    }
+
+    discardStripState(proxy, layers);
+
+    if (!ok) {
+        QFile::remove(filename);
+    }
+    
+    return ok;
 }
 
 void
@@ -18,6 +18,7 @@
 
 #include <QFrame>
 #include <QProgressBar>
+#include <QImage>
 
 #include "layer/LayerGeometryProvider.h"
 
@@ -33,11 +34,14 @@
 
 class Layer;
 class ViewPropertyContainer;
+class ViewStripProxy;
 
 class QPushButton;
+class QMutex;
 
 #include <map>
 #include <set>
+#include <functional>
 
 /**
  * View is the base class of widgets that display one or more
@@ -339,6 +343,22 @@ public:
      */
     virtual QSize getRenderedPartImageSize(sv_frame_t f0, sv_frame_t f1);
 
+    /**
+     * Render the view contents to a new image file. Unlike
+     * renderToNewImage(), this never holds the whole image in
+     * memory: it is rendered and written a strip at a time, so it
+     * can be used for images too large to be held as a QImage. The
+     * file is written in uncompressed BMP format.
+     */
+    virtual bool renderToImageFile(QString filename);
+
+    /**
+     * Render the view contents between the given frame extents to a
+     * new image file, a strip at a time, as for renderToImageFile().
+     */
+    virtual bool renderPartToImageFile(QString filename,
+                                       sv_frame_t f0, sv_frame_t f1);
+
     /**
      * Render the view contents to a new SVG file.
      */
@@ -416,7 +436,26 @@ public:
     
     View *getView() override { return this; } 
     const View *getView() const override { return this; } 
-    
+
+    /**
+     * Set the amount of memory, in bytes, that each view may use for
+     * the surfaces on which it retains its scrollable layers between
+     * paints, and save it in the preferences. Normally all of a
+     * view's scrollable layers share one surface. Once one of them
+     * changes on its own, each gets a surface of its own, so that a
+     * further change to one layer does not cause the others to be
+     * repainted; if there are more layers than the limit allows
+     * surfaces for, the frontmost layers share one. At least one
+     * surface is always used. Takes effect at the next paint.
+     */
+    static void setLayerCacheMemoryLimit(qint64 bytes);
+
+    /**
+     * Return the amount of memory each view may use for its layer
+     * surfaces, as read from the preferences (default 128MB).
+     */
+    static qint64 getLayerCacheMemoryLimit();
+
 signals:
     void propertyContainerAdded(PropertyContainer *pc);
     void propertyContainerRemoved(PropertyContainer *pc);
@@ -487,6 +526,70 @@ protected:
     virtual bool render(QPainter &paint, int x0, sv_frame_t f0, sv_frame_t f1);
     virtual void setPaintFont(QPainter &paint);
 
+    /**
+     * Prepare to render, for export, anything that appears to the
+     * left of the view's timeline (such as a vertical scale), and
+     * return its width in pixels. The default is to have no margin.
+     */
+    virtual int prepareRenderMargin() { return 0; }
+
+    /**
+     * Paint the margin whose width was returned by the last call to
+     * prepareRenderMargin(), at the left of the given painter.
+     */
+    virtual void renderMargin(QPainter &) { }
+
+    typedef std::function<QImage(int x, int width)> StripSource;
+    typedef std::function<bool(int x, const QImage &strip)> StripSink;
+
+    /**
+     * Render the region of the given width starting at frame f0, in
+     * view-sized strips, several at once on separate threads. The
+     * image for each strip (whose left edge is at x pixels from the
+     * start of the region) is obtained from the source, which should
+     * return it filled with the background colour. If sink is set,
+     * it is called with each strip in turn when it has been
+     * rendered, and rendering stops if it returns false. Return
+     * false if rendering was stopped or cancelled.
+     */
+    bool renderStrips(sv_frame_t f0, int width,
+                      StripSource source, StripSink sink);
+
+    /**
+     * Render the region starting at frame f0 into the given image,
+     * which must already have been filled with the background
+     * colour, with the region's left edge at xorigin. Strips are
+     * rendered in place in the image.
+     */
+    bool renderToImage(QImage &image, int xorigin, sv_frame_t f0);
+
+    /**
+     * Paint the given layers into a single strip through the given
+     * proxy. If layerMutexes is non-null, it must contain one mutex
+     * per layer, and each layer is painted with its mutex held.
+     * Layers may share a mutex.
+     */
+    void renderStrip(QPainter &paint, ViewStripProxy &proxy,
+                     const std::vector<Layer *> &layers, QColor foreground,
+                     const std::vector<QMutex *> *layerMutexes);
+
+    /**
+     * Fill the strip's area with the background colour and then
+     * render the given layers into it, for serial rendering.
+     */
+    void renderStripWithBackground(QPainter &paint, ViewStripProxy &proxy,
+                                   const std::vector<Layer *> &layers,
+                                   QColor background, QColor foreground);
+
+    /**
+     * Have the given layers drop any per-view state they have been
+     * keeping for the proxy, once rendering through it is finished.
+     */
+    void discardStripState(const ViewStripProxy &proxy,
+                           const std::vector<Layer *> &layers);
+
+    std::vector<Layer *> getRenderableLayers();
+
     QSize scaledSize(const QSize &s, int factor) {
         return QSize(s.width() * factor, s.height() * factor);
     }
@@ -532,6 +635,10 @@ protected:
     void checkAlignmentProgress(ModelId);
 
     bool waitForLayersToBeReady(); // returns false if user cancelled waiting
+
+    void invalidateLayerCaches();
+    void invalidateLayerCache(const Layer *layer);
+    void updateLayerCaches(const LayerList &scrollables, QSize size);
     
     int getProgressBarWidth() const; // if visible
 
@@ -547,13 +654,23 @@ protected:
     bool                m_lightBackground;
     bool                m_showProgress;
 
-    QPixmap            *m_cache;  // I own this
+    // A cache surface retaining the painted state of one or more
+    // scrollable (back) layers from one paint to the next
+    struct LayerCache {
+        LayerList layers; // back to front
+        QPixmap pixmap;
+        bool valid;
+        sv_frame_t centreFrame;
+        ZoomLevel zoomLevel;
+    };
+    
+    std::vector<LayerCache> m_layerCaches; // back to front
+    bool                m_splitLayerCaches; // a surface per layer
     QPixmap            *m_buffer; // I own this
-    bool                m_cacheValid;
-    sv_frame_t          m_cacheCentreFrame;
-    ZoomLevel           m_cacheZoomLevel;
     bool                m_selectionCached;
 
+    static qint64       m_layerCacheMemoryLimit;
+
     bool                m_deleting;
 
     LayerList           m_layerStack; // I don't own these, but see dtor note above
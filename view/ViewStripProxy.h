@@ -0,0 +1,125 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2020 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef VIEW_STRIP_PROXY_H
+#define VIEW_STRIP_PROXY_H
+
+#include "ViewProxy.h"
+
+/**
+ * A ViewProxy that presents a view-sized strip of a view's timeline
+ * lying a given number of pixels to the right of what the view was
+ * showing when the proxy was created, for use when rendering
+ * offscreen (e.g. for image export).
+ *
+ * The view's centre frame, zoom level and size are captured on
+ * construction, so the strip's geometry is unaffected by anything
+ * that happens to the view afterwards and the view itself never has
+ * to be moved in order to paint a strip. Frame/pixel mapping follows
+ * the same rounding rules as View, so adjacent strips join
+ * seamlessly. The strip has no on-screen presence: repaint requests
+ * are ignored and local features are never illuminated.
+ *
+ * The proxy has an id of its own, so any per-view state that layers
+ * keep for it is separate from that of the view, and painting the
+ * view between strips does not disturb it. Copies of a proxy share
+ * its id, so that the strips of a single render can make use of one
+ * another's cached data; a layer must therefore not be painted
+ * through two copies at once. Whoever creates the proxy should call
+ * Layer::discardViewState() with its id for each layer painted
+ * through it, once rendering is complete.
+ */
+class ViewStripProxy : public ViewProxy
+{
+public:
+    ViewStripProxy(View *view, int offset) :
+        ViewProxy(view, 1),
+        m_centreFrame(view->getCentreFrame()),
+        m_zoomLevel(view->getZoomLevel()),
+        m_rect(view->getPaintRect()),
+        m_offset(offset),
+        m_id(getNextId()) { }
+
+    int getId() const override {
+        return m_id;
+    }
+
+    void setOffset(int offset) { m_offset = offset; }
+    int getOffset() const { return m_offset; }
+
+    sv_frame_t getStartFrame() const override {
+        return getFrameForX(0);
+    }
+    sv_frame_t getCentreFrame() const override {
+        return getFrameForX(m_rect.width() / 2);
+    }
+    sv_frame_t getEndFrame() const override {
+        return getFrameForX(m_rect.width()) - 1;
+    }
+
+    int getXForFrame(sv_frame_t frame) const override {
+        // Left-rounding as in View::getXForFrame
+        sv_frame_t level = m_zoomLevel.level;
+        sv_frame_t adjusted;
+        if (m_zoomLevel.zone == ZoomLevel::FramesPerPixel) {
+            sv_frame_t fdiff = frame - (m_centreFrame / level) * level;
+            adjusted = fdiff / level;
+            if ((fdiff < 0) && ((fdiff % level) != 0)) {
+                --adjusted;
+            }
+        } else {
+            adjusted = (frame - m_centreFrame) * level;
+        }
+        return int(adjusted + m_rect.width() / 2 - m_offset);
+    }
+
+    sv_frame_t getFrameForX(int x) const override {
+        // Left-rounding as in View::getFrameForX
+        sv_frame_t diff = sv_frame_t(x) + m_offset - m_rect.width() / 2;
+        sv_frame_t level = m_zoomLevel.level;
+        if (m_zoomLevel.zone == ZoomLevel::FramesPerPixel) {
+            return diff * level + (m_centreFrame / level) * level;
+        } else {
+            sv_frame_t fdiff = diff / level;
+            if ((diff < 0) && ((diff % level) != 0)) {
+                --fdiff;
+            }
+            return fdiff + m_centreFrame;
+        }
+    }
+
+    ZoomLevel getZoomLevel() const override {
+        return m_zoomLevel;
+    }
+    QRect getPaintRect() const override {
+        return m_rect;
+    }
+
+    bool shouldIlluminateLocalFeatures(const Layer *,
+                                       QPoint &) const override {
+        return false;
+    }
+
+    void updatePaintRect(QRect) override { }
+
+private:
+    sv_frame_t m_centreFrame;
+    ZoomLevel m_zoomLevel;
+    QRect m_rect;
+    int m_offset;
+    int m_id;
+};
+
+#endif